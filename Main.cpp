@@ -1,14 +1,41 @@
 #define VC_EXTRALEAN
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <timeapi.h>
 #include <cstdio>
+#include "animation.h"
+#include "assert.h"
+#include "castle.h"
+#include "command_list.h"
+#include "dynamic_resolution.h"
 #include "file.h"
+#include "frame_scheduler.h"
 #include "graphics.h"
+#include "jobs.h"
+#include "lod.h"
+#include "mesh_optimize.h"
+#include "meshlet.h"
 #include "obj_file.h"
+#include "packed_mesh.h"
+#include "occlusion.h"
+#include "present_win32.h"
+#include "pvs.h"
+#include "scene.h"
 #include "string.h"
+#include "texture_atlas.h"
 
+#pragma comment(lib, "winmm.lib")
 
-static void draw_cube(const Matrix_4x4* view_matrix, const Matrix_4x4* projection_matrix, LARGE_INTEGER now, const Texture* texture)
+
+// ps1 resolution was 640x480, each deployment can pick its own as the render
+// target is sized at runtime
+static constexpr int32 c_frame_width = 640;
+static constexpr int32 c_frame_height = 480;
+// 32 bit for single aligned stores, RGB555 for a ps1 accurate dithered look
+static constexpr Pixel_Format c_pixel_format = Pixel_Format::BGRX8888;
+
+
+static void draw_cube(Render_Context* context, const Matrix_4x4* view_matrix, const Matrix_4x4* projection_matrix, LARGE_INTEGER now, const Texture* texture)
 {
 	// vertex/index buffers
 	constexpr Vec_3f vertices[24] = {
@@ -133,7 +160,582 @@ static void draw_cube(const Matrix_4x4* view_matrix, const Matrix_4x4* projectio
 	draw_call.triangle_count = 12;
 	draw_call.texture = texture;
 	
-	project_and_draw(vertices, normals, texcoords, projected_vertices, 24, triangles, &draw_call, 1, light, &inverse_model_matrix, &model_view_projection_matrix);
+	render_context_reserve_vertices(context, 24);
+	project_and_draw(context, vertices, normals, texcoords, projected_vertices, 24, triangles, &draw_call, 1, light, &inverse_model_matrix, &model_view_projection_matrix);
+}
+
+// Sleeps the main thread between frames rather than spinning. Prefers a high
+// resolution waitable timer, falling back to Sleep with the system timer
+// period raised to 1ms on older versions of windows. Either way the last
+// fraction of a millisecond is spun, as wakeups are never exact.
+struct Frame_Sleeper
+{
+	HANDLE timer;
+	bool raised_timer_period;
+};
+
+static Frame_Sleeper frame_sleeper_create()
+{
+	Frame_Sleeper sleeper = {};
+	sleeper.timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (!sleeper.timer)
+	{
+		timeBeginPeriod(1);
+		sleeper.raised_timer_period = true;
+	}
+	return sleeper;
+}
+
+static void frame_sleeper_destroy(Frame_Sleeper* sleeper)
+{
+	if (sleeper->timer)
+	{
+		CloseHandle(sleeper->timer);
+	}
+	if (sleeper->raised_timer_period)
+	{
+		timeEndPeriod(1);
+	}
+	*sleeper = {};
+}
+
+static void frame_sleeper_sleep_until(Frame_Sleeper* sleeper, int64 clock_freq, int64 wake_time)
+{
+	// how early to wake up and spin the rest, the fallback path is only
+	// accurate to around a millisecond either way
+	const int64 spin_margin = sleeper->timer ? clock_freq / 4000 : (clock_freq * 2) / 1000;
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	const int64 sleep_ticks = wake_time - now.QuadPart - spin_margin;
+	if (sleep_ticks > 0)
+	{
+		if (sleeper->timer)
+		{
+			// due time is relative when negative, in 100ns units
+			LARGE_INTEGER due_time;
+			due_time.QuadPart = -(sleep_ticks * 10000000) / clock_freq;
+			if (due_time.QuadPart < 0 && SetWaitableTimer(sleeper->timer, &due_time, 0, nullptr, nullptr, false))
+			{
+				WaitForSingleObject(sleeper->timer, INFINITE);
+			}
+		}
+		else
+		{
+			Sleep((DWORD)((sleep_ticks * 1000) / clock_freq));
+		}
+	}
+
+	do
+	{
+		QueryPerformanceCounter(&now);
+	} while (now.QuadPart < wake_time);
+}
+
+static Model* find_model(Model* models, const char* const* model_paths, int32 model_count, const char* path)
+{
+	for (int32 i = 0; i < model_count; ++i)
+	{
+		if (string_equals(model_paths[i], path))
+		{
+			return &models[i];
+		}
+	}
+
+	assert(false);
+	return nullptr;
+}
+
+// Draws each model on its own, framed to fill a small target so the time is
+// mostly spent on geometry rather than pixels. Geometry is split between the
+// job system's workers if there is one, and models are drawn from their
+// meshlets if they're given. Returns the time taken in seconds.
+static float32 benchmark_model_draws(const Model* models, const Meshlet_Mesh* meshlet_meshes, int32 model_count, Job_System* jobs, int32 repeat_count)
+{
+	constexpr int32 c_width = 64;
+	constexpr int32 c_height = 48;
+	Render_Target target = render_target_create(c_width, c_height, c_pixel_format);
+	Render_Context context = render_context_create(c_height);
+	render_context_set_target(&context, &target);
+	context.jobs = jobs;
+
+	Matrix_4x4 model_matrix;
+	matrix_4x4_translation(&model_matrix, { 0.0f, 0.0f, 0.0f });
+	const Vec_4f light = { -1.0f, 0.0f, 0.0f, 0.0f };
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	for (int32 repeat_i = 0; repeat_i < repeat_count; ++repeat_i)
+	{
+		for (int32 i = 0; i < model_count; ++i)
+		{
+			const Model* model = &models[i];
+			const Vec_3f centre = vec_3f_mul(vec_3f_add(model->bounds_min, model->bounds_max), 0.5f);
+			const Vec_3f size = vec_3f_sub(model->bounds_max, model->bounds_min);
+			const float32 radius = float32_sqrt(vec_3f_dot(size, size)) * 0.5f;
+
+			Matrix_4x4 projection_matrix;
+			matrix_4x4_projection(&projection_matrix, 60.0f * c_deg_to_rad, c_width / (float32)c_height, radius * 0.01f, radius * 10.0f);
+			const Vec_3f camera_position = { centre.x, centre.y - (radius * 2.0f), centre.z };
+			Matrix_4x4 view_matrix;
+			matrix_4x4_camera(&view_matrix, camera_position, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f });
+			Matrix_4x4 model_view_projection_matrix;
+			matrix_4x4_mul(&model_view_projection_matrix, &projection_matrix, &view_matrix);
+
+			graphics_clear(&context);
+			if (meshlet_meshes)
+			{
+				project_and_draw_meshlets(&context, model, &meshlet_meshes[i], light, camera_position, &model_matrix, &model_view_projection_matrix);
+				continue;
+			}
+			render_context_reserve_vertices(&context, model->vertex_count);
+			project_and_draw(&context, model->vertices, model->normals, model->texcoords, context.projected_vertices, model->vertex_count,
+				model->triangles, model->draw_calls, model->draw_call_count, light, &model_matrix, &model_view_projection_matrix);
+		}
+	}
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	render_context_destroy(&context);
+	render_target_destroy(&target);
+
+	return (end.QuadPart - start.QuadPart) / (float32)frequency.QuadPart;
+}
+
+// Draws the town from a few places around the first castle, with the same
+// culling as the main loop. The context draws through the ordering table if
+// one is given, otherwise the depth buffer. Returns the time taken in seconds.
+static float32 benchmark_scene_draws(Scene* scene, const Pvs* pvs, Ordering_Table* ordering_table, int32 repeat_count)
+{
+	Render_Target target = render_target_create(c_frame_width, c_frame_height, c_pixel_format);
+	Render_Context context = render_context_create(c_frame_height);
+	render_context_set_target(&context, &target);
+	context.ordering_table = ordering_table;
+	Occlusion_Buffer occlusion = occlusion_buffer_create(256, 128);
+
+	// outside the gate, in the courtyard, in the street and above the town
+	const Vec_3f camera_positions[] = {
+		{ 5.0f, -4.0f, 0.8f },
+		{ 4.5f, 2.0f, 1.0f },
+		{ 12.0f, -2.0f, 0.8f },
+		{ -10.0f, -10.0f, 20.0f }
+	};
+	constexpr int32 c_camera_count = sizeof(camera_positions) / sizeof(camera_positions[0]);
+	constexpr float32 c_fov_y = 60.0f * c_deg_to_rad;
+	Matrix_4x4 projection_matrix;
+	matrix_4x4_projection(&projection_matrix, c_fov_y, c_frame_width / (float32)c_frame_height, 0.1f, 1000.0f);
+	const Vec_4f light = { -1.0f, 0.0f, 0.0f, 0.0f };
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	for (int32 repeat_i = 0; repeat_i < repeat_count; ++repeat_i)
+	{
+		for (int32 i = 0; i < c_camera_count; ++i)
+		{
+			Matrix_4x4 view_matrix;
+			matrix_4x4_camera(&view_matrix, camera_positions[i], { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f });
+
+			Scene_View view = {};
+			matrix_4x4_mul(&view.view_projection_matrix, &projection_matrix, &view_matrix);
+			view.occlusion = &occlusion;
+			const int32 pvs_cell_index = pvs->visible ? pvs_cell(pvs, camera_positions[i]) : -1;
+			view.potentially_visible = pvs_cell_index != -1 ? pvs_visible_set(pvs, pvs_cell_index) : nullptr;
+			view.lod_scale = c_frame_height * 0.5f / float32_tan(c_fov_y * 0.5f);
+			view.front_to_back = true;
+
+			graphics_clear(&context);
+			scene_draw(&context, scene, &view, light);
+		}
+	}
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	occlusion_buffer_destroy(&occlusion);
+	render_context_destroy(&context);
+	render_target_destroy(&target);
+
+	return (end.QuadPart - start.QuadPart) / (float32)frequency.QuadPart;
+}
+
+// Replays a frame captured with -capture_frame into an offscreen target the
+// size of the window. Returns the time taken in seconds, or -1 if there's no
+// capture for these models.
+static float32 benchmark_replay(const char* path, const Model* models, int32 model_count, int32 repeat_count)
+{
+	Command_List list;
+	Command_View view;
+	if (!command_list_load(&list, &view, models, model_count, path))
+	{
+		return -1.0f;
+	}
+
+	Render_Target target = render_target_create(c_frame_width, c_frame_height, c_pixel_format);
+	Render_Context context = render_context_create(c_frame_height);
+	render_context_set_target(&context, &target);
+	Command_Executor executor = command_executor_create();
+	const Command_List* lists[] = { &list };
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+	for (int32 repeat_i = 0; repeat_i < repeat_count; ++repeat_i)
+	{
+		graphics_clear(&context);
+		command_lists_execute(&executor, &context, lists, 1, &view);
+	}
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	command_executor_destroy(&executor);
+	render_context_destroy(&context);
+	render_target_destroy(&target);
+	command_list_destroy(&list);
+
+	return (end.QuadPart - start.QuadPart) / (float32)frequency.QuadPart;
+}
+
+// Everything done to a model after it's parsed, which only touches that model
+struct Model_Prepare
+{
+	Model* models;
+	// optional, these only get their levels of detail
+	Model* unoptimized_models;
+	Meshlet_Mesh* meshlet_meshes;
+	uint32 acmr_cache_size;
+	// per model, before and after optimising
+	float32* acmr_before;
+	float32* acmr_after;
+};
+
+static void prepare_models(void* data, uint32 begin, uint32 end)
+{
+	const Model_Prepare* prepare = (const Model_Prepare*)data;
+	for (uint32 i = begin; i < end; ++i)
+	{
+		Model* model = &prepare->models[i];
+		model_generate_lods(model, c_max_model_lods);
+		if (prepare->unoptimized_models)
+		{
+			model_generate_lods(&prepare->unoptimized_models[i], c_max_model_lods);
+		}
+
+		prepare->acmr_before[i] = model_acmr(model, 0, prepare->acmr_cache_size);
+		model_optimize(model);
+		prepare->acmr_after[i] = model_acmr(model, 0, prepare->acmr_cache_size);
+		prepare->meshlet_meshes[i] = meshlet_mesh_create(model);
+	}
+}
+
+struct Transform_Benchmark
+{
+	const Render_Context* context;
+	const Scene* scene;
+	const Matrix_4x4* view_projection_matrix;
+	// where each instance's vertices go in the outputs
+	const uint32* vertex_offsets;
+	Vec_3f* projected_vertices;
+	Vec_2f* texcoords;
+};
+
+static void transform_instances(void* data, uint32 begin, uint32 end)
+{
+	const Transform_Benchmark* benchmark = (const Transform_Benchmark*)data;
+	for (uint32 i = begin; i < end; ++i)
+	{
+		const Model_Instance* instance = &benchmark->scene->instances[i];
+		const Model* model = instance->model;
+		Matrix_4x4 model_view_projection_matrix;
+		matrix_4x4_mul(&model_view_projection_matrix, benchmark->view_projection_matrix, &instance->transform);
+
+		const uint32 offset = benchmark->vertex_offsets[i];
+		graphics_project_packed_vertices(benchmark->context, model->packed, model->vertex_count, &model_view_projection_matrix, benchmark->projected_vertices + offset, benchmark->texcoords + offset);
+	}
+}
+
+// Projects every vertex of every instance in the scene, a batch of instances
+// per job, with one thread, then two, and so on up to one per core. Logs the
+// time for each and how much faster it is than one thread.
+static void benchmark_jobs(const Scene* scene, int32 repeat_count)
+{
+	constexpr uint32 c_instances_per_job = 16;
+
+	Render_Target target = render_target_create(c_frame_width, c_frame_height, c_pixel_format);
+	Render_Context context = render_context_create(c_frame_height);
+	render_context_set_target(&context, &target);
+
+	uint32* vertex_offsets = new uint32[scene->instance_count];
+	uint32 vertex_count = 0;
+	for (uint32 i = 0; i < scene->instance_count; ++i)
+	{
+		vertex_offsets[i] = vertex_count;
+		vertex_count += scene->instances[i].model->vertex_count;
+	}
+
+	Matrix_4x4 projection_matrix;
+	matrix_4x4_projection(&projection_matrix, 60.0f * c_deg_to_rad, c_frame_width / (float32)c_frame_height, 0.1f, 1000.0f);
+	Matrix_4x4 view_matrix;
+	matrix_4x4_camera(&view_matrix, { 5.0f, -4.0f, 0.8f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f });
+	Matrix_4x4 view_projection_matrix;
+	matrix_4x4_mul(&view_projection_matrix, &projection_matrix, &view_matrix);
+
+	Transform_Benchmark benchmark = {};
+	benchmark.context = &context;
+	benchmark.scene = scene;
+	benchmark.view_projection_matrix = &view_projection_matrix;
+	benchmark.vertex_offsets = vertex_offsets;
+	benchmark.projected_vertices = new Vec_3f[vertex_count];
+	benchmark.texcoords = new Vec_2f[vertex_count];
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	float32 single_thread_time = 0.0f;
+	const uint32 max_thread_count = job_default_worker_count() + 1;
+	for (uint32 thread_count = 1; thread_count <= max_thread_count; ++thread_count)
+	{
+		Job_System* jobs = job_system_create(thread_count - 1);
+
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+		for (int32 repeat_i = 0; repeat_i < repeat_count; ++repeat_i)
+		{
+			job_parallel_for(jobs, 0, scene->instance_count, c_instances_per_job, transform_instances, &benchmark);
+		}
+		LARGE_INTEGER end;
+		QueryPerformanceCounter(&end);
+
+		job_system_destroy(jobs);
+
+		const float32 time = (end.QuadPart - start.QuadPart) / (float32)frequency.QuadPart;
+		if (thread_count == 1)
+		{
+			single_thread_time = time;
+		}
+
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "job benchmark: %u vertices x %d, %u threads %.3fs, %.2fx\n",
+			vertex_count,
+			repeat_count,
+			thread_count,
+			time,
+			single_thread_time / time);
+		OutputDebugStringA(buffer);
+	}
+
+	delete[] benchmark.projected_vertices;
+	delete[] benchmark.texcoords;
+	delete[] vertex_offsets;
+	render_context_destroy(&context);
+	render_target_destroy(&target);
+}
+
+// characters are in folders of their own under data/models, each with a
+// .anim of its skeleton and clips next to its model
+static constexpr const char* c_character_names[] = { "genome_soldier", "snake" };
+static constexpr uint32 c_character_count = sizeof(c_character_names) / sizeof(c_character_names[0]);
+static constexpr uint32 c_characters_per_job = 8;
+
+static bool load_character(const char* name, Texture_DB* texture_db, Model* out_model, Texture_Atlas* out_atlas, Skin* out_skin)
+{
+	char folder[MAX_PATH];
+	snprintf(folder, sizeof(folder), "data/models/%s", name);
+	char path[MAX_PATH];
+	snprintf(path, sizeof(path), "%s/%s.obj", folder, name);
+	File file = read_file(path);
+	if (!file.data)
+	{
+		return false;
+	}
+	*out_model = model_obj(file, folder, texture_db);
+	delete[] file.data;
+
+	// characters have lots of little textures of their own, so get a page
+	// of their own
+	*out_atlas = texture_atlas_create(out_model, 1);
+	model_use_atlas(out_model, out_atlas);
+
+	// levels of detail and cache order first, the weights are worked out
+	// for the vertices as they end up
+	model_generate_lods(out_model, c_max_model_lods);
+	model_optimize(out_model);
+
+	snprintf(path, sizeof(path), "%s/%s.anim", folder, name);
+	File anim_file = read_file(path);
+	const bool loaded = skin_load(out_skin, out_model, anim_file);
+	delete[] anim_file.data;
+	if (!loaded)
+	{
+		texture_atlas_destroy(out_atlas);
+		model_destroy(out_model);
+	}
+	return loaded;
+}
+
+// Rows of characters, mostly the first skin with every fourth the second,
+// walking on the spot and some waving as they go.
+struct Crowd
+{
+	Skin_Instance* instances;
+	Matrix_4x4* transforms;
+	Matrix_4x4* inverse_transforms;
+	uint32 count;
+};
+
+// front_centre is the middle of the front row, which faces -y
+static Crowd crowd_create(const Skin* skins, uint32 skin_count, uint32 count, Vec_3f front_centre)
+{
+	constexpr uint32 c_row_length = 40;
+	constexpr float32 c_column_spacing = 0.7f;
+	constexpr float32 c_row_spacing = 0.45f;
+	// so they aren't all in step
+	constexpr float32 c_time_stagger = 0.37f;
+	constexpr float32 c_wave_blend = 0.6f;
+
+	Crowd crowd = {};
+	crowd.instances = new Skin_Instance[count];
+	crowd.transforms = new Matrix_4x4[count];
+	crowd.inverse_transforms = new Matrix_4x4[count];
+	crowd.count = count;
+	for (uint32 i = 0; i < count; ++i)
+	{
+		const uint32 column = i % c_row_length;
+		const uint32 row = i / c_row_length;
+		const Skin* skin = &skins[skin_count > 1 && (column + row) % 4 == 3 ? 1 : 0];
+		const uint32 walk = skin_find_clip(skin, "walk");
+		Skin_Instance* instance = &crowd.instances[i];
+		*instance = skin_instance_create(skin, walk != c_no_clip ? walk : 0);
+		instance->time = i * c_time_stagger;
+		const uint32 wave = skin_find_clip(skin, "wave");
+		if (wave != c_no_clip && i % 5 == 0)
+		{
+			instance->blend_clip = wave;
+			instance->blend_time = instance->time;
+			instance->blend = c_wave_blend;
+		}
+
+		const Vec_3f position = {
+			front_centre.x + ((column - ((c_row_length - 1) * 0.5f)) * c_column_spacing),
+			front_centre.y + (row * c_row_spacing),
+			front_centre.z };
+		const Quat rotation = quat_angle_axis({ 0.0f, 0.0f, 1.0f }, ((int32)(i % 3) - 1) * 0.3f);
+		matrix_4x4_transform(&crowd.transforms[i], position, rotation);
+		matrix_4x4_inverse_transform(&crowd.inverse_transforms[i], position, rotation);
+	}
+	return crowd;
+}
+
+static void crowd_destroy(Crowd* crowd)
+{
+	for (uint32 i = 0; i < crowd->count; ++i)
+	{
+		skin_instance_destroy(&crowd->instances[i]);
+	}
+	delete[] crowd->instances;
+	delete[] crowd->transforms;
+	delete[] crowd->inverse_transforms;
+	*crowd = {};
+}
+
+// Picks each character's level of detail like scene_draw does, before
+// they're skinned, so the far ones have fewer vertices to skin.
+static void crowd_select_lods(Crowd* crowd, const Matrix_4x4* view_projection_matrix, float32 lod_scale)
+{
+	for (uint32 i = 0; i < crowd->count; ++i)
+	{
+		Skin_Instance* instance = &crowd->instances[i];
+		const Model* model = instance->skin->model;
+		const Vec_3f centre = vec_3f_mul(vec_3f_add(model->bounds_min, model->bounds_max), 0.5f);
+		const float32 w = matrix_4x4_mul_vec4(view_projection_matrix, matrix_4x4_mul(&crowd->transforms[i], centre)).w;
+		instance->lod = model_select_view_lod(model, instance->lod, lod_scale, w);
+	}
+}
+
+// Draws the characters inside the frustum from their skinned vertices, at
+// the level of detail they were skinned for, returns how many that was.
+static uint32 crowd_draw(Render_Context* context, const Crowd* crowd, const Matrix_4x4* view_projection_matrix, Vec_4f light)
+{
+	// poses reach out past the bind pose's bounds, arms raised and legs out
+	constexpr float32 c_pose_bounds_scale = 1.5f;
+
+	Frustum frustum;
+	frustum_from_matrix(&frustum, view_projection_matrix);
+
+	uint32 drawn = 0;
+	for (uint32 i = 0; i < crowd->count; ++i)
+	{
+		const Skin_Instance* instance = &crowd->instances[i];
+		const Model* model = instance->skin->model;
+		const Vec_3f centre = vec_3f_mul(vec_3f_add(model->bounds_min, model->bounds_max), 0.5f);
+		const Vec_3f size = vec_3f_sub(model->bounds_max, model->bounds_min);
+		const float32 radius = float32_sqrt(vec_3f_dot(size, size)) * 0.5f * c_pose_bounds_scale;
+		if (!frustum_intersects_sphere(&frustum, matrix_4x4_mul(&crowd->transforms[i], centre), radius))
+		{
+			continue;
+		}
+
+		Matrix_4x4 model_view_projection_matrix;
+		matrix_4x4_mul(&model_view_projection_matrix, view_projection_matrix, &crowd->transforms[i]);
+		const Model_Lod* lod = &model->lods[instance->lod];
+		render_context_reserve_vertices(context, lod->vertex_count);
+		project_and_draw(context, instance->vertices, instance->normals, model->texcoords, context->projected_vertices, lod->vertex_count,
+			lod->triangles, lod->draw_calls, model->draw_call_count, light, &crowd->inverse_transforms[i], &model_view_projection_matrix);
+		++drawn;
+	}
+	return drawn;
+}
+
+// Skins a crowd with one thread, then two, and so on up to one per core, and
+// logs the time for each like benchmark_jobs.
+static void benchmark_skinning(const Skin* skins, uint32 skin_count, uint32 character_count, int32 repeat_count)
+{
+	Crowd crowd = crowd_create(skins, skin_count, character_count, {});
+	uint32 vertex_count = 0;
+	for (uint32 i = 0; i < crowd.count; ++i)
+	{
+		vertex_count += crowd.instances[i].skin->model->vertex_count;
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	float32 single_thread_time = 0.0f;
+	const uint32 max_thread_count = job_default_worker_count() + 1;
+	for (uint32 thread_count = 1; thread_count <= max_thread_count; ++thread_count)
+	{
+		Job_System* jobs = job_system_create(thread_count - 1);
+
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+		for (int32 repeat_i = 0; repeat_i < repeat_count; ++repeat_i)
+		{
+			skin_instances_update(jobs, crowd.instances, crowd.count, 1.0f / 60.0f, c_characters_per_job);
+		}
+		LARGE_INTEGER end;
+		QueryPerformanceCounter(&end);
+
+		job_system_destroy(jobs);
+
+		const float32 time = (end.QuadPart - start.QuadPart) / (float32)frequency.QuadPart;
+		if (thread_count == 1)
+		{
+			single_thread_time = time;
+		}
+
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "skinning benchmark: %u characters, %u vertices x %d, %u threads %.3fs, %.2fx\n",
+			crowd.count,
+			vertex_count,
+			repeat_count,
+			thread_count,
+			time,
+			single_thread_time / time);
+		OutputDebugStringA(buffer);
+	}
+
+	crowd_destroy(&crowd);
 }
 
 static bool g_keys[256];
@@ -175,9 +777,8 @@ int WinMain(
 	window_class.lpszClassName = "balder";
 	RegisterClassA(&window_class);
 
-	// ps1 resolution was 640x480, that's the size of client rect we want, 
-	// adjust rect will calculate the window rect we need to have that size of 
-	// client rect
+	// frame size is the size of client rect we want, adjust rect will
+	// calculate the window rect we need to have that size of client rect
 	RECT window_rect = {};
 	window_rect.left = 100;
 	window_rect.right = window_rect.left + c_frame_width;
@@ -200,6 +801,8 @@ int WinMain(
 
 	ShowWindow(window, show_cmd);
 
+	Job_System* jobs = job_system_create(job_default_worker_count());
+
 	Texture_DB texture_db = {};
 
 	struct Found_Model
@@ -235,41 +838,329 @@ int WinMain(
 		FindClose(find);
 	}
 
+	// Run with -benchmark_meshes to time drawing the models with and without
+	// their triangles and vertices reordered at load.
+	const bool benchmark_meshes = string_equals(cmd_line, "-benchmark_meshes");
+	Model* unoptimized_models = benchmark_meshes ? new Model[model_count] : nullptr;
+
+	// cache miss ratios are measured with a FIFO this size, about what the
+	// post transform caches of fixed function hardware had
+	constexpr uint32 c_acmr_cache_size = 16;
+	float32 acmr_before = 0.0f;
+	float32 acmr_after = 0.0f;
+	uint32 total_triangle_count = 0;
+
 	Model* models = new Model[model_count];
-	Matrix_4x4* model_matrices = new Matrix_4x4[model_count];
-	Matrix_4x4* inverse_model_matrices = new Matrix_4x4[model_count];
-	uint32 max_vertices = 0;
+	const char** model_paths = new const char*[model_count];
+	// parsing shares the texture db, so it's done one model at a time here
 	const Found_Model* current_model = found_models;
 	for (int32 i = 0; i < model_count; ++i)
 	{
 		File file = read_file(current_model->filename);
 		models[i] = model_obj(file, "data/models", &texture_db);
-		delete[] file.data;
-
-		max_vertices = uint32_max(max_vertices, models[i].vertex_count);
+		if (unoptimized_models)
+		{
+			unoptimized_models[i] = model_obj(file, "data/models", &texture_db);
+		}
 
-		matrix_4x4_translation(model_matrices + i, {0.0f, i * 2.0f, 0.0f});
-		matrix_4x4_translation(inverse_model_matrices + i, {0.0f, -i * 2.0f, 0.0f});
+		model_paths[i] = string_copy(current_model->filename);
+		delete[] file.data;
 
 		const Found_Model* temp = current_model;
 		current_model = current_model->next;
 		delete temp;
 	}
 
-	Vec_3f* projected_vertices = new Vec_3f[max_vertices];
+	// Small textures are packed onto one atlas page, so models using only
+	// those are a single draw call with a single texture.
+	Texture_Atlas atlas = texture_atlas_create(models, model_count);
+	uint32 draw_calls_before = 0;
+	uint32 draw_calls_after = 0;
+	for (int32 i = 0; i < model_count; ++i)
+	{
+		draw_calls_before += models[i].draw_call_count;
+		model_use_atlas(&models[i], &atlas);
+		draw_calls_after += models[i].draw_call_count;
+		if (unoptimized_models)
+		{
+			model_use_atlas(&unoptimized_models[i], &atlas);
+		}
+	}
+
+	{
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "texture atlas: %u textures on a %ux%u page, draw calls %u -> %u\n",
+			atlas.tile_count,
+			atlas.page.width,
+			atlas.page.height,
+			draw_calls_before,
+			draw_calls_after);
+		OutputDebugStringA(buffer);
+	}
+
+	// the rest only touches one model at a time, so the models are spread over the cores
+	Meshlet_Mesh* meshlet_meshes = new Meshlet_Mesh[model_count];
+	Model_Prepare prepare = {};
+	prepare.models = models;
+	prepare.unoptimized_models = unoptimized_models;
+	prepare.meshlet_meshes = meshlet_meshes;
+	prepare.acmr_cache_size = c_acmr_cache_size;
+	prepare.acmr_before = new float32[model_count];
+	prepare.acmr_after = new float32[model_count];
+	job_parallel_for(jobs, 0, model_count, 1, prepare_models, &prepare);
+	for (int32 i = 0; i < model_count; ++i)
+	{
+		const uint32 triangle_count = models[i].lods[0].triangle_count;
+		acmr_before += prepare.acmr_before[i] * triangle_count;
+		acmr_after += prepare.acmr_after[i] * triangle_count;
+		total_triangle_count += triangle_count;
+	}
+	delete[] prepare.acmr_before;
+	delete[] prepare.acmr_after;
+
+	{
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "mesh optimisation: acmr %.3f -> %.3f over %u triangles\n",
+			acmr_before / total_triangle_count,
+			acmr_after / total_triangle_count,
+			total_triangle_count);
+		OutputDebugStringA(buffer);
+	}
+
+	if (unoptimized_models)
+	{
+		constexpr int32 c_benchmark_repeat_count = 1000;
+		const float32 unoptimized_time = benchmark_model_draws(unoptimized_models, nullptr, model_count, nullptr, c_benchmark_repeat_count);
+		const float32 optimized_time = benchmark_model_draws(models, nullptr, model_count, nullptr, c_benchmark_repeat_count);
+		const float32 parallel_time = benchmark_model_draws(models, nullptr, model_count, jobs, c_benchmark_repeat_count);
+		const float32 meshlet_time = benchmark_model_draws(models, meshlet_meshes, model_count, nullptr, c_benchmark_repeat_count);
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "mesh benchmark: %d models x %d, unoptimized %.3fs, optimized %.3fs, parallel geometry %.3fs, meshlets %.3fs\n",
+			model_count,
+			c_benchmark_repeat_count,
+			unoptimized_time,
+			optimized_time,
+			parallel_time,
+			meshlet_time);
+		OutputDebugStringA(buffer);
+	}
+
+	// the scene draws from compact copies of the meshes, the model's own
+	// arrays are still there for anything that wants floats
+	Packed_Mesh* packed_meshes = new Packed_Mesh[model_count];
+	{
+		uint32 unpacked_size = 0;
+		uint32 packed_size = 0;
+		for (int32 i = 0; i < model_count; ++i)
+		{
+			packed_meshes[i] = packed_mesh_create(&models[i]);
+			models[i].packed = &packed_meshes[i];
+			unpacked_size += model_mesh_size(&models[i]);
+			packed_size += packed_mesh_size(&packed_meshes[i]);
+		}
+
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "packed meshes: %u -> %u bytes\n", unpacked_size, packed_size);
+		OutputDebugStringA(buffer);
+	}
+
+	// the big kit pieces hide what's behind them, their small detail
+	// triangles aren't worth drawing as occluders
+	const char* const c_occluder_model_paths[] = {
+		"data/models/wall.obj",
+		"data/models/wall_gate.obj",
+		"data/models/tower_base.obj",
+		"data/models/tower.obj"
+	};
+	constexpr int32 c_occluder_count = sizeof(c_occluder_model_paths) / sizeof(c_occluder_model_paths[0]);
+	constexpr float32 c_min_occluder_triangle_area = 0.1f;
+	Occluder occluders[c_occluder_count];
+	for (int32 i = 0; i < c_occluder_count; ++i)
+	{
+		Model* model = find_model(models, model_paths, model_count, c_occluder_model_paths[i]);
+		occluders[i] = occluder_create(model, c_min_occluder_triangle_area);
+		model->occluder = &occluders[i];
+	}
+
+	Castle_Kit castle_kit = {};
+	castle_kit.wall = find_model(models, model_paths, model_count, "data/models/wall.obj");
+	castle_kit.wall_gate = find_model(models, model_paths, model_count, "data/models/wall_gate.obj");
+	castle_kit.tower_base = find_model(models, model_paths, model_count, "data/models/tower_base.obj");
+	castle_kit.tower = find_model(models, model_paths, model_count, "data/models/tower.obj");
+	castle_kit.tower_top = find_model(models, model_paths, model_count, "data/models/tower_top.obj");
+	castle_kit.floor = find_model(models, model_paths, model_count, "data/models/floor_flat.obj");
+	castle_kit.crate = find_model(models, model_paths, model_count, "data/models/detail_crate.obj");
+	castle_kit.barrel = find_model(models, model_paths, model_count, "data/models/detail_barrel.obj");
+
+	// a town of castles, each piece of each castle is an instance of one of
+	// the kit models
+	constexpr int32 c_town_castles_x = 8;
+	constexpr int32 c_town_castles_y = 8;
+	constexpr int32 c_castle_wall_length = 10;
+	constexpr int32 c_castle_spacing = 4;
+	Scene scene = scene_create(1024);
+	castle_build_town(&scene, &castle_kit, c_town_castles_x, c_town_castles_y, c_castle_wall_length, c_castle_spacing);
+
+	// The town never changes, so what can be seen from where is baked
+	// offline. Run with -bake_pvs to rebake it after changing the town.
+	constexpr const char* c_pvs_path = "data/town.pvs";
+	Pvs pvs = {};
+	if (string_equals(cmd_line, "-bake_pvs"))
+	{
+		constexpr float32 c_pvs_cell_size = 2.0f;
+		const float32 town_size = ((c_castle_wall_length + c_castle_spacing) * c_town_castles_x) + c_castle_spacing;
+		Pvs_Bake_Settings settings = {};
+		settings.origin = { -(float32)c_castle_spacing, -(float32)c_castle_spacing, 0.5f };
+		settings.cell_size = c_pvs_cell_size;
+		settings.cells_x = (int32)(town_size / c_pvs_cell_size) + 1;
+		settings.cells_y = settings.cells_x;
+		settings.max_z = 1.5f;
+		settings.samples_per_cell = 2;
+		settings.height_samples = 2;
+		settings.resolution = 128;
+		settings.near_plane = 0.1f;
+		settings.far_plane = 1000.0f;
+
+		LARGE_INTEGER bake_start;
+		QueryPerformanceCounter(&bake_start);
+		pvs = pvs_bake(&scene, &settings);
+		LARGE_INTEGER bake_end;
+		QueryPerformanceCounter(&bake_end);
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+
+		const bool saved = pvs_save(&pvs, c_pvs_path);
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "baked pvs: %d cells in %.1fs, %s\n",
+			pvs.cells_x * pvs.cells_y,
+			(bake_end.QuadPart - bake_start.QuadPart) / (float32)frequency.QuadPart,
+			saved ? "saved" : "failed to save");
+		OutputDebugStringA(buffer);
+	}
+	else if (pvs_load(&pvs, c_pvs_path) && pvs.instance_count != scene.instance_count)
+	{
+		// baked for a different town
+		pvs_destroy(&pvs);
+	}
+
+	// The PS1 had no depth buffer, triangles were sorted into an ordering
+	// table and drawn back to front. Run with -ordering_table to draw that
+	// way, or with -benchmark_ordering_table to compare it with the depth
+	// buffer.
+	constexpr uint32 c_ordering_table_size = 4096;
+	Ordering_Table ordering_table = ordering_table_create(c_ordering_table_size);
+	if (string_equals(cmd_line, "-benchmark_ordering_table"))
+	{
+		constexpr int32 c_benchmark_repeat_count = 100;
+		const float32 depth_buffer_time = benchmark_scene_draws(&scene, &pvs, nullptr, c_benchmark_repeat_count);
+		const float32 ordering_table_time = benchmark_scene_draws(&scene, &pvs, &ordering_table, c_benchmark_repeat_count);
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "scene benchmark: %d repeats, depth buffer %.3fs, ordering table %.3fs\n",
+			c_benchmark_repeat_count,
+			depth_buffer_time,
+			ordering_table_time);
+		OutputDebugStringA(buffer);
+	}
+
+	// Run with -benchmark_jobs to see how transforming vertices scales with
+	// the number of threads.
+	if (string_equals(cmd_line, "-benchmark_jobs"))
+	{
+		constexpr int32 c_benchmark_repeat_count = 100;
+		benchmark_jobs(&scene, c_benchmark_repeat_count);
+	}
+
+	// Run with -characters to have a crowd of them walking on the spot in
+	// front of the start, skinned every frame, or -benchmark_skinning to time
+	// skinning them.
+	constexpr uint32 c_crowd_size = 240;
+	Model character_models[c_character_count] = {};
+	Texture_Atlas character_atlases[c_character_count] = {};
+	Skin skins[c_character_count] = {};
+	uint32 skin_count = 0;
+	for (uint32 i = 0; i < c_character_count; ++i)
+	{
+		if (load_character(c_character_names[i], &texture_db, &character_models[skin_count], &character_atlases[skin_count], &skins[skin_count]))
+		{
+			++skin_count;
+		}
+	}
+	if (skin_count && string_equals(cmd_line, "-benchmark_skinning"))
+	{
+		constexpr int32 c_benchmark_repeat_count = 100;
+		benchmark_skinning(skins, skin_count, c_crowd_size, c_benchmark_repeat_count);
+	}
+	Crowd crowd = {};
+	if (skin_count && string_equals(cmd_line, "-characters"))
+	{
+		crowd = crowd_create(skins, skin_count, c_crowd_size, { c_castle_wall_length * 0.5f, -2.6f, 0.0f });
+	}
+	float32 crowd_time_step = 0.0f;
 
-	Vec_3f camera_pos = {};
+	// Run with -command_lists to record the scene's draws and execute them
+	// rather than drawing straight away, or with -capture_frame to do that and
+	// save the first frame's. -benchmark_replay times replaying the capture.
+	constexpr const char* c_capture_path = "data/frame.cmd";
+	bool capture_frame = string_equals(cmd_line, "-capture_frame");
+	const bool use_command_lists = capture_frame || string_equals(cmd_line, "-command_lists");
+	Command_List command_list = command_list_create();
+	Command_Executor command_executor = command_executor_create();
+	if (string_equals(cmd_line, "-benchmark_replay"))
+	{
+		constexpr int32 c_benchmark_repeat_count = 100;
+		const float32 replay_time = benchmark_replay(c_capture_path, models, model_count, c_benchmark_repeat_count);
+		char buffer[256];
+		if (replay_time >= 0.0f)
+		{
+			snprintf(buffer, sizeof(buffer), "replay benchmark: %d repeats, %.3fs\n", c_benchmark_repeat_count, replay_time);
+		}
+		else
+		{
+			snprintf(buffer, sizeof(buffer), "replay benchmark: no capture at %s, run with -capture_frame first\n", c_capture_path);
+		}
+		OutputDebugStringA(buffer);
+	}
+
+	// frames are rendered into targets owned by the present queue, shrunk by
+	// dynamic resolution when we go over budget. The present thread stretches
+	// them back to the window size and draws them while we render the next.
+	constexpr int32 c_present_buffer_count = 2;
+	Present_Queue* present_queue = present_queue_create(presenter_window(window), c_present_buffer_count, c_frame_width, c_frame_height, c_pixel_format, Upscale_Filter::Nearest);
+	Render_Context render_context = render_context_create(c_frame_height);
+	render_context.jobs = jobs;
+	// Run with -visibility_buffer to rasterise everything first and then
+	// texture and light each pixel once, rather than as it's drawn.
+	const bool visibility_buffer = string_equals(cmd_line, "-visibility_buffer");
+	if (string_equals(cmd_line, "-ordering_table"))
+	{
+		render_context.ordering_table = &ordering_table;
+	}
+	constexpr int32 c_occlusion_width = 256;
+	constexpr int32 c_occlusion_height = 128;
+	Occlusion_Buffer occlusion = occlusion_buffer_create(c_occlusion_width, c_occlusion_height);
+
+	// start outside the first castle's gate, at head height
+	Vec_3f camera_pos = { c_castle_wall_length * 0.5f, -4.0f, 0.8f };
+	Vec_3f previous_camera_pos = camera_pos;
 
 	LARGE_INTEGER clock_freq;
 	QueryPerformanceFrequency(&clock_freq);
-	LARGE_INTEGER last_frame_time;
-	QueryPerformanceCounter(&last_frame_time);
-	constexpr float c_framerate = 60.0f;
-	constexpr float c_frame_duration_s = 1.0f / c_framerate;
-	const LONGLONG c_frame_duration = (LONGLONG)(clock_freq.QuadPart * c_frame_duration_s);
+	LARGE_INTEGER start_time;
+	QueryPerformanceCounter(&start_time);
+	constexpr float32 c_simulation_rate = 60.0f;
+	constexpr float32 c_simulation_step_s = 1.0f / c_simulation_rate;
+	constexpr float32 c_render_rate = 60.0f;
+	constexpr float32 c_render_interval_s = 1.0f / c_render_rate;
+	constexpr int32 c_max_simulation_steps_per_frame = 5;
+	Frame_Scheduler scheduler = frame_scheduler_create(clock_freq.QuadPart, c_simulation_step_s, c_render_interval_s, c_max_simulation_steps_per_frame, start_time.QuadPart);
+	Frame_Sleeper sleeper = frame_sleeper_create();
+
+	// leave some of the frame for simulation and present
+	constexpr float32 c_raster_budget_s = c_render_interval_s * 0.75f;
+	constexpr float32 c_min_resolution_scale = 0.25f;
+	Dynamic_Resolution dynamic_resolution = dynamic_resolution_create(c_raster_budget_s, c_min_resolution_scale);
 	bool quit = false;
 	MSG msg;
-	int a = 0;
 	while (!quit)
 	{
 		while (PeekMessageA(&msg, window, 0, 0, PM_REMOVE))
@@ -286,10 +1177,12 @@ int WinMain(
 
 		LARGE_INTEGER now;
 		QueryPerformanceCounter(&now);
-		const LONGLONG dt = (now.QuadPart - last_frame_time.QuadPart);
 
-		if (dt >= c_frame_duration)
+		const int32 simulation_steps = frame_scheduler_update(&scheduler, now.QuadPart);
+		for (int32 step = 0; step < simulation_steps; ++step)
 		{
+			previous_camera_pos = camera_pos;
+
 			constexpr float32 c_camera_speed = 10.0f;
 			Vec_3f camera_movement = {};
 			if (g_keys['W'])
@@ -308,14 +1201,31 @@ int WinMain(
 			{
 				camera_movement.x -= 1.0f;
 			}
-			camera_movement = vec_3f_mul(vec_3f_normalised(camera_movement), c_camera_speed * c_frame_duration_s);
+			camera_movement = vec_3f_mul(vec_3f_normalised(camera_movement), c_camera_speed * c_simulation_step_s);
 			camera_pos = vec_3f_add(camera_pos, camera_movement);
 
+			crowd_time_step += c_simulation_step_s;
+		}
+
+		if (frame_scheduler_begin_render(&scheduler, now.QuadPart))
+		{
+			Render_Target* render_target = present_queue_acquire(present_queue);
+			if (visibility_buffer)
+			{
+				render_target_enable_visibility(render_target);
+			}
+
 			LARGE_INTEGER frame_start;
 			QueryPerformanceCounter(&frame_start);
 
-			// TODO what if dt >= (2*c_frame_duration)?
-			last_frame_time.QuadPart += c_frame_duration;
+			int32 render_width;
+			int32 render_height;
+			dynamic_resolution_size(&dynamic_resolution, c_frame_width, c_frame_height, &render_width, &render_height);
+			render_target_resize(render_target, render_width, render_height);
+			render_context_set_target(&render_context, render_target);
+
+			const float32 alpha = frame_scheduler_alpha(&scheduler, frame_start.QuadPart);
+			const Vec_3f render_camera_pos = vec_3f_lerp(previous_camera_pos, camera_pos, alpha);
 			
 			constexpr float32 c_fov_y = 60.0f * c_deg_to_rad;
 			constexpr float32 c_near = 0.1f;
@@ -324,50 +1234,151 @@ int WinMain(
 			matrix_4x4_projection(&projection_matrix, c_fov_y, c_frame_width / (float32)c_frame_height, c_near, c_far);
 
 			Matrix_4x4 view_matrix;
-			matrix_4x4_camera(&view_matrix, camera_pos, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f });
+			matrix_4x4_camera(&view_matrix, render_camera_pos, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f });
 
 			Matrix_4x4 view_projection_matrix;
 			matrix_4x4_mul(&view_projection_matrix, &projection_matrix, &view_matrix);
 
 			// clear previous draw
-			graphics_clear();
+			graphics_clear(&render_context);
 
-			//draw_cube(&view_matrix, &projection_matrix, now, &texture_db.next->texture);
+			//draw_cube(&render_context, &view_matrix, &projection_matrix, now, &texture_db.next->texture);
 			
 			const Vec_4f light = { -1.0f, 0.0f, 0.0f, 0.0f };
 
-			for (int32 i = 0; i < model_count; ++i)
+			Scene_View view = {};
+			view.view_projection_matrix = view_projection_matrix;
+			view.occlusion = &occlusion;
+			const int32 pvs_cell_index = pvs.visible ? pvs_cell(&pvs, render_camera_pos) : -1;
+			view.potentially_visible = pvs_cell_index != -1 ? pvs_visible_set(&pvs, pvs_cell_index) : nullptr;
+			// the projection maps tan(fov / 2) at a distance of one to half the height
+			view.lod_scale = render_height * 0.5f / float32_tan(c_fov_y * 0.5f);
+			view.front_to_back = true;
+
+			// characters go first, the scene is drawn over them with the same
+			// depth test, ordering table or visibility buffer
+			uint32 characters_drawn = 0;
+			// skinning costs the same at any resolution, so it's left out of
+			// the time dynamic resolution goes by
+			int64 skinning_ticks = 0;
+			if (crowd.count)
 			{
-				Matrix_4x4 model_view_projection_matrix;
-				matrix_4x4_mul(&model_view_projection_matrix, &view_projection_matrix, &model_matrices[i]);
-
-				project_and_draw(
-					models[i].vertices,
-					models[i].normals,
-					models[i].texcoords,
-					projected_vertices,
-					models[i].vertex_count,
-					models[i].triangles,
-					models[i].draw_calls,
-					models[i].draw_call_count,
-					light,
-					&inverse_model_matrices[i],
-					&model_view_projection_matrix);
+				crowd_select_lods(&crowd, &view_projection_matrix, view.lod_scale);
+				LARGE_INTEGER skinning_start;
+				QueryPerformanceCounter(&skinning_start);
+				skin_instances_update(jobs, crowd.instances, crowd.count, crowd_time_step, c_characters_per_job);
+				LARGE_INTEGER skinning_end;
+				QueryPerformanceCounter(&skinning_end);
+				skinning_ticks = skinning_end.QuadPart - skinning_start.QuadPart;
+				crowd_time_step = 0.0f;
+				characters_drawn = crowd_draw(&render_context, &crowd, &view_projection_matrix, light);
 			}
 
-			graphics_draw_to_window(window);
+			Scene_Draw_Stats draw_stats;
+			if (use_command_lists)
+			{
+				command_list_reset(&command_list);
+				draw_stats = scene_record_draws(&scene, &view, &command_list);
+
+				Command_View command_view = {};
+				command_view.view_projection_matrix = view_projection_matrix;
+				command_view.light = light;
+				command_view.lod_scale = view.lod_scale;
+				const Command_List* command_lists[] = { &command_list };
+				const Command_Stats command_stats = command_lists_execute(&command_executor, &render_context, command_lists, 1, &command_view);
+				draw_stats.triangles_submitted = command_stats.triangles_submitted;
+				draw_stats.pixels_shaded = command_stats.pixels_shaded;
+
+				if (capture_frame)
+				{
+					const bool saved = command_list_save(&command_list, &command_view, models, model_count, c_capture_path);
+					OutputDebugStringA(saved ? "captured frame\n" : "failed to save captured frame\n");
+					capture_frame = false;
+				}
+			}
+			else
+			{
+				draw_stats = scene_draw(&render_context, &scene, &view, light);
+			}
+
+			LARGE_INTEGER raster_end;
+			QueryPerformanceCounter(&raster_end);
+			dynamic_resolution_update(&dynamic_resolution, (raster_end.QuadPart - frame_start.QuadPart - skinning_ticks) / (float32)clock_freq.QuadPart);
+
+			present_queue_submit(present_queue, render_target);
 
 			LARGE_INTEGER frame_end;
 			QueryPerformanceCounter(&frame_end);
 
+			const Present_Stats present_stats = present_queue_stats(present_queue);
+
 			// TODO maybe make a debug printf func with a shared buffer?
-			char buffer[64];
-			snprintf(buffer, sizeof(buffer), "FPS: %lld\n", clock_freq.QuadPart / (frame_end.QuadPart - frame_start.QuadPart));
+			char buffer[512];
+			snprintf(buffer, sizeof(buffer), "FPS: %lld scale: %.3f missed steps: %llu dropped steps: %llu missed renders: %llu present latency: %.2fms queue depth: %d drawn: %u culled: %u not in pvs: %u occluded: %u (%u occluders) bvh nodes: %u triangles: %u relit: %u (%u local lights) overdraw: %.2f characters: %u\n",
+				clock_freq.QuadPart / (frame_end.QuadPart - frame_start.QuadPart),
+				dynamic_resolution_scale(&dynamic_resolution),
+				scheduler.missed_steps,
+				scheduler.dropped_steps,
+				scheduler.missed_renders,
+				present_stats.average_latency_s * 1000.0f,
+				present_stats.queue_depth,
+				draw_stats.instances_drawn,
+				draw_stats.instances_culled,
+				draw_stats.instances_not_potentially_visible,
+				draw_stats.instances_occluded,
+				draw_stats.occluders_drawn,
+				draw_stats.bvh_nodes_visited,
+				draw_stats.triangles_submitted,
+				draw_stats.instances_relit,
+				draw_stats.instance_lights,
+				draw_stats.pixels_shaded / (float32)(render_width * render_height),
+				characters_drawn);
 			OutputDebugStringA(buffer);
 		}
 
-		// TODO sleep unused cycles
+		frame_sleeper_sleep_until(&sleeper, clock_freq.QuadPart, frame_scheduler_next_wake(&scheduler));
+	}
+
+	frame_sleeper_destroy(&sleeper);
+	present_queue_destroy(present_queue);
+	render_context_destroy(&render_context);
+	occlusion_buffer_destroy(&occlusion);
+	command_executor_destroy(&command_executor);
+	command_list_destroy(&command_list);
+	ordering_table_destroy(&ordering_table);
+	crowd_destroy(&crowd);
+	for (uint32 i = 0; i < skin_count; ++i)
+	{
+		skin_destroy(&skins[i]);
+		model_destroy(&character_models[i]);
+	}
+	for (uint32 i = 0; i < c_character_count; ++i)
+	{
+		texture_atlas_destroy(&character_atlases[i]);
+	}
+	job_system_destroy(jobs);
+	pvs_destroy(&pvs);
+	scene_destroy(&scene);
+	for (int32 i = 0; i < c_occluder_count; ++i)
+	{
+		occluder_destroy(&occluders[i]);
+	}
+	for (int32 i = 0; i < model_count; ++i)
+	{
+		models[i].packed = nullptr;
+		packed_mesh_destroy(&packed_meshes[i]);
+		meshlet_mesh_destroy(&meshlet_meshes[i]);
+		delete[] model_paths[i];
+		if (unoptimized_models)
+		{
+			model_destroy(&unoptimized_models[i]);
+		}
 	}
+	delete[] packed_meshes;
+	delete[] meshlet_meshes;
+	delete[] model_paths;
+	delete[] unoptimized_models;
+	texture_atlas_destroy(&atlas);
 
 	return int(msg.wParam);
 }
\ No newline at end of file
@@ -0,0 +1,566 @@
+#include "animation.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <xmmintrin.h>
+#include "assert.h"
+#include "jobs.h"
+#include "string.h"
+
+
+static constexpr uint32 c_max_anim_line = 256;
+static constexpr uint32 c_max_anim_word = 64;
+// Vertex weights fall off with the fourth power of the distance to each bone,
+// so a vertex is moved almost entirely by its nearest bone, blending between
+// them only where bones meet.
+static constexpr float32 c_weight_falloff_power = 4.0f;
+
+
+// the model's axes to the scene's, z up
+struct Anim_Import
+{
+	float32 scale;
+	char up;
+};
+
+static Vec_3f import_direction(const Anim_Import* import, Vec_3f v)
+{
+	switch (import->up)
+	{
+	case 'x':
+		return { -v.z, v.y, v.x };
+	case 'y':
+		return { v.x, -v.z, v.y };
+	default:
+		return v;
+	}
+}
+
+static Vec_3f import_position(const Anim_Import* import, Vec_3f v)
+{
+	return vec_3f_mul(import_direction(import, v), import->scale);
+}
+
+// reads the next whitespace separated word, false if there isn't one
+static bool anim_read_word(const char** iter, char* out_word)
+{
+	const char* str = *iter;
+	while (*str && char_is_whitespace(*str))
+	{
+		++str;
+	}
+
+	uint32 length = 0;
+	while (*str && !char_is_whitespace(*str))
+	{
+		if (length < c_max_anim_word - 1)
+		{
+			out_word[length] = *str;
+			++length;
+		}
+		++str;
+	}
+	out_word[length] = '\0';
+
+	*iter = str;
+	return length > 0;
+}
+
+static bool anim_read_floats(const char** iter, float32* out_floats, uint32 float_count)
+{
+	for (uint32 i = 0; i < float_count; ++i)
+	{
+		char* end;
+		out_floats[i] = (float32)strtod(*iter, &end);
+		if (end == *iter)
+		{
+			return false;
+		}
+		*iter = end;
+	}
+	return true;
+}
+
+// copies the next line into out_line without its newline, false at the end
+static bool anim_next_line(const char** iter, const char* end, char* out_line)
+{
+	const char* str = *iter;
+	if (str >= end)
+	{
+		return false;
+	}
+
+	uint32 length = 0;
+	while (str < end && *str != '\n')
+	{
+		if (length < c_max_anim_line - 1)
+		{
+			out_line[length] = *str;
+			++length;
+		}
+		++str;
+	}
+	out_line[length] = '\0';
+
+	*iter = str < end ? str + 1 : end;
+	return true;
+}
+
+static uint32 find_joint(const Joint* joints, uint32 joint_count, const char* name)
+{
+	for (uint32 i = 0; i < joint_count; ++i)
+	{
+		if (string_equals(joints[i].name, name))
+		{
+			return i;
+		}
+	}
+	return c_no_joint;
+}
+
+static float32 distance_sq_to_segment(Vec_3f point, Vec_3f a, Vec_3f b)
+{
+	const Vec_3f ab = vec_3f_sub(b, a);
+	const float32 length_sq = vec_3f_dot(ab, ab);
+	const float32 t = length_sq > 0.0f ? float32_clamp(0.0f, 1.0f, vec_3f_dot(vec_3f_sub(point, a), ab) / length_sq) : 0.0f;
+	const Vec_3f offset = vec_3f_sub(point, vec_3f_add(a, vec_3f_mul(ab, t)));
+	return vec_3f_dot(offset, offset);
+}
+
+// Each joint but the root ends a bone from its parent, which the parent
+// moves. Vertices are weighted to the parents of the nearest few bones.
+static void skin_compute_weights(Skin* skin)
+{
+	const Model* model = skin->model;
+	const Vec_3f size = vec_3f_sub(model->bounds_max, model->bounds_min);
+	// keeps vertices right on a bone from dividing by zero
+	const float32 min_distance_sq = vec_3f_dot(size, size) * 1e-8f;
+
+	for (uint32 vertex_i = 0; vertex_i < model->vertex_count; ++vertex_i)
+	{
+		float32 joint_weights[c_max_joints] = {};
+		for (uint32 joint_i = 0; joint_i < skin->joint_count; ++joint_i)
+		{
+			const Joint* joint = &skin->joints[joint_i];
+			if (joint->parent == c_no_joint)
+			{
+				continue;
+			}
+
+			const float32 distance_sq = float32_max(distance_sq_to_segment(model->vertices[vertex_i], skin->joints[joint->parent].bind_position, joint->bind_position), min_distance_sq);
+			// a joint with several children gets the nearest of its bones
+			const float32 weight = 1.0f / float32_pow(distance_sq, c_weight_falloff_power * 0.5f);
+			joint_weights[joint->parent] = float32_max(joint_weights[joint->parent], weight);
+		}
+
+		// keep the heaviest few
+		Vertex_Weights* weights = &skin->weights[vertex_i];
+		*weights = {};
+		for (uint32 influence_i = 0; influence_i < c_max_joint_influences; ++influence_i)
+		{
+			uint32 heaviest = 0;
+			for (uint32 joint_i = 1; joint_i < skin->joint_count; ++joint_i)
+			{
+				if (joint_weights[joint_i] > joint_weights[heaviest])
+				{
+					heaviest = joint_i;
+				}
+			}
+
+			weights->joints[influence_i] = (uint8)heaviest;
+			weights->weights[influence_i] = joint_weights[heaviest];
+			joint_weights[heaviest] = 0.0f;
+		}
+
+		float32 total = 0.0f;
+		for (uint32 i = 0; i < c_max_joint_influences; ++i)
+		{
+			total += weights->weights[i];
+		}
+		for (uint32 i = 0; i < c_max_joint_influences; ++i)
+		{
+			weights->weights[i] = total > 0.0f ? weights->weights[i] / total : (i == 0 ? 1.0f : 0.0f);
+		}
+	}
+}
+
+bool skin_load(Skin* out_skin, Model* model, File anim_file)
+{
+	if (!anim_file.data)
+	{
+		return false;
+	}
+
+	const char* const end = (const char*)anim_file.data + anim_file.size;
+	char line[c_max_anim_line];
+	char word[c_max_anim_word];
+	char parent_name[c_max_anim_word];
+
+	// count everything first, so it can all be allocated up front
+	uint32 joint_count = 0;
+	uint32 clip_count = 0;
+	uint32 frame_count = 0;
+	const char* iter = (const char*)anim_file.data;
+	while (anim_next_line(&iter, end, line))
+	{
+		const char* line_iter = line;
+		if (!anim_read_word(&line_iter, word))
+		{
+			continue;
+		}
+
+		if (string_equals(word, "joint"))
+		{
+			++joint_count;
+		}
+		else if (string_equals(word, "clip"))
+		{
+			++clip_count;
+		}
+		else if (string_equals(word, "frame"))
+		{
+			++frame_count;
+		}
+	}
+
+	if (joint_count == 0 || joint_count > c_max_joints)
+	{
+		return false;
+	}
+
+	Skin skin = {};
+	skin.model = model;
+	skin.joints = new Joint[joint_count];
+	skin.clips = new Animation_Clip[clip_count];
+	Joint_Pose* frames = new Joint_Pose[frame_count * joint_count];
+
+	Anim_Import import = { 1.0f, 'z' };
+	bool success = true;
+	Animation_Clip* clip = nullptr;
+	Joint_Pose* frame = nullptr;
+	uint32 next_frame = 0;
+	iter = (const char*)anim_file.data;
+	while (success && anim_next_line(&iter, end, line))
+	{
+		const char* line_iter = line;
+		if (!anim_read_word(&line_iter, word) || word[0] == '#')
+		{
+			continue;
+		}
+
+		if (string_equals(word, "scale"))
+		{
+			success = anim_read_floats(&line_iter, &import.scale, 1);
+		}
+		else if (string_equals(word, "up"))
+		{
+			success = anim_read_word(&line_iter, word) && (word[0] == 'x' || word[0] == 'y' || word[0] == 'z');
+			import.up = word[0];
+		}
+		else if (string_equals(word, "joint"))
+		{
+			Joint* joint = &skin.joints[skin.joint_count];
+			Vec_3f position;
+			success = anim_read_word(&line_iter, word) &&
+				anim_read_word(&line_iter, parent_name) &&
+				anim_read_floats(&line_iter, position.v, 3);
+			if (success)
+			{
+				joint->name = string_copy(word);
+				joint->parent = string_equals(parent_name, "-") ? c_no_joint : find_joint(skin.joints, skin.joint_count, parent_name);
+				joint->bind_position = import_position(&import, position);
+				++skin.joint_count;
+				// parents have to come first
+				success = joint->parent != c_no_joint || skin.joint_count == 1;
+			}
+		}
+		else if (string_equals(word, "clip"))
+		{
+			clip = &skin.clips[skin.clip_count];
+			*clip = {};
+			success = anim_read_word(&line_iter, word) && anim_read_floats(&line_iter, &clip->frames_per_second, 1) && clip->frames_per_second > 0.0f;
+			clip->name = string_copy(word);
+			clip->frames = &frames[next_frame * joint_count];
+			++skin.clip_count;
+		}
+		else if (string_equals(word, "frame"))
+		{
+			success = clip && skin.joint_count == joint_count;
+			if (success)
+			{
+				frame = &frames[next_frame * joint_count];
+				for (uint32 i = 0; i < joint_count; ++i)
+				{
+					frame[i] = { quat_identity(), {} };
+				}
+				++next_frame;
+				++clip->frame_count;
+			}
+		}
+		else if (string_equals(word, "offset"))
+		{
+			Vec_3f offset;
+			success = frame && anim_read_floats(&line_iter, offset.v, 3);
+			if (success)
+			{
+				frame[0].offset = import_position(&import, offset);
+			}
+		}
+		else
+		{
+			// a joint turned in this frame
+			const uint32 joint = find_joint(skin.joints, skin.joint_count, word);
+			float32 axis_angle[4];
+			success = frame && joint != c_no_joint && anim_read_floats(&line_iter, axis_angle, 4);
+			if (success)
+			{
+				Vec_3f axis = import_direction(&import, { axis_angle[0], axis_angle[1], axis_angle[2] });
+				const float32 length = float32_sqrt(vec_3f_dot(axis, axis));
+				success = length > 0.0f;
+				axis = vec_3f_mul(axis, 1.0f / length);
+				frame[joint].rotation = quat_angle_axis(axis, axis_angle[3] * c_deg_to_rad);
+			}
+		}
+	}
+
+	for (uint32 i = 0; i < skin.clip_count; ++i)
+	{
+		success = success && skin.clips[i].frame_count > 0;
+	}
+
+	// the frames belong to the first clip from here on
+	if (skin.clip_count == 0)
+	{
+		delete[] frames;
+	}
+
+	if (!success)
+	{
+		skin_destroy(&skin);
+		return false;
+	}
+
+	const uint32 vertex_count = model->vertex_count;
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		model->vertices[i] = import_position(&import, model->vertices[i]);
+		model->normals[i] = import_direction(&import, model->normals[i]);
+	}
+	model->bounds_min = model->vertices[0];
+	model->bounds_max = model->vertices[0];
+	for (uint32 i = 1; i < vertex_count; ++i)
+	{
+		model->bounds_min = vec_3f_min(model->bounds_min, model->vertices[i]);
+		model->bounds_max = vec_3f_max(model->bounds_max, model->vertices[i]);
+	}
+	for (uint32 i = 0; i < model->lod_count; ++i)
+	{
+		model->lods[i].error *= import.scale;
+	}
+
+	skin.weights = new Vertex_Weights[vertex_count];
+	skin_compute_weights(&skin);
+
+	*out_skin = skin;
+	return true;
+}
+
+void skin_destroy(Skin* skin)
+{
+	for (uint32 i = 0; i < skin->joint_count; ++i)
+	{
+		delete[] skin->joints[i].name;
+	}
+	for (uint32 i = 0; i < skin->clip_count; ++i)
+	{
+		delete[] skin->clips[i].name;
+	}
+	// every clip's frames are in one array, starting at the first clip's
+	if (skin->clip_count)
+	{
+		delete[] skin->clips[0].frames;
+	}
+	delete[] skin->joints;
+	delete[] skin->clips;
+	delete[] skin->weights;
+	*skin = {};
+}
+
+uint32 skin_find_clip(const Skin* skin, const char* name)
+{
+	for (uint32 i = 0; i < skin->clip_count; ++i)
+	{
+		if (string_equals(skin->clips[i].name, name))
+		{
+			return i;
+		}
+	}
+	return c_no_clip;
+}
+
+static Quat quat_nlerp(Quat a, Quat b, float32 t)
+{
+	// q and -q are the same rotation, go the short way round
+	const float32 dot = (a.zy * b.zy) + (a.xz * b.xz) + (a.yx * b.yx) + (a.scalar * b.scalar);
+	const float32 sign = dot < 0.0f ? -1.0f : 1.0f;
+	const Quat q = {
+		float32_lerp(a.zy, b.zy * sign, t),
+		float32_lerp(a.xz, b.xz * sign, t),
+		float32_lerp(a.yx, b.yx * sign, t),
+		float32_lerp(a.scalar, b.scalar * sign, t)
+	};
+	const float32 length = float32_sqrt((q.zy * q.zy) + (q.xz * q.xz) + (q.yx * q.yx) + (q.scalar * q.scalar));
+	return { q.zy / length, q.xz / length, q.yx / length, q.scalar / length };
+}
+
+void skin_sample_clip(const Skin* skin, uint32 clip_index, float32 time, Joint_Pose* out_pose)
+{
+	assert(clip_index < skin->clip_count);
+	const Animation_Clip* clip = &skin->clips[clip_index];
+
+	const float32 frame_time = time * clip->frames_per_second;
+	const float32 whole_frames = float32_floor(frame_time);
+	const float32 t = frame_time - whole_frames;
+	const uint32 frame = (uint32)((int64)whole_frames % clip->frame_count + clip->frame_count) % clip->frame_count;
+	const uint32 next_frame = (frame + 1) % clip->frame_count;
+	skin_blend_poses(skin->joint_count, &clip->frames[frame * skin->joint_count], &clip->frames[next_frame * skin->joint_count], t, out_pose);
+}
+
+void skin_blend_poses(uint32 joint_count, const Joint_Pose* a, const Joint_Pose* b, float32 t, Joint_Pose* out_pose)
+{
+	for (uint32 i = 0; i < joint_count; ++i)
+	{
+		out_pose[i].rotation = quat_nlerp(a[i].rotation, b[i].rotation, t);
+		out_pose[i].offset = vec_3f_lerp(a[i].offset, b[i].offset, t);
+	}
+}
+
+void skin_pose_matrices(const Skin* skin, const Joint_Pose* pose, Matrix_4x4* out_skinning_matrices)
+{
+	// Each joint turns about where it is in the bind pose, then its parent
+	// moves it. As joints aren't rotated in the bind pose, undoing the bind
+	// pose is just moving the joint back to the origin.
+	Matrix_4x4 joint_to_model[c_max_joints];
+	for (uint32 i = 0; i < skin->joint_count; ++i)
+	{
+		const Joint* joint = &skin->joints[i];
+		Matrix_4x4 local;
+		if (joint->parent == c_no_joint)
+		{
+			matrix_4x4_transform(&local, vec_3f_add(joint->bind_position, pose[i].offset), pose[i].rotation);
+			joint_to_model[i] = local;
+		}
+		else
+		{
+			matrix_4x4_transform(&local, vec_3f_sub(joint->bind_position, skin->joints[joint->parent].bind_position), pose[i].rotation);
+			matrix_4x4_mul(&joint_to_model[i], &joint_to_model[joint->parent], &local);
+		}
+
+		Matrix_4x4 model_to_joint;
+		matrix_4x4_translation(&model_to_joint, vec_3f_mul(joint->bind_position, -1.0f));
+		matrix_4x4_mul(&out_skinning_matrices[i], &joint_to_model[i], &model_to_joint);
+	}
+}
+
+void skin_vertices(const Skin* skin, const Matrix_4x4* skinning_matrices, uint32 vertex_count, Vec_3f* out_vertices, Vec_3f* out_normals)
+{
+	// Matrices are column major, so each column loads straight into a
+	// register. The weighted sum of the joints' matrices is built a column at
+	// a time, then the vertex is the columns scaled by its x, y and z.
+	const Model* model = skin->model;
+	for (uint32 vertex_i = 0; vertex_i < vertex_count; ++vertex_i)
+	{
+		const Vertex_Weights* weights = &skin->weights[vertex_i];
+		__m128 column_0 = _mm_setzero_ps();
+		__m128 column_1 = _mm_setzero_ps();
+		__m128 column_2 = _mm_setzero_ps();
+		__m128 column_3 = _mm_setzero_ps();
+		for (uint32 i = 0; i < c_max_joint_influences && weights->weights[i] > 0.0f; ++i)
+		{
+			const float32* m = &skinning_matrices[weights->joints[i]].m11;
+			const __m128 weight = _mm_set1_ps(weights->weights[i]);
+			column_0 = _mm_add_ps(column_0, _mm_mul_ps(_mm_loadu_ps(m), weight));
+			column_1 = _mm_add_ps(column_1, _mm_mul_ps(_mm_loadu_ps(m + 4), weight));
+			column_2 = _mm_add_ps(column_2, _mm_mul_ps(_mm_loadu_ps(m + 8), weight));
+			column_3 = _mm_add_ps(column_3, _mm_mul_ps(_mm_loadu_ps(m + 12), weight));
+		}
+
+		const Vec_3f vertex = model->vertices[vertex_i];
+		const Vec_3f normal = model->normals[vertex_i];
+		const __m128 position = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(column_0, _mm_set1_ps(vertex.x)), _mm_mul_ps(column_1, _mm_set1_ps(vertex.y))),
+			_mm_add_ps(_mm_mul_ps(column_2, _mm_set1_ps(vertex.z)), column_3));
+		const __m128 direction = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(column_0, _mm_set1_ps(normal.x)), _mm_mul_ps(column_1, _mm_set1_ps(normal.y))),
+			_mm_mul_ps(column_2, _mm_set1_ps(normal.z)));
+
+		// blending rotations shrinks normals a little, so they're
+		// renormalised
+		const __m128 squared = _mm_mul_ps(direction, direction);
+		const __m128 length_sq = _mm_add_ss(_mm_add_ss(squared, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(2, 2, 2, 2)));
+		const __m128 inverse_length = _mm_shuffle_ps(_mm_rsqrt_ss(length_sq), _mm_rsqrt_ss(length_sq), _MM_SHUFFLE(0, 0, 0, 0));
+
+		alignas(16) float32 out_position[4];
+		alignas(16) float32 out_normal[4];
+		_mm_store_ps(out_position, position);
+		_mm_store_ps(out_normal, _mm_mul_ps(direction, inverse_length));
+		out_vertices[vertex_i] = { out_position[0], out_position[1], out_position[2] };
+		out_normals[vertex_i] = { out_normal[0], out_normal[1], out_normal[2] };
+	}
+}
+
+Skin_Instance skin_instance_create(const Skin* skin, uint32 clip)
+{
+	Skin_Instance instance = {};
+	instance.skin = skin;
+	instance.clip = clip;
+	instance.blend_clip = c_no_clip;
+	instance.skinning_matrices = new Matrix_4x4[skin->joint_count];
+	instance.vertices = new Vec_3f[skin->model->vertex_count];
+	instance.normals = new Vec_3f[skin->model->vertex_count];
+	return instance;
+}
+
+void skin_instance_destroy(Skin_Instance* instance)
+{
+	delete[] instance->skinning_matrices;
+	delete[] instance->vertices;
+	delete[] instance->normals;
+	*instance = {};
+}
+
+struct Skin_Update
+{
+	Skin_Instance* instances;
+	float32 dt;
+};
+
+static void update_instances(void* data, uint32 begin, uint32 end)
+{
+	const Skin_Update* update = (const Skin_Update*)data;
+	Joint_Pose pose[c_max_joints];
+	Joint_Pose blend_pose[c_max_joints];
+	for (uint32 i = begin; i < end; ++i)
+	{
+		Skin_Instance* instance = &update->instances[i];
+		const Skin* skin = instance->skin;
+		instance->time += update->dt;
+		skin_sample_clip(skin, instance->clip, instance->time, pose);
+		if (instance->blend_clip != c_no_clip)
+		{
+			instance->blend_time += update->dt;
+			skin_sample_clip(skin, instance->blend_clip, instance->blend_time, blend_pose);
+			skin_blend_poses(skin->joint_count, pose, blend_pose, instance->blend, pose);
+		}
+
+		skin_pose_matrices(skin, pose, instance->skinning_matrices);
+		// coarser levels use a prefix of the vertices
+		skin_vertices(skin, instance->skinning_matrices, skin->model->lods[instance->lod].vertex_count, instance->vertices, instance->normals);
+	}
+}
+
+void skin_instances_update(Job_System* jobs, Skin_Instance* instances, uint32 instance_count, float32 dt, uint32 batch_size)
+{
+	Skin_Update update = { instances, dt };
+	job_parallel_for(jobs, 0, instance_count, batch_size, update_instances, &update);
+}
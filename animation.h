@@ -0,0 +1,119 @@
+#pragma once
+
+#include "file.h"
+#include "graphics.h"
+
+struct Job_System;
+
+
+constexpr uint32 c_max_joints = 64;
+constexpr uint32 c_max_joint_influences = 4;
+constexpr uint32 c_no_joint = 0xffffffff;
+constexpr uint32 c_no_clip = 0xffffffff;
+
+// Joints aren't rotated in the bind pose, so where each one is is all there
+// is to it. Parents come before their children.
+struct Joint
+{
+	const char* name;
+	uint32 parent; // c_no_joint for the root
+	Vec_3f bind_position; // model space
+};
+
+// A joint's rotation relative to the bind pose, and for the root how far
+// it's moved from where it is in the bind pose.
+struct Joint_Pose
+{
+	Quat rotation;
+	Vec_3f offset;
+};
+
+// Poses sampled at a fixed rate, joint_count of them per frame. Clips loop,
+// the last frame blends back into the first.
+struct Animation_Clip
+{
+	const char* name;
+	float32 frames_per_second;
+	uint32 frame_count;
+	Joint_Pose* frames;
+};
+
+// The joints moving each vertex, heaviest first, weights adding up to 1.
+// Unused influences have no weight.
+struct Vertex_Weights
+{
+	uint8 joints[c_max_joint_influences];
+	float32 weights[c_max_joint_influences];
+};
+
+// A skeleton fitted to a model, with the model's vertex weights and the
+// clips it can play.
+struct Skin
+{
+	const Model* model;
+	Joint* joints;
+	uint32 joint_count;
+	Vertex_Weights* weights; // one per model vertex
+	Animation_Clip* clips;
+	uint32 clip_count;
+};
+
+// One animated copy of a skin. Two clips can play at once, blended from one
+// to the other, and the skinned vertices and normals are written into the
+// instance's own arrays, ready for project_and_draw. Only the vertices its
+// level of detail uses are skinned.
+struct Skin_Instance
+{
+	const Skin* skin;
+	uint32 lod;
+	uint32 clip;
+	float32 time;
+	uint32 blend_clip; // optional
+	float32 blend_time;
+	float32 blend; // 0 is all clip, 1 all blend_clip
+
+	Matrix_4x4* skinning_matrices; // bind pose to posed, per joint
+	Vec_3f* vertices;
+	Vec_3f* normals;
+};
+
+
+// Reads a skeleton and clips for the model from a .anim file, a line per
+// thing, # for comments:
+//
+//   scale <factor>
+//   up <x, y or z>
+//   joint <name> <parent name, or - for the root> <x> <y> <z>
+//   clip <name> <frames per second>
+//   frame
+//   <joint name> <axis x> <axis y> <axis z> <degrees>
+//   offset <x> <y> <z>
+//
+// Joints are where they are in the bind pose, in the model's units. Scale and
+// up (the axis that's up in the model) turn the model, and everything in the
+// file after them, into z up scene units, so they're applied to the model's
+// vertices, and its levels of detail's errors, too. Each frame turns the
+// joints it names, the rest stay as they are in the bind pose, and offset
+// moves the root. Vertex weights are worked out from how close vertices are
+// to the bones between joints and their parents, so a leaf joint (an end of
+// hand or top of head) is needed for the last bone in each chain to have any
+// vertices. False if the file's missing or can't be read.
+bool skin_load(Skin* out_skin, Model* model, File anim_file);
+void skin_destroy(Skin* skin);
+uint32 skin_find_clip(const Skin* skin, const char* name);
+
+// clip's pose at time seconds in, looping
+void skin_sample_clip(const Skin* skin, uint32 clip, float32 time, Joint_Pose* out_pose);
+// t of 0 is a, 1 is b
+void skin_blend_poses(uint32 joint_count, const Joint_Pose* a, const Joint_Pose* b, float32 t, Joint_Pose* out_pose);
+// what moves each joint's vertices from the bind pose to the pose
+void skin_pose_matrices(const Skin* skin, const Joint_Pose* pose, Matrix_4x4* out_skinning_matrices);
+// Moves the model's first vertex_count vertices and normals by their joints'
+// matrices, four floats at a time with SSE.
+void skin_vertices(const Skin* skin, const Matrix_4x4* skinning_matrices, uint32 vertex_count, Vec_3f* out_vertices, Vec_3f* out_normals);
+
+Skin_Instance skin_instance_create(const Skin* skin, uint32 clip);
+void skin_instance_destroy(Skin_Instance* instance);
+// Advances each instance's clips by dt seconds, then samples, blends and
+// skins them, batch_size instances per job.
+void skin_instances_update(Job_System* jobs, Skin_Instance* instances, uint32 instance_count, float32 dt, uint32 batch_size);
@@ -0,0 +1,468 @@
+#include "bvh.h"
+
+#include <cstring>
+#include "assert.h"
+
+
+static constexpr int32 c_null_node = -1;
+// the tree is kept balanced so this is plenty, even for millions of leaves
+static constexpr int32 c_max_query_stack = 256;
+
+
+static float32 aabb_area(Vec_3f bounds_min, Vec_3f bounds_max)
+{
+	const Vec_3f size = vec_3f_sub(bounds_max, bounds_min);
+	return 2.0f * ((size.x * size.y) + (size.y * size.z) + (size.z * size.x));
+}
+
+static bool aabb_contains(Vec_3f outer_min, Vec_3f outer_max, Vec_3f inner_min, Vec_3f inner_max)
+{
+	return outer_min.x <= inner_min.x && outer_min.y <= inner_min.y && outer_min.z <= inner_min.z &&
+		outer_max.x >= inner_max.x && outer_max.y >= inner_max.y && outer_max.z >= inner_max.z;
+}
+
+static bool is_leaf(const Bvh_Node* node)
+{
+	return node->children[0] == c_null_node;
+}
+
+static void link_free_nodes(Bvh* bvh, int32 start)
+{
+	for (int32 i = start; i < bvh->node_capacity - 1; ++i)
+	{
+		bvh->nodes[i].parent = i + 1;
+		bvh->nodes[i].height = -1;
+	}
+	bvh->nodes[bvh->node_capacity - 1].parent = c_null_node;
+	bvh->nodes[bvh->node_capacity - 1].height = -1;
+	bvh->free_list = start;
+}
+
+Bvh bvh_create(int32 leaf_capacity, float32 margin)
+{
+	assert(leaf_capacity > 0);
+
+	Bvh bvh = {};
+	// a tree with n leaves has n - 1 internal nodes
+	bvh.node_capacity = leaf_capacity * 2;
+	bvh.nodes = new Bvh_Node[bvh.node_capacity];
+	bvh.root = c_null_node;
+	bvh.margin = margin;
+	link_free_nodes(&bvh, 0);
+
+	return bvh;
+}
+
+void bvh_destroy(Bvh* bvh)
+{
+	delete[] bvh->nodes;
+	*bvh = {};
+}
+
+static int32 allocate_node(Bvh* bvh)
+{
+	if (bvh->free_list == c_null_node)
+	{
+		const int32 old_capacity = bvh->node_capacity;
+		Bvh_Node* nodes = new Bvh_Node[old_capacity * 2];
+		memcpy(nodes, bvh->nodes, old_capacity * sizeof(Bvh_Node));
+		delete[] bvh->nodes;
+		bvh->nodes = nodes;
+		bvh->node_capacity = old_capacity * 2;
+		link_free_nodes(bvh, old_capacity);
+	}
+
+	const int32 node_index = bvh->free_list;
+	Bvh_Node* node = &bvh->nodes[node_index];
+	bvh->free_list = node->parent;
+	node->parent = c_null_node;
+	node->children[0] = c_null_node;
+	node->children[1] = c_null_node;
+	node->height = 0;
+	node->item = 0;
+
+	return node_index;
+}
+
+static void free_node(Bvh* bvh, int32 node_index)
+{
+	bvh->nodes[node_index].parent = bvh->free_list;
+	bvh->nodes[node_index].height = -1;
+	bvh->free_list = node_index;
+}
+
+static void refit(Bvh* bvh, int32 node_index)
+{
+	Bvh_Node* node = &bvh->nodes[node_index];
+	const Bvh_Node* child_a = &bvh->nodes[node->children[0]];
+	const Bvh_Node* child_b = &bvh->nodes[node->children[1]];
+	node->bounds_min = vec_3f_min(child_a->bounds_min, child_b->bounds_min);
+	node->bounds_max = vec_3f_max(child_a->bounds_max, child_b->bounds_max);
+	node->height = 1 + int32_max(child_a->height, child_b->height);
+}
+
+// If one child of a is more than one level taller than the other, rotate the
+// taller one up into a's place. Returns the index of the node now at the top
+// of this subtree.
+static int32 balance(Bvh* bvh, int32 index_a)
+{
+	Bvh_Node* a = &bvh->nodes[index_a];
+	if (is_leaf(a) || a->height < 2)
+	{
+		return index_a;
+	}
+
+	const int32 index_b = a->children[0];
+	const int32 index_c = a->children[1];
+	Bvh_Node* b = &bvh->nodes[index_b];
+	Bvh_Node* c = &bvh->nodes[index_c];
+
+	const int32 height_difference = c->height - b->height;
+	if (height_difference > 1 || height_difference < -1)
+	{
+		// promote the taller child, its taller child stays with it and the
+		// shorter one swaps down to a
+		const int32 index_up = height_difference > 1 ? index_c : index_b;
+		const int32 index_other = height_difference > 1 ? index_b : index_c;
+		Bvh_Node* up = &bvh->nodes[index_up];
+		const int32 index_f = up->children[0];
+		const int32 index_g = up->children[1];
+		Bvh_Node* f = &bvh->nodes[index_f];
+		Bvh_Node* g = &bvh->nodes[index_g];
+
+		// up takes a's place
+		up->children[0] = index_a;
+		up->parent = a->parent;
+		a->parent = index_up;
+		if (up->parent != c_null_node)
+		{
+			Bvh_Node* parent = &bvh->nodes[up->parent];
+			parent->children[parent->children[0] == index_a ? 0 : 1] = index_up;
+		}
+		else
+		{
+			bvh->root = index_up;
+		}
+
+		const int32 index_keep = f->height > g->height ? index_f : index_g;
+		const int32 index_move = f->height > g->height ? index_g : index_f;
+		up->children[1] = index_keep;
+		a->children[0] = index_other;
+		a->children[1] = index_move;
+		bvh->nodes[index_move].parent = index_a;
+
+		refit(bvh, index_a);
+		refit(bvh, index_up);
+
+		return index_up;
+	}
+
+	return index_a;
+}
+
+static void fix_upwards(Bvh* bvh, int32 node_index)
+{
+	while (node_index != c_null_node)
+	{
+		node_index = balance(bvh, node_index);
+		refit(bvh, node_index);
+		node_index = bvh->nodes[node_index].parent;
+	}
+}
+
+static void insert_leaf(Bvh* bvh, int32 leaf)
+{
+	if (bvh->root == c_null_node)
+	{
+		bvh->root = leaf;
+		bvh->nodes[leaf].parent = c_null_node;
+		return;
+	}
+
+	// walk down choosing whichever of: pair with this node, or descend into
+	// a child, adds the least surface area
+	const Vec_3f leaf_min = bvh->nodes[leaf].bounds_min;
+	const Vec_3f leaf_max = bvh->nodes[leaf].bounds_max;
+	int32 sibling = bvh->root;
+	while (!is_leaf(&bvh->nodes[sibling]))
+	{
+		const Bvh_Node* node = &bvh->nodes[sibling];
+		const float32 area = aabb_area(node->bounds_min, node->bounds_max);
+		const float32 combined_area = aabb_area(vec_3f_min(node->bounds_min, leaf_min), vec_3f_max(node->bounds_max, leaf_max));
+
+		// cost of creating a new parent for this node and the leaf
+		const float32 cost = 2.0f * combined_area;
+		// minimum cost of pushing the leaf further down the tree
+		const float32 inheritance_cost = 2.0f * (combined_area - area);
+
+		float32 child_cost[2];
+		for (int32 i = 0; i < 2; ++i)
+		{
+			const Bvh_Node* child = &bvh->nodes[node->children[i]];
+			const float32 child_combined_area = aabb_area(vec_3f_min(child->bounds_min, leaf_min), vec_3f_max(child->bounds_max, leaf_max));
+			if (is_leaf(child))
+			{
+				child_cost[i] = child_combined_area + inheritance_cost;
+			}
+			else
+			{
+				child_cost[i] = (child_combined_area - aabb_area(child->bounds_min, child->bounds_max)) + inheritance_cost;
+			}
+		}
+
+		if (cost < child_cost[0] && cost < child_cost[1])
+		{
+			break;
+		}
+
+		sibling = child_cost[0] < child_cost[1] ? node->children[0] : node->children[1];
+	}
+
+	const int32 old_parent = bvh->nodes[sibling].parent;
+	const int32 new_parent = allocate_node(bvh);
+	bvh->nodes[new_parent].parent = old_parent;
+	bvh->nodes[new_parent].children[0] = sibling;
+	bvh->nodes[new_parent].children[1] = leaf;
+	bvh->nodes[sibling].parent = new_parent;
+	bvh->nodes[leaf].parent = new_parent;
+	refit(bvh, new_parent);
+
+	if (old_parent != c_null_node)
+	{
+		Bvh_Node* parent = &bvh->nodes[old_parent];
+		parent->children[parent->children[0] == sibling ? 0 : 1] = new_parent;
+		fix_upwards(bvh, old_parent);
+	}
+	else
+	{
+		bvh->root = new_parent;
+	}
+}
+
+static void remove_leaf(Bvh* bvh, int32 leaf)
+{
+	if (leaf == bvh->root)
+	{
+		bvh->root = c_null_node;
+		return;
+	}
+
+	// the leaf's parent goes away and its sibling takes the parent's place
+	const int32 parent = bvh->nodes[leaf].parent;
+	const int32 grandparent = bvh->nodes[parent].parent;
+	const int32 sibling = bvh->nodes[parent].children[bvh->nodes[parent].children[0] == leaf ? 1 : 0];
+
+	if (grandparent != c_null_node)
+	{
+		Bvh_Node* node = &bvh->nodes[grandparent];
+		node->children[node->children[0] == parent ? 0 : 1] = sibling;
+		bvh->nodes[sibling].parent = grandparent;
+		free_node(bvh, parent);
+		fix_upwards(bvh, grandparent);
+	}
+	else
+	{
+		bvh->root = sibling;
+		bvh->nodes[sibling].parent = c_null_node;
+		free_node(bvh, parent);
+	}
+}
+
+int32 bvh_insert(Bvh* bvh, uint32 item, Vec_3f bounds_min, Vec_3f bounds_max)
+{
+	const int32 proxy = allocate_node(bvh);
+	const Vec_3f margin = { bvh->margin, bvh->margin, bvh->margin };
+	bvh->nodes[proxy].bounds_min = vec_3f_sub(bounds_min, margin);
+	bvh->nodes[proxy].bounds_max = vec_3f_add(bounds_max, margin);
+	bvh->nodes[proxy].item = item;
+
+	insert_leaf(bvh, proxy);
+
+	return proxy;
+}
+
+void bvh_remove(Bvh* bvh, int32 proxy)
+{
+	assert(proxy >= 0 && proxy < bvh->node_capacity && is_leaf(&bvh->nodes[proxy]));
+
+	remove_leaf(bvh, proxy);
+	free_node(bvh, proxy);
+}
+
+bool bvh_move(Bvh* bvh, int32 proxy, Vec_3f bounds_min, Vec_3f bounds_max)
+{
+	assert(proxy >= 0 && proxy < bvh->node_capacity && is_leaf(&bvh->nodes[proxy]));
+
+	Bvh_Node* node = &bvh->nodes[proxy];
+	if (aabb_contains(node->bounds_min, node->bounds_max, bounds_min, bounds_max))
+	{
+		// still inside the fattened bounds
+		return false;
+	}
+
+	remove_leaf(bvh, proxy);
+	const Vec_3f margin = { bvh->margin, bvh->margin, bvh->margin };
+	node = &bvh->nodes[proxy];
+	node->bounds_min = vec_3f_sub(bounds_min, margin);
+	node->bounds_max = vec_3f_add(bounds_max, margin);
+	insert_leaf(bvh, proxy);
+
+	return true;
+}
+
+// adds every leaf under node_index without testing anything
+static void add_subtree(const Bvh* bvh, int32 node_index, uint32* out_items, uint32 max_items, Bvh_Query_Stats* stats)
+{
+	int32 stack[c_max_query_stack];
+	int32 stack_count = 0;
+	stack[stack_count++] = node_index;
+	while (stack_count)
+	{
+		const Bvh_Node* node = &bvh->nodes[stack[--stack_count]];
+		++stats->nodes_visited;
+		if (is_leaf(node))
+		{
+			if (stats->items_found < max_items)
+			{
+				out_items[stats->items_found] = node->item;
+				++stats->items_found;
+			}
+		}
+		else
+		{
+			assert(stack_count + 2 <= c_max_query_stack);
+			stack[stack_count++] = node->children[0];
+			stack[stack_count++] = node->children[1];
+		}
+	}
+}
+
+Bvh_Query_Stats bvh_query_frustum(const Bvh* bvh, const Frustum* frustum, uint32* out_items, uint32 max_items)
+{
+	Bvh_Query_Stats stats = {};
+	if (bvh->root == c_null_node)
+	{
+		return stats;
+	}
+
+	int32 stack[c_max_query_stack];
+	int32 stack_count = 0;
+	stack[stack_count++] = bvh->root;
+	while (stack_count)
+	{
+		const int32 node_index = stack[--stack_count];
+		const Bvh_Node* node = &bvh->nodes[node_index];
+		++stats.nodes_visited;
+
+		const Frustum_Test test = frustum_classify_aabb(frustum, node->bounds_min, node->bounds_max);
+		if (test == Frustum_Test::Outside)
+		{
+			continue;
+		}
+
+		if (is_leaf(node))
+		{
+			if (stats.items_found < max_items)
+			{
+				out_items[stats.items_found] = node->item;
+				++stats.items_found;
+			}
+		}
+		else if (test == Frustum_Test::Inside)
+		{
+			// everything below is inside too, no need to test any more planes
+			--stats.nodes_visited;
+			add_subtree(bvh, node_index, out_items, max_items, &stats);
+		}
+		else
+		{
+			assert(stack_count + 2 <= c_max_query_stack);
+			stack[stack_count++] = node->children[0];
+			stack[stack_count++] = node->children[1];
+		}
+	}
+
+	return stats;
+}
+
+Bvh_Query_Stats bvh_query_aabb(const Bvh* bvh, Vec_3f bounds_min, Vec_3f bounds_max, uint32* out_items, uint32 max_items)
+{
+	Bvh_Query_Stats stats = {};
+	if (bvh->root == c_null_node)
+	{
+		return stats;
+	}
+
+	int32 stack[c_max_query_stack];
+	int32 stack_count = 0;
+	stack[stack_count++] = bvh->root;
+	while (stack_count)
+	{
+		const Bvh_Node* node = &bvh->nodes[stack[--stack_count]];
+		++stats.nodes_visited;
+
+		if (!aabb_overlaps(node->bounds_min, node->bounds_max, bounds_min, bounds_max))
+		{
+			continue;
+		}
+
+		if (is_leaf(node))
+		{
+			if (stats.items_found < max_items)
+			{
+				out_items[stats.items_found] = node->item;
+				++stats.items_found;
+			}
+		}
+		else
+		{
+			assert(stack_count + 2 <= c_max_query_stack);
+			stack[stack_count++] = node->children[0];
+			stack[stack_count++] = node->children[1];
+		}
+	}
+
+	return stats;
+}
+
+Bvh_Query_Stats bvh_query_ray(const Bvh* bvh, Vec_3f origin, Vec_3f direction, float32 max_t, uint32* out_items, uint32 max_items)
+{
+	Bvh_Query_Stats stats = {};
+	if (bvh->root == c_null_node)
+	{
+		return stats;
+	}
+
+	const Vec_3f inverse_direction = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+	int32 stack[c_max_query_stack];
+	int32 stack_count = 0;
+	stack[stack_count++] = bvh->root;
+	while (stack_count)
+	{
+		const Bvh_Node* node = &bvh->nodes[stack[--stack_count]];
+		++stats.nodes_visited;
+
+		if (!ray_intersects_aabb(origin, inverse_direction, max_t, node->bounds_min, node->bounds_max))
+		{
+			continue;
+		}
+
+		if (is_leaf(node))
+		{
+			if (stats.items_found < max_items)
+			{
+				out_items[stats.items_found] = node->item;
+				++stats.items_found;
+			}
+		}
+		else
+		{
+			assert(stack_count + 2 <= c_max_query_stack);
+			stack[stack_count++] = node->children[0];
+			stack[stack_count++] = node->children[1];
+		}
+	}
+
+	return stats;
+}
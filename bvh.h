@@ -0,0 +1,53 @@
+#pragma once
+
+#include "maths.h"
+
+
+// Dynamic AABB tree. Each leaf holds a user item (e.g. an instance index) with
+// its bounds grown by a margin, so small movements don't need the tree
+// touching at all, and bigger ones just remove and reinsert the leaf.
+// Insertion picks the sibling that grows the tree's surface area least and
+// the tree is kept balanced with rotations, so queries stay logarithmic as
+// things move around.
+struct Bvh_Node
+{
+	Vec_3f bounds_min;
+	Vec_3f bounds_max;
+	int32 parent; // also the next free node when on the free list
+	int32 children[2]; // -1 for leaves
+	int32 height; // leaves are 0, -1 when free
+	uint32 item;
+};
+
+struct Bvh
+{
+	Bvh_Node* nodes;
+	int32 node_capacity;
+	int32 free_list;
+	int32 root;
+	float32 margin;
+};
+
+struct Bvh_Query_Stats
+{
+	uint32 nodes_visited;
+	uint32 items_found;
+};
+
+
+Bvh bvh_create(int32 leaf_capacity, float32 margin);
+void bvh_destroy(Bvh* bvh);
+// returns a proxy for the leaf, used to move or remove it
+int32 bvh_insert(Bvh* bvh, uint32 item, Vec_3f bounds_min, Vec_3f bounds_max);
+void bvh_remove(Bvh* bvh, int32 proxy);
+// returns true if the leaf had to be reinserted
+bool bvh_move(Bvh* bvh, int32 proxy, Vec_3f bounds_min, Vec_3f bounds_max);
+
+// Queries write the items found into out_items, stopping at max_items. Items
+// can be reported whose bounds only overlap because of the margin, so callers
+// still need their own test if they need an exact answer.
+Bvh_Query_Stats bvh_query_frustum(const Bvh* bvh, const Frustum* frustum, uint32* out_items, uint32 max_items);
+Bvh_Query_Stats bvh_query_aabb(const Bvh* bvh, Vec_3f bounds_min, Vec_3f bounds_max, uint32* out_items, uint32 max_items);
+// items whose bounds the ray from origin along direction (needn't be
+// normalised) hits within max_t, in no particular order
+Bvh_Query_Stats bvh_query_ray(const Bvh* bvh, Vec_3f origin, Vec_3f direction, float32 max_t, uint32* out_items, uint32 max_items);
@@ -0,0 +1,101 @@
+#include "castle.h"
+
+#include "assert.h"
+
+
+// torches either side of the gate and a brazier in the middle of the courtyard
+static constexpr float32 c_torch_range = 3.0f;
+static constexpr float32 c_torch_intensity = 1.0f;
+static constexpr float32 c_torch_height = 0.7f;
+static constexpr float32 c_brazier_range = 4.0f;
+static constexpr float32 c_brazier_intensity = 0.8f;
+static constexpr float32 c_brazier_height = 0.3f;
+
+
+static void add_point_light(Scene* scene, Vec_3f position, float32 range, float32 intensity)
+{
+	Local_Light light = {};
+	light.position = position;
+	light.range = range;
+	light.intensity = intensity;
+	light.cos_inner = -1.0f;
+	light.cos_outer = -1.0f;
+	scene_add_light(scene, &light);
+}
+
+static Quat piece_rotation(float32 yaw)
+{
+	// kit pieces are y up, stand them up then turn them about world z
+	const Quat stand_up = quat_angle_axis({ 1.0f, 0.0f, 0.0f }, 90.0f * c_deg_to_rad);
+	return quat_mul(quat_angle_axis({ 0.0f, 0.0f, 1.0f }, yaw), stand_up);
+}
+
+void castle_build(Scene* scene, const Castle_Kit* kit, Vec_3f origin, int32 wall_length)
+{
+	assert(wall_length >= 3);
+
+	const Quat facing[4] = {
+		piece_rotation(0.0f),
+		piece_rotation(90.0f * c_deg_to_rad),
+		piece_rotation(180.0f * c_deg_to_rad),
+		piece_rotation(270.0f * c_deg_to_rad)
+	};
+
+	const int32 last = wall_length - 1;
+	for (int32 y = 0; y < wall_length; ++y)
+	{
+		for (int32 x = 0; x < wall_length; ++x)
+		{
+			const Vec_3f position = vec_3f_add(origin, { (float32)x, (float32)y, 0.0f });
+			const bool edge_x = x == 0 || x == last;
+			const bool edge_y = y == 0 || y == last;
+
+			if (edge_x && edge_y)
+			{
+				// corner tower
+				scene_add_instance(scene, kit->tower_base, position, facing[0]);
+				scene_add_instance(scene, kit->tower, vec_3f_add(position, { 0.0f, 0.0f, 1.0f }), facing[0]);
+				scene_add_instance(scene, kit->tower_top, vec_3f_add(position, { 0.0f, 0.0f, 2.0f }), facing[0]);
+			}
+			else if (edge_y)
+			{
+				const bool is_gate = y == 0 && x == wall_length / 2;
+				scene_add_instance(scene, is_gate ? kit->wall_gate : kit->wall, position, facing[y == 0 ? 0 : 2]);
+			}
+			else if (edge_x)
+			{
+				scene_add_instance(scene, kit->wall, position, facing[x == 0 ? 3 : 1]);
+			}
+			else
+			{
+				scene_add_instance(scene, kit->floor, position, facing[0]);
+
+				// scatter some clutter around the courtyard, deterministic so
+				// every run builds the same scene
+				const uint32 hash = ((uint32)x * 73856093u) ^ ((uint32)y * 19349663u);
+				if (hash % 7 == 0)
+				{
+					scene_add_instance(scene, (hash & 8) ? kit->crate : kit->barrel, position, facing[hash & 3]);
+				}
+			}
+		}
+	}
+
+	const float32 gate_x = (float32)(wall_length / 2);
+	add_point_light(scene, vec_3f_add(origin, { gate_x - 0.6f, -0.7f, c_torch_height }), c_torch_range, c_torch_intensity);
+	add_point_light(scene, vec_3f_add(origin, { gate_x + 0.6f, -0.7f, c_torch_height }), c_torch_range, c_torch_intensity);
+	const float32 middle = last * 0.5f;
+	add_point_light(scene, vec_3f_add(origin, { middle, middle, c_brazier_height }), c_brazier_range, c_brazier_intensity);
+}
+
+void castle_build_town(Scene* scene, const Castle_Kit* kit, int32 castles_x, int32 castles_y, int32 wall_length, int32 spacing)
+{
+	const float32 pitch = (float32)(wall_length + spacing);
+	for (int32 y = 0; y < castles_y; ++y)
+	{
+		for (int32 x = 0; x < castles_x; ++x)
+		{
+			castle_build(scene, kit, { x * pitch, y * pitch, 0.0f }, wall_length);
+		}
+	}
+}
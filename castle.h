@@ -0,0 +1,27 @@
+#pragma once
+
+#include "scene.h"
+
+
+// The kit pieces castles are built from. They're all authored y up on a 1
+// unit grid, the world is z up.
+struct Castle_Kit
+{
+	const Model* wall;
+	const Model* wall_gate;
+	const Model* tower_base;
+	const Model* tower;
+	const Model* tower_top;
+	const Model* floor;
+	const Model* crate;
+	const Model* barrel;
+};
+
+
+// square castle with its south west corner at origin, wall_length pieces
+// along each side including the corner towers, a gate in the south wall and a
+// floored courtyard with some clutter in it, lit by torches at the gate and a
+// brazier in the middle
+void castle_build(Scene* scene, const Castle_Kit* kit, Vec_3f origin, int32 wall_length);
+// a grid of castles, spacing is the gap between castles in grid units
+void castle_build_town(Scene* scene, const Castle_Kit* kit, int32 castles_x, int32 castles_y, int32 wall_length, int32 spacing);
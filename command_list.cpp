@@ -0,0 +1,455 @@
+#include "command_list.h"
+
+#include <cstring>
+#include "assert.h"
+#include "file.h"
+#include "lod.h"
+
+
+static constexpr uint32 c_command_file_magic = 'C' | ('M' << 8) | ('D' << 16) | ('2' << 24);
+static constexpr uint32 c_initial_draw_capacity = 256;
+static constexpr uint32 c_initial_pipeline_capacity = 8;
+// Sort keys are the pipeline above a 16 bit depth, so there can't be more
+// pipelines than this in one execution.
+static constexpr uint32 c_max_executed_pipelines = 1 << 15;
+
+struct Command_File_Header
+{
+	uint32 magic;
+	Matrix_4x4 view_projection_matrix;
+	Vec_4f light;
+	float32 lod_scale;
+	uint32 pipeline_count;
+	uint32 draw_count;
+};
+
+// Pipeline_State a byte a field, so the file doesn't depend on the
+// compiler's layout or padding. The last byte keeps the draws after the
+// pipelines 4 byte aligned.
+struct Command_File_Pipeline
+{
+	uint8 untextured;
+	uint8 unlit;
+	uint8 depth_mode;
+	uint8 texture_address;
+	uint8 colour[3];
+	uint8 unused;
+};
+
+struct Command_File_Draw
+{
+	Matrix_4x4 transform;
+	uint32 model;
+	uint32 draw_id;
+	uint32 pipeline;
+};
+
+
+static bool pipeline_state_equals(const Pipeline_State* a, const Pipeline_State* b)
+{
+	return a->untextured == b->untextured &&
+		a->unlit == b->unlit &&
+		a->depth_mode == b->depth_mode &&
+		a->texture_address == b->texture_address &&
+		a->colour[0] == b->colour[0] &&
+		a->colour[1] == b->colour[1] &&
+		a->colour[2] == b->colour[2];
+}
+
+static void add_pipeline(Command_List* list, const Pipeline_State* pipeline)
+{
+	if (list->pipeline_count == list->pipeline_capacity)
+	{
+		const uint32 new_capacity = list->pipeline_capacity * 2;
+		Pipeline_State* pipelines = new Pipeline_State[new_capacity];
+		memcpy(pipelines, list->pipelines, list->pipeline_count * sizeof(Pipeline_State));
+		delete[] list->pipelines;
+		list->pipelines = pipelines;
+		list->pipeline_capacity = new_capacity;
+	}
+
+	list->pipelines[list->pipeline_count] = *pipeline;
+	++list->pipeline_count;
+}
+
+Command_List command_list_create()
+{
+	Command_List list = {};
+	list.draws = new Draw_Command[c_initial_draw_capacity];
+	list.draw_capacity = c_initial_draw_capacity;
+	list.pipelines = new Pipeline_State[c_initial_pipeline_capacity];
+	list.pipeline_capacity = c_initial_pipeline_capacity;
+	command_list_reset(&list);
+
+	return list;
+}
+
+void command_list_destroy(Command_List* list)
+{
+	delete[] list->draws;
+	delete[] list->pipelines;
+	*list = {};
+}
+
+void command_list_reset(Command_List* list)
+{
+	list->draw_count = 0;
+	list->pipelines[0] = {};
+	list->pipeline_count = 1;
+}
+
+void command_list_set_pipeline(Command_List* list, const Pipeline_State* pipeline)
+{
+	if (!pipeline_state_equals(&list->pipelines[list->pipeline_count - 1], pipeline))
+	{
+		add_pipeline(list, pipeline);
+	}
+}
+
+void command_list_draw(Command_List* list, const Model* model, const Matrix_4x4* transform, uint32 draw_id)
+{
+	if (list->draw_count == list->draw_capacity)
+	{
+		const uint32 new_capacity = list->draw_capacity * 2;
+		Draw_Command* draws = new Draw_Command[new_capacity];
+		memcpy(draws, list->draws, list->draw_count * sizeof(Draw_Command));
+		delete[] list->draws;
+		list->draws = draws;
+		list->draw_capacity = new_capacity;
+	}
+
+	Draw_Command* draw = &list->draws[list->draw_count];
+	++list->draw_count;
+	draw->transform = *transform;
+	draw->model = model;
+	draw->draw_id = draw_id;
+	draw->pipeline = list->pipeline_count - 1;
+}
+
+bool command_list_save(const Command_List* list, const Command_View* view, const Model* models, uint32 model_count, const char* path)
+{
+	const uint64 pipelines_size = list->pipeline_count * sizeof(Command_File_Pipeline);
+	const uint64 size = sizeof(Command_File_Header) + pipelines_size + (list->draw_count * sizeof(Command_File_Draw));
+	uint8* data = new uint8[size];
+
+	Command_File_Header* header = (Command_File_Header*)data;
+	header->magic = c_command_file_magic;
+	header->view_projection_matrix = view->view_projection_matrix;
+	header->light = view->light;
+	header->lod_scale = view->lod_scale;
+	header->pipeline_count = list->pipeline_count;
+	header->draw_count = list->draw_count;
+
+	Command_File_Pipeline* pipelines = (Command_File_Pipeline*)(data + sizeof(Command_File_Header));
+	for (uint32 i = 0; i < list->pipeline_count; ++i)
+	{
+		const Pipeline_State* pipeline = &list->pipelines[i];
+		pipelines[i].untextured = pipeline->untextured;
+		pipelines[i].unlit = pipeline->unlit;
+		pipelines[i].depth_mode = (uint8)pipeline->depth_mode;
+		pipelines[i].texture_address = (uint8)pipeline->texture_address;
+		pipelines[i].colour[0] = pipeline->colour[0];
+		pipelines[i].colour[1] = pipeline->colour[1];
+		pipelines[i].colour[2] = pipeline->colour[2];
+		pipelines[i].unused = 0;
+	}
+
+	Command_File_Draw* draws = (Command_File_Draw*)(data + sizeof(Command_File_Header) + pipelines_size);
+	for (uint32 i = 0; i < list->draw_count; ++i)
+	{
+		const Draw_Command* draw = &list->draws[i];
+		assert(draw->model >= models && draw->model < models + model_count);
+		draws[i].transform = draw->transform;
+		draws[i].model = (uint32)(draw->model - models);
+		draws[i].draw_id = draw->draw_id;
+		draws[i].pipeline = draw->pipeline;
+	}
+
+	const bool success = write_file(path, data, size);
+	delete[] data;
+
+	return success;
+}
+
+bool command_list_load(Command_List* out_list, Command_View* out_view, const Model* models, uint32 model_count, const char* path)
+{
+	File file = read_file(path);
+	if (!file.data)
+	{
+		return false;
+	}
+
+	const Command_File_Header* header = (const Command_File_Header*)file.data;
+	if (file.size < sizeof(Command_File_Header) ||
+		header->magic != c_command_file_magic ||
+		header->pipeline_count == 0 ||
+		file.size != sizeof(Command_File_Header) + (header->pipeline_count * (uint64)sizeof(Command_File_Pipeline)) + (header->draw_count * (uint64)sizeof(Command_File_Draw)))
+	{
+		delete[] file.data;
+		return false;
+	}
+
+	const Command_File_Pipeline* pipelines = (const Command_File_Pipeline*)(file.data + sizeof(Command_File_Header));
+	for (uint32 i = 0; i < header->pipeline_count; ++i)
+	{
+		if (pipelines[i].untextured > 1 ||
+			pipelines[i].unlit > 1 ||
+			pipelines[i].depth_mode > (uint8)Depth_Mode::None ||
+			pipelines[i].texture_address > (uint8)Texture_Address::Clamp)
+		{
+			delete[] file.data;
+			return false;
+		}
+	}
+
+	const Command_File_Draw* draws = (const Command_File_Draw*)(pipelines + header->pipeline_count);
+	for (uint32 i = 0; i < header->draw_count; ++i)
+	{
+		if (draws[i].model >= model_count || draws[i].pipeline >= header->pipeline_count)
+		{
+			delete[] file.data;
+			return false;
+		}
+	}
+
+	Command_List list = {};
+	list.pipeline_count = header->pipeline_count;
+	list.pipeline_capacity = header->pipeline_count;
+	list.pipelines = new Pipeline_State[list.pipeline_capacity];
+	for (uint32 i = 0; i < list.pipeline_count; ++i)
+	{
+		Pipeline_State* pipeline = &list.pipelines[i];
+		pipeline->untextured = pipelines[i].untextured != 0;
+		pipeline->unlit = pipelines[i].unlit != 0;
+		pipeline->depth_mode = (Depth_Mode)pipelines[i].depth_mode;
+		pipeline->texture_address = (Texture_Address)pipelines[i].texture_address;
+		pipeline->colour[0] = pipelines[i].colour[0];
+		pipeline->colour[1] = pipelines[i].colour[1];
+		pipeline->colour[2] = pipelines[i].colour[2];
+	}
+	list.draw_count = header->draw_count;
+	list.draw_capacity = uint32_max(header->draw_count, 1);
+	list.draws = new Draw_Command[list.draw_capacity];
+	for (uint32 i = 0; i < list.draw_count; ++i)
+	{
+		list.draws[i].transform = draws[i].transform;
+		list.draws[i].model = &models[draws[i].model];
+		list.draws[i].draw_id = draws[i].draw_id;
+		list.draws[i].pipeline = draws[i].pipeline;
+	}
+
+	Command_View view = {};
+	view.view_projection_matrix = header->view_projection_matrix;
+	view.light = header->light;
+	view.lod_scale = header->lod_scale;
+	delete[] file.data;
+
+	*out_list = list;
+	*out_view = view;
+	return true;
+}
+
+Command_Executor command_executor_create()
+{
+	Command_Executor executor = {};
+	executor.queued = new Queued_Draw[c_initial_draw_capacity];
+	executor.order = new Sort_Item[c_initial_draw_capacity];
+	executor.order_scratch = new Sort_Item[c_initial_draw_capacity];
+	executor.draw_capacity = c_initial_draw_capacity;
+	executor.pipelines = new Pipeline_State[c_initial_pipeline_capacity];
+	executor.pipeline_capacity = c_initial_pipeline_capacity;
+	executor.pipeline_remap = new uint32[c_initial_pipeline_capacity];
+	executor.pipeline_remap_capacity = c_initial_pipeline_capacity;
+
+	return executor;
+}
+
+void command_executor_destroy(Command_Executor* executor)
+{
+	delete[] executor->queued;
+	delete[] executor->order;
+	delete[] executor->order_scratch;
+	delete[] executor->pipelines;
+	delete[] executor->pipeline_remap;
+	*executor = {};
+}
+
+static void reserve_draws(Command_Executor* executor, uint32 draw_count)
+{
+	if (draw_count <= executor->draw_capacity)
+	{
+		return;
+	}
+
+	uint32 new_capacity = executor->draw_capacity * 2;
+	while (new_capacity < draw_count)
+	{
+		new_capacity *= 2;
+	}
+	delete[] executor->queued;
+	delete[] executor->order;
+	delete[] executor->order_scratch;
+	executor->queued = new Queued_Draw[new_capacity];
+	executor->order = new Sort_Item[new_capacity];
+	executor->order_scratch = new Sort_Item[new_capacity];
+	executor->draw_capacity = new_capacity;
+}
+
+// the executor's index for the state, added if it hasn't got one yet
+static uint32 merge_pipeline(Command_Executor* executor, const Pipeline_State* pipeline)
+{
+	// there are only ever a handful
+	for (uint32 i = 0; i < executor->pipeline_count; ++i)
+	{
+		if (pipeline_state_equals(&executor->pipelines[i], pipeline))
+		{
+			return i;
+		}
+	}
+
+	assert(executor->pipeline_count < c_max_executed_pipelines);
+	if (executor->pipeline_count == executor->pipeline_capacity)
+	{
+		const uint32 new_capacity = executor->pipeline_capacity * 2;
+		Pipeline_State* pipelines = new Pipeline_State[new_capacity];
+		memcpy(pipelines, executor->pipelines, executor->pipeline_count * sizeof(Pipeline_State));
+		delete[] executor->pipelines;
+		executor->pipelines = pipelines;
+		executor->pipeline_capacity = new_capacity;
+	}
+
+	executor->pipelines[executor->pipeline_count] = *pipeline;
+	++executor->pipeline_count;
+	return executor->pipeline_count - 1;
+}
+
+static void execute_draw(Render_Context* context, const Queued_Draw* queued, const Matrix_4x4* view_projection_matrix, Vec_3f light)
+{
+	const Draw_Command* command = queued->command;
+	const Model* model = command->model;
+	const Model_Lod* lod = &model->lods[queued->lod];
+	const uint32 vertex_count = lod->vertex_count;
+	render_context_reserve_vertices(context, vertex_count);
+
+	Matrix_4x4 model_view_projection_matrix;
+	matrix_4x4_mul(&model_view_projection_matrix, view_projection_matrix, &command->transform);
+
+	// The transform is a rotation and translation, so its rotation transposed
+	// takes the light back into model space.
+	const Matrix_4x4* transform = &command->transform;
+	const Vec_3f light_in_model_space = {
+		(light.x * transform->m11) + (light.y * transform->m21) + (light.z * transform->m31),
+		(light.x * transform->m12) + (light.y * transform->m22) + (light.z * transform->m32),
+		(light.x * transform->m13) + (light.y * transform->m23) + (light.z * transform->m33) };
+
+	graphics_project_model_lod(context, model, queued->lod, &model_view_projection_matrix, context->projected_vertices, context->unpacked_texcoords);
+	if (!context->pipeline.unlit)
+	{
+		if (model->packed)
+		{
+			graphics_light_packed_vertices(context, model->packed, vertex_count, light_in_model_space, context->vertex_light);
+		}
+		else
+		{
+			graphics_light_vertices(context, model->normals, vertex_count, light_in_model_space, context->vertex_light);
+		}
+	}
+	graphics_draw_model_lod(context, model, queued->lod, context->projected_vertices, context->unpacked_texcoords, context->vertex_light, 0, model->draw_call_count);
+}
+
+Command_Stats command_lists_execute(Command_Executor* executor, Render_Context* context, const Command_List* const* lists, uint32 list_count, const Command_View* view)
+{
+	uint32 draw_count = 0;
+	for (uint32 i = 0; i < list_count; ++i)
+	{
+		draw_count += lists[i]->draw_count;
+	}
+	reserve_draws(executor, draw_count);
+
+	const Matrix_4x4* view_projection_matrix = &view->view_projection_matrix;
+	Frustum frustum;
+	frustum_from_matrix(&frustum, view_projection_matrix);
+
+	Command_Stats stats = {};
+	const uint64 pixels_shaded_before = context->pixels_shaded;
+
+	// cull, and work out each draw's sort key and level of detail on the way
+	executor->pipeline_count = 0;
+	uint32 queued_count = 0;
+	for (uint32 list_i = 0; list_i < list_count; ++list_i)
+	{
+		const Command_List* list = lists[list_i];
+		if (list->pipeline_count > executor->pipeline_remap_capacity)
+		{
+			delete[] executor->pipeline_remap;
+			executor->pipeline_remap = new uint32[list->pipeline_count];
+			executor->pipeline_remap_capacity = list->pipeline_count;
+		}
+		for (uint32 i = 0; i < list->pipeline_count; ++i)
+		{
+			executor->pipeline_remap[i] = merge_pipeline(executor, &list->pipelines[i]);
+		}
+
+		for (uint32 i = 0; i < list->draw_count; ++i)
+		{
+			const Draw_Command* command = &list->draws[i];
+			const Model* model = command->model;
+			Vec_3f bounds_min;
+			Vec_3f bounds_max;
+			aabb_transform(&command->transform, model->bounds_min, model->bounds_max, &bounds_min, &bounds_max);
+			if (!frustum_intersects_aabb(&frustum, bounds_min, bounds_max))
+			{
+				++stats.draws_culled;
+				continue;
+			}
+
+			// w is the distance along the view direction, see scene_draw
+			const Vec_3f centre = vec_3f_mul(vec_3f_add(bounds_min, bounds_max), 0.5f);
+			const float32 w = matrix_4x4_mul_vec4(view_projection_matrix, centre).w;
+
+			Queued_Draw* queued = &executor->queued[queued_count];
+			queued->command = command;
+			queued->pipeline = executor->pipeline_remap[command->pipeline];
+			queued->lod = model_select_view_lod(model, 0, view->lod_scale, w);
+			executor->order[queued_count].key = (queued->pipeline << 16) | depth_sort_key(w);
+			executor->order[queued_count].value = queued_count;
+			++queued_count;
+		}
+	}
+
+	const uint32 key_bits = 16 + uint32_highest_set_bit(uint32_max(executor->pipeline_count, 2) - 1) + 1;
+	radix_sort(executor->order, executor->order_scratch, queued_count, key_bits);
+
+	const Pipeline_State context_pipeline = context->pipeline;
+	const Vec_3f light = { view->light.x, view->light.y, view->light.z };
+	uint32 pipeline = c_max_executed_pipelines;
+	for (uint32 i = 0; i < queued_count; ++i)
+	{
+		const Queued_Draw* queued = &executor->queued[executor->order[i].value];
+		if (queued->pipeline != pipeline)
+		{
+			pipeline = queued->pipeline;
+			context->pipeline = executor->pipelines[pipeline];
+			++stats.pipeline_changes;
+		}
+
+		context->draw_id = queued->command->draw_id;
+		execute_draw(context, queued, view_projection_matrix, light);
+		stats.triangles_submitted += queued->command->model->lods[queued->lod].triangle_count;
+	}
+	context->pipeline = context_pipeline;
+	stats.draws_executed = queued_count;
+
+	if (context->ordering_table)
+	{
+		graphics_draw_ordering_table(context);
+	}
+	else if (context->target->visibility)
+	{
+		context->pixels_shaded += graphics_shade_visibility_buffer(context);
+	}
+
+	stats.pixels_shaded = (uint32)(context->pixels_shaded - pixels_shaded_before);
+
+	return stats;
+}
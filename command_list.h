@@ -0,0 +1,101 @@
+#pragma once
+
+#include "graphics.h"
+#include "sort.h"
+
+
+// A draw recorded for later. Transforms are rotation and translation only,
+// like scene instances'.
+struct Draw_Command
+{
+	Matrix_4x4 transform;
+	const Model* model;
+	uint32 draw_id;
+	uint32 pipeline; // index into the list's pipelines
+};
+
+// Draws recorded rather than drawn, to be culled, sorted and executed later.
+// A list is only touched by whoever's recording it, so each thread can record
+// its own and they're executed together. Pipeline states are kept once per
+// change and draws refer to them by index.
+struct Command_List
+{
+	Draw_Command* draws;
+	uint32 draw_count;
+	uint32 draw_capacity;
+
+	Pipeline_State* pipelines;
+	uint32 pipeline_count;
+	uint32 pipeline_capacity;
+};
+
+// What lists are executed from. Lists are lit by light, a direction, only.
+struct Command_View
+{
+	Matrix_4x4 view_projection_matrix;
+	Vec_4f light;
+	// as for Scene_View, 0 draws everything at full detail
+	float32 lod_scale;
+};
+
+struct Command_Stats
+{
+	uint32 draws_executed;
+	uint32 draws_culled;
+	uint32 pipeline_changes;
+	uint32 triangles_submitted;
+	uint32 pixels_shaded;
+};
+
+// A draw that survived culling, on its way to being drawn
+struct Queued_Draw
+{
+	const Draw_Command* command;
+	uint32 pipeline; // index into the executor's pipelines
+	uint32 lod;
+};
+
+// Scratch for executing lists, grown to whatever the biggest frame needs.
+// Pipelines from all the lists are merged, so draws sharing a state share an
+// index whichever list they came from.
+struct Command_Executor
+{
+	Queued_Draw* queued;
+	Sort_Item* order;
+	Sort_Item* order_scratch;
+	uint32 draw_capacity;
+
+	Pipeline_State* pipelines;
+	uint32 pipeline_count;
+	uint32 pipeline_capacity;
+	// a list's pipeline indices to the executor's, for the list being gathered
+	uint32* pipeline_remap;
+	uint32 pipeline_remap_capacity;
+};
+
+
+Command_List command_list_create();
+void command_list_destroy(Command_List* list);
+// empties the list, keeping its memory for the next frame
+void command_list_reset(Command_List* list);
+// Draws recorded from now on use this state. Lists start with the zeroed,
+// full pipeline.
+void command_list_set_pipeline(Command_List* list, const Pipeline_State* pipeline);
+void command_list_draw(Command_List* list, const Model* model, const Matrix_4x4* transform, uint32 draw_id);
+
+// Models are saved as indices into models, so a list can be loaded in another
+// run which has loaded the same models in the same order. The view it was
+// recorded for is saved with it, so the frame can be replayed exactly.
+bool command_list_save(const Command_List* list, const Command_View* view, const Model* models, uint32 model_count, const char* path);
+// false if the file is missing, isn't a command list, refers to models past
+// model_count or has pipeline states this build doesn't have
+bool command_list_load(Command_List* out_list, Command_View* out_view, const Model* models, uint32 model_count, const char* path);
+
+Command_Executor command_executor_create();
+void command_executor_destroy(Command_Executor* executor);
+// Draws everything in the lists. Draws outside the view are culled, the rest
+// are sorted by pipeline, then front to back, and each is drawn at the level
+// of detail its distance calls for. Like scene_draw, an ordering table or
+// visibility buffer is drawn or shaded afterwards, with the context's own
+// pipeline, as the draws' aren't known by then.
+Command_Stats command_lists_execute(Command_Executor* executor, Render_Context* context, const Command_List* const* lists, uint32 list_count, const Command_View* view);
@@ -0,0 +1,108 @@
+#include "dynamic_resolution.h"
+
+#include "assert.h"
+#include "maths.h"
+
+
+Dynamic_Resolution dynamic_resolution_create(float32 budget_s, float32 min_scale)
+{
+	assert(budget_s > 0.0f);
+	assert(min_scale > 0.0f && min_scale <= 1.0f);
+
+	Dynamic_Resolution resolution = {};
+	resolution.budget_s = budget_s;
+	resolution.min_scale = min_scale;
+	resolution.max_scale = 1.0f;
+	resolution.scale_step = 1.0f / 16.0f;
+	resolution.increase_threshold = 0.7f;
+	resolution.increase_delay_frames = 30;
+	resolution.smoothing = 0.1f;
+	resolution.scale = 1.0f;
+	resolution.average_raster_s = 0.0f;
+
+	return resolution;
+}
+
+static float32 snap_scale(const Dynamic_Resolution* resolution, float32 scale)
+{
+	// small bias so a scale that is already on a step doesn't round down to the
+	// one below through float error
+	const float32 snapped = float32_floor((scale / resolution->scale_step) + 0.001f) * resolution->scale_step;
+	return float32_clamp(resolution->min_scale, resolution->max_scale, snapped);
+}
+
+static void set_scale(Dynamic_Resolution* resolution, float32 scale)
+{
+	if (scale == resolution->scale)
+	{
+		return;
+	}
+
+	// the average was measured at the old scale, rescale it to what we expect
+	// at the new one so the next few samples don't look like a spike
+	const float32 area_ratio = (scale * scale) / (resolution->scale * resolution->scale);
+	resolution->average_raster_s *= area_ratio;
+	resolution->scale = scale;
+	resolution->frames_under_threshold = 0;
+	++resolution->scale_changes;
+}
+
+void dynamic_resolution_update(Dynamic_Resolution* resolution, float32 raster_s)
+{
+	if (resolution->average_raster_s == 0.0f)
+	{
+		resolution->average_raster_s = raster_s;
+	}
+	else
+	{
+		resolution->average_raster_s = float32_lerp(resolution->average_raster_s, raster_s, resolution->smoothing);
+	}
+
+	const float32 average = resolution->average_raster_s;
+	if (average > resolution->budget_s)
+	{
+		// over budget, drop straight to the scale we predict fits
+		const float32 predicted = resolution->scale * float32_sqrt(resolution->budget_s / average);
+		float32 scale = snap_scale(resolution, predicted);
+		if (scale == resolution->scale && scale > resolution->min_scale)
+		{
+			// prediction rounded back to where we are, always make progress
+			scale = snap_scale(resolution, resolution->scale - resolution->scale_step);
+		}
+		set_scale(resolution, scale);
+	}
+	else if (average < resolution->budget_s * resolution->increase_threshold && resolution->scale < resolution->max_scale)
+	{
+		++resolution->frames_under_threshold;
+		if (resolution->frames_under_threshold >= resolution->increase_delay_frames)
+		{
+			// only go up one step at a time, and never to a scale predicted to
+			// be over budget, otherwise we'd just come straight back down
+			const float32 scale = snap_scale(resolution, resolution->scale + resolution->scale_step);
+			const float32 area_ratio = (scale * scale) / (resolution->scale * resolution->scale);
+			if (average * area_ratio < resolution->budget_s)
+			{
+				set_scale(resolution, scale);
+			}
+			else
+			{
+				resolution->frames_under_threshold = 0;
+			}
+		}
+	}
+	else
+	{
+		resolution->frames_under_threshold = 0;
+	}
+}
+
+float32 dynamic_resolution_scale(const Dynamic_Resolution* resolution)
+{
+	return resolution->scale;
+}
+
+void dynamic_resolution_size(const Dynamic_Resolution* resolution, int32 output_width, int32 output_height, int32* out_width, int32* out_height)
+{
+	*out_width = int32_max(1, (int32)(output_width * resolution->scale));
+	*out_height = int32_max(1, (int32)(output_height * resolution->scale));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "types.h"
+
+
+// Picks the internal render resolution from how long recent frames took to
+// rasterise. Raster cost is roughly proportional to pixel count, so the scale
+// (applied to both axes) is predicted from the square root of the ratio of
+// budget to measured cost. Scale only goes down once the average is over
+// budget, and only comes back up after it has stayed comfortably under budget
+// for a while, so it doesn't oscillate between two sizes.
+struct Dynamic_Resolution
+{
+	float32 budget_s;
+	float32 min_scale;
+	float32 max_scale;
+	float32 scale_step; // scales are snapped to multiples of this
+	float32 increase_threshold; // fraction of budget average must stay under to scale up
+	int32 increase_delay_frames;
+	float32 smoothing; // weight given to the newest sample in the moving average
+
+	float32 scale;
+	float32 average_raster_s;
+	int32 frames_under_threshold;
+	uint32 scale_changes;
+};
+
+
+Dynamic_Resolution dynamic_resolution_create(float32 budget_s, float32 min_scale);
+// feed in how long the frame rendered at the current scale took to rasterise
+void dynamic_resolution_update(Dynamic_Resolution* resolution, float32 raster_s);
+float32 dynamic_resolution_scale(const Dynamic_Resolution* resolution);
+void dynamic_resolution_size(const Dynamic_Resolution* resolution, int32 output_width, int32 output_height, int32* out_width, int32* out_height);
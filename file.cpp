@@ -9,6 +9,11 @@
 File read_file(const char* path)
 {
 	HANDLE file_handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+	{
+		return {};
+	}
+
 	LARGE_INTEGER file_size;
 	GetFileSizeEx(file_handle, &file_size);
 
@@ -19,6 +24,22 @@ File read_file(const char* path)
 	DWORD bytes_read;
 	const BOOL success = ReadFile(file_handle, file.data, file_size.QuadPart, &bytes_read, nullptr);
 	assert(success);
+	CloseHandle(file_handle);
 
 	return file;
+}
+
+bool write_file(const char* path, const uint8* data, uint64 size)
+{
+	HANDLE file_handle = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	DWORD bytes_written;
+	const BOOL success = WriteFile(file_handle, data, (DWORD)size, &bytes_written, nullptr);
+	CloseHandle(file_handle);
+
+	return success && bytes_written == size;
 }
\ No newline at end of file
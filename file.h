@@ -9,4 +9,6 @@ struct File
 	uint8* data;
 };
 
-File read_file(const char* path);
\ No newline at end of file
+// data is nullptr if the file couldn't be opened
+File read_file(const char* path);
+bool write_file(const char* path, const uint8* data, uint64 size);
\ No newline at end of file
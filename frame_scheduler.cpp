@@ -0,0 +1,97 @@
+#include "frame_scheduler.h"
+
+#include "assert.h"
+#include "maths.h"
+
+
+Frame_Scheduler frame_scheduler_create(int64 clock_frequency, float32 step_duration_s, float32 render_interval_s, int32 max_steps_per_frame, int64 now)
+{
+	assert(clock_frequency > 0);
+	assert(max_steps_per_frame > 0);
+
+	Frame_Scheduler scheduler = {};
+	scheduler.clock_frequency = clock_frequency;
+	scheduler.step_duration = (int64)(clock_frequency * (float64)step_duration_s);
+	scheduler.render_interval = (int64)(clock_frequency * (float64)render_interval_s);
+	scheduler.max_steps_per_frame = max_steps_per_frame;
+	scheduler.simulation_time = now;
+	scheduler.next_render_time = now;
+
+	assert(scheduler.step_duration > 0);
+
+	return scheduler;
+}
+
+int32 frame_scheduler_update(Frame_Scheduler* scheduler, int64 now)
+{
+	// a step is due once the time it simulates up to has passed
+	const int64 elapsed = now - scheduler->simulation_time;
+	if (elapsed < scheduler->step_duration)
+	{
+		return 0;
+	}
+
+	int64 steps_due = elapsed / scheduler->step_duration;
+	if (steps_due > scheduler->max_steps_per_frame)
+	{
+		// we've fallen too far behind (breakpoint, window drag, long load),
+		// rather than spiral trying to catch up, drop the excess so the
+		// simulation just runs slow for a moment
+		const int64 dropped = steps_due - scheduler->max_steps_per_frame;
+		scheduler->dropped_steps += dropped;
+		scheduler->simulation_time += dropped * scheduler->step_duration;
+		steps_due = scheduler->max_steps_per_frame;
+	}
+
+	// only the steps still run are late, the rest were counted as dropped
+	scheduler->missed_steps += steps_due - 1;
+
+	scheduler->simulation_time += steps_due * scheduler->step_duration;
+	scheduler->simulation_steps += steps_due;
+
+	return (int32)steps_due;
+}
+
+bool frame_scheduler_begin_render(Frame_Scheduler* scheduler, int64 now)
+{
+	if (now < scheduler->next_render_time)
+	{
+		return false;
+	}
+
+	if (scheduler->render_interval > 0)
+	{
+		// skip over any slots we were too late for, rather than rendering
+		// back to back to catch up
+		const int64 slots_passed = (now - scheduler->next_render_time) / scheduler->render_interval;
+		scheduler->missed_renders += slots_passed;
+		scheduler->next_render_time += (slots_passed + 1) * scheduler->render_interval;
+	}
+	else
+	{
+		scheduler->next_render_time = now;
+	}
+
+	++scheduler->frames_rendered;
+	return true;
+}
+
+float32 frame_scheduler_alpha(const Frame_Scheduler* scheduler, int64 now)
+{
+	// the current state is at simulation_time and now is somewhere within the
+	// step after it. Rendering a blend of the previous and current states by
+	// that fraction costs a step of latency, but motion stays smooth whatever
+	// the render rate is.
+	const int64 since_current = now - scheduler->simulation_time;
+	return float32_clamp(0.0f, 1.0f, since_current / (float32)scheduler->step_duration);
+}
+
+int64 frame_scheduler_next_wake(const Frame_Scheduler* scheduler)
+{
+	const int64 next_step = scheduler->simulation_time + scheduler->step_duration;
+	if (scheduler->render_interval > 0 && scheduler->next_render_time < next_step)
+	{
+		return scheduler->next_render_time;
+	}
+	return next_step;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.h"
+
+
+// Fixed step simulation with rendering decoupled from it. Times are in ticks
+// of whatever clock the caller uses (QueryPerformanceCounter on windows).
+// Each loop iteration asks how many simulation steps are due, runs them, and
+// renders if a render is due, interpolating between the last two simulation
+// states by frame_scheduler_alpha. The rest of the time should be spent
+// sleeping until frame_scheduler_next_wake.
+struct Frame_Scheduler
+{
+	int64 clock_frequency;
+	int64 step_duration;
+	int64 render_interval; // 0 renders every time the loop wakes
+	int32 max_steps_per_frame; // catch-up limit, any more than this are dropped
+
+	int64 simulation_time; // time the simulation has been advanced to
+	int64 next_render_time;
+
+	uint64 simulation_steps;
+	uint64 frames_rendered;
+	uint64 missed_steps; // steps that ran late because earlier ones were overdue
+	uint64 dropped_steps; // steps skipped entirely because of the catch-up limit
+	uint64 missed_renders; // render slots that passed without a render
+};
+
+
+Frame_Scheduler frame_scheduler_create(int64 clock_frequency, float32 step_duration_s, float32 render_interval_s, int32 max_steps_per_frame, int64 now);
+// returns how many fixed simulation steps to run now
+int32 frame_scheduler_update(Frame_Scheduler* scheduler, int64 now);
+// returns true if a frame should be rendered now, and schedules the next one
+bool frame_scheduler_begin_render(Frame_Scheduler* scheduler, int64 now);
+// how far between the previous and current simulation state to render, 0-1
+float32 frame_scheduler_alpha(const Frame_Scheduler* scheduler, int64 now);
+// the next time anything is due, so the caller can sleep until then
+int64 frame_scheduler_next_wake(const Frame_Scheduler* scheduler);
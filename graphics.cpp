@@ -1,12 +1,11 @@
 #include "graphics.h"
 
+#include <cstring>
 #include "assert.h"
 #include "string.h"
 #include "file.h"
-
-
-static uint8 frame[c_frame_width * c_frame_height * 3];
-static float32 depth_buffer[c_frame_width * c_frame_height * 3];
+#include "jobs.h"
+#include "packed_mesh.h"
 
 
 Texture texture_bmp(uint8* bmp_file)
@@ -59,49 +58,305 @@ const Texture* texture_db_get(Texture_DB* db, const char* path)
 	return &new_entry->texture;
 }
 
-static constexpr int32 pixel(int32 x, int32 y)
+static int32 frame_stride(int32 width, Pixel_Format format)
+{
+	// DIB rows have to start on a 4 byte boundary
+	return ((width * pixel_format_bytes(format)) + 3) & ~3;
+}
+
+Render_Target render_target_create(int32 width, int32 height, Pixel_Format format)
+{
+	assert(width > 0 && height > 0);
+
+	Render_Target target = {};
+	target.width = width;
+	target.height = height;
+	target.stride = frame_stride(width, format);
+	target.max_width = width;
+	target.max_height = height;
+	target.format = format;
+	target.frame = new uint8[target.stride * height];
+	target.depth_buffer = new float32[width * height];
+
+	return target;
+}
+
+void render_target_destroy(Render_Target* target)
+{
+	delete[] target->frame;
+	delete[] target->depth_buffer;
+	delete[] target->draw_ids;
+	delete[] target->visibility;
+	*target = {};
+}
+
+void render_target_resize(Render_Target* target, int32 width, int32 height)
+{
+	assert(width > 0 && width <= target->max_width);
+	assert(height > 0 && height <= target->max_height);
+
+	// rows are packed to the new width, a smaller stride always fits in the
+	// original allocation
+	target->width = width;
+	target->height = height;
+	target->stride = frame_stride(width, target->format);
+}
+
+void render_target_enable_draw_ids(Render_Target* target)
+{
+	if (!target->draw_ids)
+	{
+		target->draw_ids = new uint32[target->max_width * target->max_height];
+	}
+}
+
+void render_target_enable_visibility(Render_Target* target)
+{
+	if (!target->visibility)
+	{
+		target->visibility = new uint32[target->max_width * target->max_height];
+	}
+}
+
+template <typename Format>
+static void upscale_nearest(const Render_Target* src, Render_Target* dst)
+{
+	// 16.16 fixed point step through the source, sampling at pixel centres
+	const int32 step_x = (src->width << 16) / dst->width;
+	const int32 step_y = (src->height << 16) / dst->height;
+
+	int32 src_y_fixed = step_y >> 1;
+	for (int32 y = 0; y < dst->height; ++y)
+	{
+		const uint8* src_row = src->frame + ((src_y_fixed >> 16) * src->stride);
+		uint8* dst_pixel = dst->frame + (y * dst->stride);
+
+		int32 src_x_fixed = step_x >> 1;
+		for (int32 x = 0; x < dst->width; ++x)
+		{
+			// no need to decode, and copying the source pixel as is keeps
+			// its dither pattern
+			memcpy(dst_pixel, src_row + ((src_x_fixed >> 16) * Format::c_bytes), Format::c_bytes);
+			dst_pixel += Format::c_bytes;
+			src_x_fixed += step_x;
+		}
+
+		src_y_fixed += step_y;
+	}
+}
+
+template <typename Format>
+static void upscale_bilinear(const Render_Target* src, Render_Target* dst)
+{
+	// 16.16 fixed point positions, offset by half a pixel so the centres of
+	// source and destination pixels line up. Weights are 8 bit.
+	const int32 step_x = (src->width << 16) / dst->width;
+	const int32 step_y = (src->height << 16) / dst->height;
+	const int32 max_x = src->width - 1;
+	const int32 max_y = src->height - 1;
+
+	int32 src_y_fixed = (step_y >> 1) - (1 << 15);
+	for (int32 y = 0; y < dst->height; ++y)
+	{
+		const int32 y0 = int32_clamp(0, max_y, src_y_fixed >> 16);
+		const int32 y1 = int32_min(y0 + 1, max_y);
+		const uint32 weight_y = src_y_fixed < 0 ? 0 : (src_y_fixed >> 8) & 0xff;
+		const uint8* row0 = src->frame + (y0 * src->stride);
+		const uint8* row1 = src->frame + (y1 * src->stride);
+		uint8* dst_row = dst->frame + (y * dst->stride);
+
+		int32 src_x_fixed = (step_x >> 1) - (1 << 15);
+		for (int32 x = 0; x < dst->width; ++x)
+		{
+			const int32 x0 = int32_clamp(0, max_x, src_x_fixed >> 16);
+			const int32 x1 = int32_min(x0 + 1, max_x);
+			const uint32 weight_x = src_x_fixed < 0 ? 0 : (src_x_fixed >> 8) & 0xff;
+
+			uint32 corners[4][3];
+			Format::read(row0, x0, &corners[0][0], &corners[0][1], &corners[0][2]);
+			Format::read(row0, x1, &corners[1][0], &corners[1][1], &corners[1][2]);
+			Format::read(row1, x0, &corners[2][0], &corners[2][1], &corners[2][2]);
+			Format::read(row1, x1, &corners[3][0], &corners[3][1], &corners[3][2]);
+
+			uint32 out[3];
+			for (int32 channel = 0; channel < 3; ++channel)
+			{
+				const uint32 top = (corners[0][channel] * (256 - weight_x)) + (corners[1][channel] * weight_x);
+				const uint32 bottom = (corners[2][channel] * (256 - weight_x)) + (corners[3][channel] * weight_x);
+				out[channel] = ((top * (256 - weight_y)) + (bottom * weight_y)) >> 16;
+			}
+			Format::write(dst_row, x, y, out[0], out[1], out[2]);
+
+			src_x_fixed += step_x;
+		}
+
+		src_y_fixed += step_y;
+	}
+}
+
+template <typename Format>
+static void upscale(const Render_Target* src, Render_Target* dst, Upscale_Filter filter)
+{
+	switch (filter)
+	{
+	case Upscale_Filter::Nearest:
+		upscale_nearest<Format>(src, dst);
+		break;
+
+	case Upscale_Filter::Bilinear:
+		upscale_bilinear<Format>(src, dst);
+		break;
+	}
+}
+
+void render_target_upscale(const Render_Target* src, Render_Target* dst, Upscale_Filter filter)
+{
+	assert(src->format == dst->format);
+
+	switch (src->format)
+	{
+	case Pixel_Format::BGR888:
+		upscale<Pixel_BGR888>(src, dst, filter);
+		break;
+
+	case Pixel_Format::BGRX8888:
+		upscale<Pixel_BGRX8888>(src, dst, filter);
+		break;
+
+	case Pixel_Format::RGB555:
+		upscale<Pixel_RGB555>(src, dst, filter);
+		break;
+	}
+}
+
+Render_Context render_context_create(int32 max_height)
+{
+	assert(max_height > 0);
+
+	Render_Context context = {};
+	context.max_height = max_height;
+	context.min_x = new int32[max_height];
+	context.min_depth = new float32[max_height];
+	context.min_texcoord = new Vec_2f[max_height];
+	context.min_light = new float32[max_height];
+	context.max_x = new int32[max_height];
+	context.max_depth = new float32[max_height];
+	context.max_texcoord = new Vec_2f[max_height];
+	context.max_light = new float32[max_height];
+
+	return context;
+}
+
+void render_context_destroy(Render_Context* context)
+{
+	delete[] context->min_x;
+	delete[] context->min_depth;
+	delete[] context->min_texcoord;
+	delete[] context->min_light;
+	delete[] context->max_x;
+	delete[] context->max_depth;
+	delete[] context->max_texcoord;
+	delete[] context->max_light;
+	delete[] context->projected_vertices;
+	delete[] context->unpacked_texcoords;
+	delete[] context->vertex_light;
+	delete[] context->vertex_stamps;
+	delete[] context->stamped_indices;
+	delete[] context->visibility_triangles;
+	delete[] context->set_up_triangles;
+	delete[] context->geometry_chunks;
+	*context = {};
+}
+
+void render_context_reserve_vertices(Render_Context* context, uint32 vertex_count)
 {
-	return ((y * c_frame_width) + x);
+	if (vertex_count > context->projected_vertex_capacity)
+	{
+		delete[] context->projected_vertices;
+		delete[] context->unpacked_texcoords;
+		delete[] context->vertex_light;
+		delete[] context->vertex_stamps;
+		delete[] context->stamped_indices;
+		context->projected_vertices = new Vec_3f[vertex_count];
+		context->unpacked_texcoords = new Vec_2f[vertex_count];
+		context->vertex_light = new float32[vertex_count];
+		// zero is never a draw's stamp
+		context->vertex_stamps = new uint32[vertex_count]();
+		context->stamped_indices = new uint32[vertex_count];
+		context->projected_vertex_capacity = vertex_count;
+	}
 }
 
-void graphics_clear()
+Ordering_Table ordering_table_create(uint32 bucket_count)
 {
-	memset(frame, 0, sizeof(frame));
-	for (int i = 0; i < (c_frame_width * c_frame_height); ++i)
+	assert(bucket_count > 1);
+
+	Ordering_Table table = {};
+	table.buckets = new uint32[bucket_count];
+	table.bucket_count = bucket_count;
+	for (uint32 i = 0; i < bucket_count; ++i)
 	{
-		depth_buffer[i] = INFINITY;
+		table.buckets[i] = c_no_ordered_triangle;
 	}
+
+	return table;
+}
+
+void ordering_table_destroy(Ordering_Table* table)
+{
+	delete[] table->buckets;
+	delete[] table->triangles;
+	*table = {};
 }
 
-void graphics_draw_to_window(HWND window)
+void render_context_set_target(Render_Context* context, Render_Target* target)
 {
-	HDC dc = GetDC(window);
+	// the edge arrays are per row, so they have to cover every row of the target
+	assert(target->height <= context->max_height);
+	context->target = target;
+}
 
-	BITMAPINFO bitmap_info = {};
-	bitmap_info.bmiHeader.biSize = sizeof(bitmap_info.bmiHeader);
-	bitmap_info.bmiHeader.biWidth = c_frame_width;
-	bitmap_info.bmiHeader.biHeight = c_frame_height;
-	bitmap_info.bmiHeader.biPlanes = 1;
-	bitmap_info.bmiHeader.biBitCount = 24;
-	bitmap_info.bmiHeader.biCompression = BI_RGB;
+static int32 pixel(const Render_Target* target, int32 x, int32 y)
+{
+	return ((y * target->width) + x);
+}
 
-	// TODO measure this, bitblt might be faster, also could draw this with directdraw or something if it takes up too much of the frame
-	SetDIBitsToDevice(
-		dc,
-		0, 0,
-		c_frame_width, c_frame_height,
-		0, 0,
-		0,
-		c_frame_height,
-		frame,
-		&bitmap_info,
-		DIB_RGB_COLORS
-	);
+static uint8* frame_row(const Render_Target* target, int32 y)
+{
+	return target->frame + (y * target->stride);
+}
 
-	ReleaseDC(window, dc);
+void graphics_clear(Render_Context* context)
+{
+	Render_Target* target = context->target;
+	memset(target->frame, 0, target->stride * target->height);
+	const int32 pixel_count = target->width * target->height;
+	if (!context->ordering_table)
+	{
+		for (int32 i = 0; i < pixel_count; ++i)
+		{
+			target->depth_buffer[i] = INFINITY;
+		}
+	}
+	if (target->draw_ids)
+	{
+		for (int32 i = 0; i < pixel_count; ++i)
+		{
+			target->draw_ids[i] = c_no_draw_id;
+		}
+	}
+	if (target->visibility)
+	{
+		for (int32 i = 0; i < pixel_count; ++i)
+		{
+			target->visibility[i] = c_no_visibility_triangle;
+		}
+	}
+	context->visibility_triangle_count = 0;
 }
 
-static void draw_line(Vec_3f p1, Vec_3f p2) // TODO more efficient algo impl
+template <typename Format>
+static void draw_line(Render_Target* target, Vec_3f p1, Vec_3f p2) // TODO more efficient algo impl
 {
 	// make sure we're iterating x in a positive direction
 	if (p1.x > p2.x)
@@ -145,10 +400,7 @@ static void draw_line(Vec_3f p1, Vec_3f p2) // TODO more efficient algo impl
 
 		while (true)
 		{
-			const int32 offset = pixel(x, y) * 3;
-			frame[offset] = 0xff;
-			frame[offset + 1] = 0xff;
-			frame[offset + 2] = 0xff;
+			Format::write(frame_row(target, y), x, y, 0xff, 0xff, 0xff);
 
 			if (y == y_end)
 			{
@@ -160,10 +412,13 @@ static void draw_line(Vec_3f p1, Vec_3f p2) // TODO more efficient algo impl
 	}
 }
 
+// Only the attributes the rasteriser will use are interpolated along the edge
+template <bool Depth, bool Textured, bool Lit>
 static void triangle_edge(
 	Vec_3f a, Vec_3f b,
 	Vec_2f a_tex, Vec_2f b_tex,
 	float32 a_light, float32 b_light,
+	int32 height,
 	int32* out_min_x, int32* out_max_x,
 	float32* out_min_depth, float32* out_max_depth,
 	Vec_2f* out_min_texcoord, Vec_2f* out_max_texcoord,
@@ -207,7 +462,7 @@ static void triangle_edge(
 		while (true)
 		{
 			// TODO can we calculate the begin/end range to fill in and do it, then update y to y_end in one step?
-			if (y >= 0 && y < c_frame_height) {
+			if (y >= 0 && y < height) {
 				if (x < out_min_x[y])
 				{
 					out_min_x[y] = x;
@@ -216,9 +471,18 @@ static void triangle_edge(
 					const int32 distance_from_a_sq = ((x - x1) * (x - x1)) + ((y - y1) * (y - y1));
 					const float32 t = float32_sqrt(distance_from_a_sq / (float32)edge_len_sq);
 
-					out_min_depth[y] = float32_lerp(a.z, b.z, t);
-					out_min_texcoord[y] = vec_2f_lerp(a_tex, b_tex, t);
-					out_min_light[y] = float32_lerp(a_light, b_light, t);
+					if (Depth)
+					{
+						out_min_depth[y] = float32_lerp(a.z, b.z, t);
+					}
+					if (Textured)
+					{
+						out_min_texcoord[y] = vec_2f_lerp(a_tex, b_tex, t);
+					}
+					if (Lit)
+					{
+						out_min_light[y] = float32_lerp(a_light, b_light, t);
+					}
 				}
 				if (x > out_max_x[y])
 				{
@@ -228,9 +492,18 @@ static void triangle_edge(
 					const int32 distance_from_a_sq = ((x - x1) * (x - x1)) + ((y - y1) * (y - y1));
 					const float32 t = float32_sqrt(distance_from_a_sq / (float32)edge_len_sq);
 
-					out_max_depth[y] = float32_lerp(a.z, b.z, t);
-					out_max_texcoord[y] = vec_2f_lerp(a_tex, b_tex, t);
-					out_max_light[y] = float32_lerp(a_light, b_light, t);
+					if (Depth)
+					{
+						out_max_depth[y] = float32_lerp(a.z, b.z, t);
+					}
+					if (Textured)
+					{
+						out_max_texcoord[y] = vec_2f_lerp(a_tex, b_tex, t);
+					}
+					if (Lit)
+					{
+						out_max_light[y] = float32_lerp(a_light, b_light, t);
+					}
 				}
 			}
 
@@ -259,7 +532,144 @@ static float32 wrap_texcoord(float32 f)
 	return fmodf(f, 1.0f);
 }
 
-static void draw_triangle(const Vec_3f position[3], const Vec_2f texcoord[3], const float32 light[3], const Texture* texture)
+// Pipeline_State as template parameters, so each combination gets its own
+// rasteriser
+template <bool Is_Textured, bool Is_Lit, Depth_Mode Depth, Texture_Address Address>
+struct Pipeline
+{
+	static constexpr bool c_textured = Is_Textured;
+	static constexpr bool c_lit = Is_Lit;
+	static constexpr Depth_Mode c_depth_mode = Depth;
+	static constexpr Texture_Address c_texture_address = Address;
+};
+
+// what the rasteriser did before there were pipelines, for triangles kept to
+// be drawn later, which need everything
+typedef Pipeline<true, true, Depth_Mode::Test_And_Write, Texture_Address::Wrap> Full_Pipeline;
+
+// Light is quantised to this many levels, each with a table of what it makes
+// of every byte, so lighting a pixel is a lookup per channel rather than float
+// maths. Ambient is baked into the tables, so every level is a different
+// shade.
+static constexpr int32 c_light_levels = 64;
+static constexpr float32 c_ambient = 0.4f;
+
+struct Light_Table
+{
+	uint8 shaded[c_light_levels][256];
+};
+
+static Light_Table light_table_create()
+{
+	Light_Table table;
+	for (int32 level = 0; level < c_light_levels; ++level)
+	{
+		const float32 light = float32_min(1.0f, (level / (float32)(c_light_levels - 1)) + c_ambient);
+		for (int32 i = 0; i < 256; ++i)
+		{
+			table.shaded[level][i] = (uint8)(i * light);
+		}
+	}
+	return table;
+}
+
+static const Light_Table c_light_table = light_table_create();
+
+template <typename Format, typename Pipeline>
+static void shade_pixel(uint8* row, int32 x, int32 y, const Pipeline_State* state, const Texture* texture, Vec_2f texcoord, float32 light)
+{
+	const uint8* shaded = nullptr;
+	if (Pipeline::c_lit)
+	{
+		const int32 level = int32_clamp(0, c_light_levels - 1, (int32)((float32_clamp(0.0f, 1.0f, light) * (c_light_levels - 1)) + 0.5f));
+		shaded = c_light_table.shaded[level];
+	}
+
+	const uint8* colour = state->colour;
+	if (Pipeline::c_textured)
+	{
+		if (Pipeline::c_texture_address == Texture_Address::Wrap)
+		{
+			texcoord.x = wrap_texcoord(texcoord.x);
+			texcoord.y = wrap_texcoord(texcoord.y);
+		}
+		// clamping is left to the texel clamp below
+		const int32 tex_pixel_x = int32_clamp(0, texture->width - 1, (int32)float32_floor(texcoord.x * texture->width));
+		const int32 tex_pixel_y = int32_clamp(0, texture->height - 1, (int32)float32_floor(texcoord.y * texture->height));
+		colour = texture->pixels + (((tex_pixel_y * texture->width) + tex_pixel_x) * 3);
+	}
+
+	if (Pipeline::c_lit)
+	{
+		Format::write(row, x, y, shaded[colour[0]], shaded[colour[1]], shaded[colour[2]]);
+	}
+	else
+	{
+		Format::write(row, x, y, colour[0], colour[1], colour[2]);
+	}
+}
+
+// a = (b * weight_b) + (c * weight_c), solved for how an attribute changes
+// per pixel from the two edges leaving vertex 0
+static Vec_3f attribute_plane(float32 a0, float32 a1, float32 a2, Vec_2f edge_1, Vec_2f edge_2, float32 inverse_area)
+{
+	const float32 d1 = a1 - a0;
+	const float32 d2 = a2 - a0;
+	return {
+		a0,
+		((d1 * edge_2.y) - (d2 * edge_1.y)) * inverse_area,
+		((d2 * edge_1.x) - (d1 * edge_2.x)) * inverse_area };
+}
+
+static void add_visibility_triangle(Render_Context* context, const Vec_3f position[3], const Vec_2f texcoord[3], const float32 light[3], const Texture* texture)
+{
+	if (context->visibility_triangle_count == context->visibility_triangle_capacity)
+	{
+		const uint32 new_capacity = uint32_max(context->visibility_triangle_capacity * 2, 1024);
+		Visibility_Triangle* triangles = new Visibility_Triangle[new_capacity];
+		memcpy(triangles, context->visibility_triangles, context->visibility_triangle_count * sizeof(Visibility_Triangle));
+		delete[] context->visibility_triangles;
+		context->visibility_triangles = triangles;
+		context->visibility_triangle_capacity = new_capacity;
+	}
+
+	// Slivers too thin to have an area still cover pixels, they get their
+	// first vertex's attributes all over.
+	const Vec_2f edge_1 = { position[1].x - position[0].x, position[1].y - position[0].y };
+	const Vec_2f edge_2 = { position[2].x - position[0].x, position[2].y - position[0].y };
+	const float32 area = (edge_1.x * edge_2.y) - (edge_1.y * edge_2.x);
+	const float32 inverse_area = float32_abs(area) > 1e-6f ? 1.0f / area : 0.0f;
+
+	Visibility_Triangle* triangle = &context->visibility_triangles[context->visibility_triangle_count];
+	++context->visibility_triangle_count;
+	triangle->texture = texture;
+	triangle->origin = { position[0].x, position[0].y };
+	triangle->texcoord_u = attribute_plane(texcoord[0].x, texcoord[1].x, texcoord[2].x, edge_1, edge_2, inverse_area);
+	triangle->texcoord_v = attribute_plane(texcoord[0].y, texcoord[1].y, texcoord[2].y, edge_1, edge_2, inverse_area);
+	triangle->light = attribute_plane(light[0], light[1], light[2], edge_1, edge_2, inverse_area);
+	triangle->texcoord_min = {
+		float32_min(texcoord[0].x, float32_min(texcoord[1].x, texcoord[2].x)),
+		float32_min(texcoord[0].y, float32_min(texcoord[1].y, texcoord[2].y)) };
+	triangle->texcoord_max = {
+		float32_max(texcoord[0].x, float32_max(texcoord[1].x, texcoord[2].x)),
+		float32_max(texcoord[0].y, float32_max(texcoord[1].y, texcoord[2].y)) };
+}
+
+// What happens to triangles that reach the rasteriser
+enum class Raster_Mode
+{
+	// filled in as they're drawn, as the pipeline says
+	Forward,
+	// depth tested, only which triangle is nearest is written, they're
+	// textured and lit once per pixel by graphics_shade_visibility
+	Visibility,
+	// put in the context's ordering table rather than drawn, until
+	// graphics_draw_ordering_table draws them without depth
+	Ordered
+};
+
+template <typename Format, bool Write_Draw_Ids, Raster_Mode Mode, typename Pipeline>
+static void draw_triangle(Render_Context* context, const Vec_3f position[3], const Vec_2f texcoord[3], const float32 light[3], const Texture* texture)
 {
 	// High level algorithm is to plot the 3 lines describing the edges, use
 	// this to figure out per row (y) what the min/max x value is, and 
@@ -267,135 +677,1087 @@ static void draw_triangle(const Vec_3f position[3], const Vec_2f texcoord[3], co
 	// Then go row by row, and min x to max x, filling in the pixels, and 
 	// interpolating attributes from min to max x
 
-	// TODO put this somewhere, get all the globals/statics into a struct or something
-	static int32 min_x[c_frame_height];
-	static float32 min_depth[c_frame_height];
-	static Vec_2f min_texcoord[c_frame_height];
-	static float32 min_light[c_frame_height];
-	static int32 max_x[c_frame_height];
-	static float32 max_depth[c_frame_height];
-	static Vec_2f max_texcoord[c_frame_height];
-	static float32 max_light[c_frame_height];
+	// visibility buffers only need depth, their attributes are worked out when shading
+	constexpr Depth_Mode c_depth_mode = Mode == Raster_Mode::Visibility ? Depth_Mode::Test_And_Write : Pipeline::c_depth_mode;
+	constexpr bool c_textured = Mode == Raster_Mode::Forward && Pipeline::c_textured;
+	constexpr bool c_lit = Mode == Raster_Mode::Forward && Pipeline::c_lit;
+
+	Render_Target* target = context->target;
+	int32* min_x = context->min_x;
+	float32* min_depth = context->min_depth;
+	Vec_2f* min_texcoord = context->min_texcoord;
+	float32* min_light = context->min_light;
+	int32* max_x = context->max_x;
+	float32* max_depth = context->max_depth;
+	Vec_2f* max_texcoord = context->max_texcoord;
+	float32* max_light = context->max_light;
 
 	const int32 y_min = int32_max(0, int32_min(int32_min(int32(position[0].y), int32(position[1].y)), int32(position[2].y)));
-	const int32 y_max = int32_min(c_frame_height - 1, int32_max(int32_max(int32(position[0].y), int32(position[1].y)), int32(position[2].y)));
+	const int32 y_max = int32_min(target->height - 1, int32_max(int32_max(int32(position[0].y), int32(position[1].y)), int32(position[2].y)));
 
 	// TODO is there a better way of doing this?
 	for (int32 y = y_min; y <= y_max; ++y)
 	{
-		min_x[y] = c_frame_width;
+		min_x[y] = target->width;
 		max_x[y] = -1;
 	}
 
-	triangle_edge(position[0], position[1], texcoord[0], texcoord[1], light[0], light[1], min_x, max_x, min_depth, max_depth, min_texcoord, max_texcoord, min_light, max_light);
-	triangle_edge(position[1], position[2], texcoord[1], texcoord[2], light[1], light[2], min_x, max_x, min_depth, max_depth, min_texcoord, max_texcoord, min_light, max_light);
-	triangle_edge(position[2], position[0], texcoord[2], texcoord[0], light[2], light[0], min_x, max_x, min_depth, max_depth, min_texcoord, max_texcoord, min_light, max_light);
+	constexpr bool c_depth = c_depth_mode != Depth_Mode::None;
+	triangle_edge<c_depth, c_textured, c_lit>(position[0], position[1], texcoord[0], texcoord[1], light[0], light[1], target->height, min_x, max_x, min_depth, max_depth, min_texcoord, max_texcoord, min_light, max_light);
+	triangle_edge<c_depth, c_textured, c_lit>(position[1], position[2], texcoord[1], texcoord[2], light[1], light[2], target->height, min_x, max_x, min_depth, max_depth, min_texcoord, max_texcoord, min_light, max_light);
+	triangle_edge<c_depth, c_textured, c_lit>(position[2], position[0], texcoord[2], texcoord[0], light[2], light[0], target->height, min_x, max_x, min_depth, max_depth, min_texcoord, max_texcoord, min_light, max_light);
 
+	const Pipeline_State* state = &context->pipeline;
+	float32* depth_buffer = target->depth_buffer;
+	uint32 pixels_shaded = 0;
+	const uint32 visibility_triangle = context->visibility_triangle_count;
+	uint32 pixels_visible = 0;
 	for (int32 y = int32_max(y_min, 0); y <= y_max; ++y)
 	{
-		const int32 x_end = int32_min(max_x[y], c_frame_width - 1);
+		uint8* row = frame_row(target, y);
+		const int32 x_end = int32_min(max_x[y], target->width - 1);
 		for (int32 x = int32_max(min_x[y], 0); x <= x_end; ++x)
 		{
 			const float32 t = min_x[y] != max_x[y] ? (x - min_x[y]) / (float32)(max_x[y] - min_x[y]) : 0.0f;
-			const float32 depth = float32_lerp(min_depth[y], max_depth[y], t);
 
-			const int32 offset = pixel(x, y);
-			if (depth_buffer[offset] > depth)
+			const int32 offset = pixel(target, x, y);
+			if (c_depth)
+			{
+				const float32 depth = float32_lerp(min_depth[y], max_depth[y], t);
+				if (!(depth_buffer[offset] > depth))
+				{
+					continue;
+				}
+				if (c_depth_mode == Depth_Mode::Test_And_Write)
+				{
+					depth_buffer[offset] = depth;
+				}
+			}
+
+			if (Write_Draw_Ids)
 			{
-				depth_buffer[offset] = depth;
-
-				constexpr float32 c_ambient = 0.4f;
-				const float32 lerped_light = float32_clamp(0.0f, 1.0f, float32_lerp(min_light[y], max_light[y], t));
-				const float32 final_light = float32_clamp(0.0f, 1.0f, lerped_light + c_ambient);
-
-				Vec_2f texcoord = vec_2f_lerp(min_texcoord[y], max_texcoord[y], t);
-				texcoord.x = wrap_texcoord(texcoord.x);
-				texcoord.y = wrap_texcoord(texcoord.y);
-				const int32 tex_pixel_x = int32_clamp(0, texture->width - 1, (int32)float32_floor(texcoord.x * texture->width));
-				const int32 tex_pixel_y = int32_clamp(0, texture->height - 1, (int32)float32_floor(texcoord.y * texture->height));
-				const int32 tex_pixel_offset = ((tex_pixel_y * texture->width) + tex_pixel_x) * 3;
-
-				const int32 frame_offset = offset * 3;
-				frame[frame_offset] = texture->pixels[tex_pixel_offset] * final_light;
-				frame[frame_offset + 1] = texture->pixels[tex_pixel_offset + 1] * final_light;
-				frame[frame_offset + 2] = texture->pixels[tex_pixel_offset + 2] * final_light;
+				target->draw_ids[offset] = context->draw_id;
 			}
+
+			if (Mode == Raster_Mode::Visibility)
+			{
+				target->visibility[offset] = visibility_triangle;
+				++pixels_visible;
+				continue;
+			}
+
+			const Vec_2f pixel_texcoord = c_textured ? vec_2f_lerp(min_texcoord[y], max_texcoord[y], t) : Vec_2f{};
+			const float32 pixel_light = c_lit ? float32_lerp(min_light[y], max_light[y], t) : 0.0f;
+			shade_pixel<Format, Pipeline>(row, x, y, state, texture, pixel_texcoord, pixel_light);
+			++pixels_shaded;
 		}
 	}
+	context->pixels_shaded += pixels_shaded;
+
+	// only kept if it's nearest anywhere, for now at least
+	if (pixels_visible)
+	{
+		add_visibility_triangle(context, position, texcoord, light, texture);
+	}
 }
 
-void project_and_draw(
-	const Vec_3f* vertices,
-	const Vec_3f* normals,
-	const Vec_2f* texcoords,
-	Vec_3f* projected_vertices,
-	const int32 vertex_count,
-	const int32* triangles,
-	const Draw_Call* draw_calls,
-	uint32 draw_call_count,
-	Vec_4f light_in_world_space,
-	const Matrix_4x4* inverse_model_matrix,
-	const Matrix_4x4* model_view_projection_matrix)
+// Depth is z / w, which for a perspective projection makes 1 - depth about
+// near / w. The bits of a float are close to its log, so bucketing on them
+// gives each doubling of distance as many buckets, out to this many
+// doublings past the near plane.
+static constexpr uint32 c_ordering_table_doublings = 16;
+
+static uint32 ordering_table_bucket(const Ordering_Table* table, float32 depth)
+{
+	constexpr float32 c_min_inverse_depth = 1.0f / (1 << c_ordering_table_doublings);
+	const float32 inverse_depth = float32_clamp(c_min_inverse_depth, 1.0f, 1.0f - depth);
+	uint32 bits;
+	memcpy(&bits, &inverse_depth, sizeof(bits));
+	uint32 min_bits;
+	memcpy(&min_bits, &c_min_inverse_depth, sizeof(min_bits));
+
+	// the float's exponent is 23 bits up, so there are this many bits between the min and 1
+	constexpr uint64 c_bits_range = (uint64)c_ordering_table_doublings << 23;
+	return (uint32)(((bits - min_bits) * (uint64)(table->bucket_count - 1)) / c_bits_range);
+}
+
+static void ordering_table_add(Ordering_Table* table, uint32 draw_id, const Vec_3f position[3], const Vec_2f texcoord[3], const float32 light[3], const Texture* texture)
 {
-	for (int i = 0; i < vertex_count; ++i)
+	if (table->triangle_count == table->triangle_capacity)
 	{
-		Vec_4f projected3d = matrix_4x4_mul_vec4(model_view_projection_matrix, vertices[i]);
-		projected3d.x /= projected3d.w;
-		projected3d.y /= projected3d.w;
-		projected3d.z /= projected3d.w;
-		projected3d.x = (projected3d.x + 1) / 2;
-		projected3d.y = (projected3d.y - 1) / -2;
-		projected3d.x *= c_frame_width;
-		projected3d.y *= c_frame_height;
-		projected_vertices[i] = { projected3d.x, projected3d.y, projected3d.z };
+		const uint32 new_capacity = uint32_max(table->triangle_capacity * 2, 1024);
+		Ordered_Triangle* triangles = new Ordered_Triangle[new_capacity];
+		memcpy(triangles, table->triangles, table->triangle_count * sizeof(Ordered_Triangle));
+		delete[] table->triangles;
+		table->triangles = triangles;
+		table->triangle_capacity = new_capacity;
 	}
 
-	const bool light_is_directional = light_in_world_space.w == 0.0f;
-	Vec_3f light_in_model_space = matrix_4x4_mul_direction(inverse_model_matrix, { light_in_world_space.x, light_in_world_space.y, light_in_world_space.z});
+	const uint32 index = table->triangle_count;
+	++table->triangle_count;
+
+	Ordered_Triangle* triangle = &table->triangles[index];
+	for (int32 i = 0; i < 3; ++i)
+	{
+		triangle->position[i] = position[i];
+		triangle->texcoord[i] = texcoord[i];
+		triangle->light[i] = light[i];
+	}
+	triangle->texture = texture;
+	triangle->draw_id = draw_id;
+
+	// the average, like the ps1's AVSZ3
+	const float32 depth = (position[0].z + position[1].z + position[2].z) * (1.0f / 3.0f);
+	const uint32 bucket = ordering_table_bucket(table, depth);
+	triangle->next = table->buckets[bucket];
+	table->buckets[bucket] = index;
+}
+
+// A draw's triangles and what they're drawn with, passed down through picking
+// the rasteriser. Vertices are already lit, once each.
+template <typename Index>
+struct Triangle_Batch
+{
+	Render_Context* context;
+	const Vec_3f* projected_vertices;
+	const Vec_2f* texcoords;
+	const float32* vertex_light;
+	const Index* triangles;
+	const Draw_Call* draw_calls;
+	uint32 draw_call_count;
+};
+
+// Below these there isn't enough work in a draw to be worth splitting up
+static constexpr uint32 c_vertices_per_geometry_job = 1024;
+static constexpr uint32 c_triangles_per_geometry_job = 512;
+
+// runs func over 0 to count, on the context's workers if it has any and
+// there's more than one job's worth
+static void run_geometry_stage(const Render_Context* context, uint32 count, uint32 per_job, Job_Range_Func func, void* data)
+{
+	if (context->jobs && count > per_job)
+	{
+		job_parallel_for(context->jobs, 0, count, per_job, func, data);
+	}
+	else
+	{
+		func(data, 0, count);
+	}
+}
+
+// Fetches a triangle's vertices and works out whether it's worth rasterising.
+// Texcoords and light are only fetched for triangles which are.
+template <bool Textured, bool Lit, typename Index>
+static bool set_up_triangle(const Triangle_Batch<Index>* batch, uint32 draw_call_i, uint32 triangle_i, float32 frame_width, float32 frame_height, Set_Up_Triangle* out_triangle)
+{
+	const Vec_3f* projected_vertices = batch->projected_vertices;
+	const Draw_Call* draw_call = &batch->draw_calls[draw_call_i];
+	const int32 base = (draw_call->triangle_start + triangle_i) * 3;
+	const int32 v0 = batch->triangles[base];
+	const int32 v1 = batch->triangles[base + 1];
+	const int32 v2 = batch->triangles[base + 2];
+
+	Vec_3f* pos = out_triangle->position;
+	pos[0] = projected_vertices[v0];
+	pos[1] = projected_vertices[v1];
+	pos[2] = projected_vertices[v2];
+
+	// There's no clipping yet, so a triangle crossing the near plane
+	// has vertices projected from behind the camera, which can be
+	// huge and make the edge walk take forever. Drop them instead.
+	if (pos[0].z < 0.0f || pos[1].z < 0.0f || pos[2].z < 0.0f ||
+		pos[0].z > 1.0f || pos[1].z > 1.0f || pos[2].z > 1.0f)
+	{
+		return false;
+	}
+
+	// TODO is it quicker to do this before projection by seeing if
+	// any of the vertices lie on the positive side of the planes
+	// defining the view frustum
+	bool on_screen = false;
+	for (int32 i = 0; i < 3 && !on_screen; ++i)
+	{
+		// TODO depth based culling too
+		on_screen = pos[i].x >= 0.0f && pos[i].x < frame_width &&
+			pos[i].y >= 0.0f && pos[i].y < frame_height;
+	}
+	if (!on_screen || vec_3f_cross(vec_3f_sub(pos[0], pos[1]), vec_3f_sub(pos[0], pos[2])).z <= 0.0f)
+	{
+		return false;
+	}
+
+	if (Textured)
+	{
+		const Vec_2f* texcoords = batch->texcoords;
+		out_triangle->texcoord[0] = texcoords[v0];
+		out_triangle->texcoord[1] = texcoords[v1];
+		out_triangle->texcoord[2] = texcoords[v2];
+	}
+
+	if (Lit)
+	{
+		const float32* vertex_light = batch->vertex_light;
+		out_triangle->light[0] = vertex_light[v0];
+		out_triangle->light[1] = vertex_light[v1];
+		out_triangle->light[2] = vertex_light[v2];
+	}
+
+	out_triangle->texture = draw_call->texture;
+	return true;
+}
 
-	Vec_3f pos[3];
-	Vec_2f tex[3];
-	float32 light[3];
-	for (int32 draw_call_i = 0; draw_call_i < draw_call_count; ++draw_call_i)
+template <typename Format, bool Write_Draw_Ids, Raster_Mode Mode, typename Pipeline>
+static void rasterise(Render_Context* context, const Set_Up_Triangle* triangle)
+{
+	if (Mode == Raster_Mode::Ordered)
+	{
+		ordering_table_add(context->ordering_table, context->draw_id, triangle->position, triangle->texcoord, triangle->light, triangle->texture);
+	}
+	else
+	{
+		draw_triangle<Format, Write_Draw_Ids, Mode, Pipeline>(context, triangle->position, triangle->texcoord, triangle->light, triangle->texture);
+	}
+}
+
+template <typename Index>
+struct Set_Up_Job
+{
+	const Triangle_Batch<Index>* batch;
+	Geometry_Chunk* chunks;
+	Set_Up_Triangle* out_triangles;
+	float32 frame_width;
+	float32 frame_height;
+};
+
+template <bool Textured, bool Lit, typename Index>
+static void set_up_chunks(void* data, uint32 begin, uint32 end)
+{
+	const Set_Up_Job<Index>* job = (const Set_Up_Job<Index>*)data;
+
+	Set_Up_Triangle triangle = {};
+	for (uint32 chunk_i = begin; chunk_i < end; ++chunk_i)
 	{
-		for (int32 triangle_i = 0; triangle_i < draw_calls[draw_call_i].triangle_count; ++triangle_i)
+		Geometry_Chunk* chunk = &job->chunks[chunk_i];
+		Set_Up_Triangle* out_triangles = job->out_triangles + chunk->first_output;
+		uint32 kept = 0;
+		for (uint32 i = 0; i < chunk->triangle_count; ++i)
 		{
-			const int32 base = (draw_calls[draw_call_i].triangle_start + triangle_i) * 3;
-			const int32 v0 = triangles[base];
-			const int32 v1 = triangles[base + 1];
-			const int32 v2 = triangles[base + 2];
-
-			pos[0] = projected_vertices[v0];
-			pos[1] = projected_vertices[v1];
-			pos[2] = projected_vertices[v2];
-
-			// TODO maybe move tex and light stuff into prior to draw_triangle, as it may be culled
-			tex[0] = texcoords[v0];
-			tex[1] = texcoords[v1];
-			tex[2] = texcoords[v2];
-
-			light[0] = -vec_3f_dot(normals[v0], light_in_model_space);
-			light[1] = -vec_3f_dot(normals[v1], light_in_model_space);
-			light[2] = -vec_3f_dot(normals[v2], light_in_model_space);
-
-			// TODO is it quicker to do this before projection by seeing if
-			// any of the vertices lie on the positive side of the planes
-			// defining the view frustum
-			for (int32 i = 0; i < 3; ++i)
+			if (set_up_triangle<Textured, Lit>(job->batch, chunk->draw_call, chunk->triangle_start + i, job->frame_width, job->frame_height, &triangle))
 			{
-				// TODO depth based culling too
-				if (pos[i].x >= 0.0f && pos[i].x < c_frame_width &&
-					pos[i].y >= 0.0f && pos[i].y < c_frame_height)
-				{
-					// at least one vertex is visible
-					if (vec_3f_cross(vec_3f_sub(pos[0], pos[1]), vec_3f_sub(pos[0], pos[2])).z > 0.0f)
-					{
-						draw_triangle(pos, tex, light, draw_calls[draw_call_i].texture);
-					}
-
-					break;
-				}
+				out_triangles[kept] = triangle;
+				++kept;
 			}
 		}
+		chunk->kept = kept;
 	}
+}
+
+// Splits each draw call's triangles into chunks of up to a job's worth,
+// making room for every triangle to be kept. Returns the number of chunks.
+static uint32 plan_geometry_chunks(Render_Context* context, const Draw_Call* draw_calls, uint32 draw_call_count, uint32 triangle_count)
+{
+	uint32 chunk_count = 0;
+	for (uint32 i = 0; i < draw_call_count; ++i)
+	{
+		chunk_count += (draw_calls[i].triangle_count + c_triangles_per_geometry_job - 1) / c_triangles_per_geometry_job;
+	}
+
+	if (triangle_count > context->set_up_triangle_capacity)
+	{
+		delete[] context->set_up_triangles;
+		context->set_up_triangles = new Set_Up_Triangle[triangle_count];
+		context->set_up_triangle_capacity = triangle_count;
+	}
+	if (chunk_count > context->geometry_chunk_capacity)
+	{
+		delete[] context->geometry_chunks;
+		context->geometry_chunks = new Geometry_Chunk[chunk_count];
+		context->geometry_chunk_capacity = chunk_count;
+	}
+
+	uint32 chunk_i = 0;
+	uint32 first_output = 0;
+	for (uint32 draw_call_i = 0; draw_call_i < draw_call_count; ++draw_call_i)
+	{
+		const uint32 draw_call_triangles = draw_calls[draw_call_i].triangle_count;
+		for (uint32 start = 0; start < draw_call_triangles; start += c_triangles_per_geometry_job)
+		{
+			Geometry_Chunk* chunk = &context->geometry_chunks[chunk_i];
+			chunk->draw_call = draw_call_i;
+			chunk->triangle_start = start;
+			chunk->triangle_count = uint32_min(c_triangles_per_geometry_job, draw_call_triangles - start);
+			chunk->first_output = first_output;
+			chunk->kept = 0;
+			first_output += chunk->triangle_count;
+			++chunk_i;
+		}
+	}
+
+	return chunk_count;
+}
+
+template <typename Format, bool Write_Draw_Ids, Raster_Mode Mode, typename Pipeline, typename Index>
+static void draw_triangles(const Triangle_Batch<Index>* batch)
+{
+	// triangles drawn later need everything, whatever the pipeline
+	constexpr bool c_textured = Mode != Raster_Mode::Forward || Pipeline::c_textured;
+	constexpr bool c_lit = Mode != Raster_Mode::Forward || Pipeline::c_lit;
+
+	Render_Context* context = batch->context;
+	const Draw_Call* draw_calls = batch->draw_calls;
+	const float32 frame_width = (float32)context->target->width;
+	const float32 frame_height = (float32)context->target->height;
+
+	uint32 triangle_count = 0;
+	for (uint32 i = 0; i < batch->draw_call_count; ++i)
+	{
+		triangle_count += draw_calls[i].triangle_count;
+	}
+
+	if (!context->jobs || triangle_count <= c_triangles_per_geometry_job)
+	{
+		Set_Up_Triangle triangle = {};
+		for (uint32 draw_call_i = 0; draw_call_i < batch->draw_call_count; ++draw_call_i)
+		{
+			for (uint32 triangle_i = 0; triangle_i < draw_calls[draw_call_i].triangle_count; ++triangle_i)
+			{
+				if (set_up_triangle<c_textured, c_lit>(batch, draw_call_i, triangle_i, frame_width, frame_height, &triangle))
+				{
+					rasterise<Format, Write_Draw_Ids, Mode, Pipeline>(context, &triangle);
+				}
+			}
+		}
+		return;
+	}
+
+	// Set up is independent per triangle so it's split between the workers,
+	// but the rasteriser's scratch is the context's, and ordering table
+	// lists and ties in depth both depend on the order triangles arrive in,
+	// so they're all rasterised here, chunk by chunk in submission order.
+	const uint32 chunk_count = plan_geometry_chunks(context, draw_calls, batch->draw_call_count, triangle_count);
+	Set_Up_Job<Index> job = { batch, context->geometry_chunks, context->set_up_triangles, frame_width, frame_height };
+	job_parallel_for(context->jobs, 0, chunk_count, 1, set_up_chunks<c_textured, c_lit, Index>, &job);
+
+	for (uint32 chunk_i = 0; chunk_i < chunk_count; ++chunk_i)
+	{
+		const Geometry_Chunk* chunk = &context->geometry_chunks[chunk_i];
+		const Set_Up_Triangle* triangles = context->set_up_triangles + chunk->first_output;
+		for (uint32 i = 0; i < chunk->kept; ++i)
+		{
+			rasterise<Format, Write_Draw_Ids, Mode, Pipeline>(context, &triangles[i]);
+		}
+	}
+}
+
+struct Project_Vertices_Job
+{
+	const Vec_3f* vertices;
+	const uint32* indices; // optional, otherwise the vertices are projected in order
+	const Matrix_4x4* matrix;
+	float32 frame_width;
+	float32 frame_height;
+	Vec_3f* out_projected_vertices;
+};
+
+static void project_vertices(void* data, uint32 begin, uint32 end)
+{
+	const Project_Vertices_Job* job = (const Project_Vertices_Job*)data;
+	const Vec_3f* vertices = job->vertices;
+	const float32 frame_width = job->frame_width;
+	const float32 frame_height = job->frame_height;
+
+	for (uint32 i = begin; i < end; ++i)
+	{
+		const uint32 vertex = job->indices ? job->indices[i] : i;
+		Vec_4f projected3d = matrix_4x4_mul_vec4(job->matrix, vertices[vertex]);
+		projected3d.x /= projected3d.w;
+		projected3d.y /= projected3d.w;
+		projected3d.z /= projected3d.w;
+		projected3d.x = (projected3d.x + 1) / 2;
+		projected3d.y = (projected3d.y - 1) / -2;
+		projected3d.x *= frame_width;
+		projected3d.y *= frame_height;
+		job->out_projected_vertices[vertex] = { projected3d.x, projected3d.y, projected3d.z };
+	}
+}
+
+void graphics_project_vertices(
+	const Render_Context* context,
+	const Vec_3f* vertices,
+	uint32 vertex_count,
+	const Matrix_4x4* model_view_projection_matrix,
+	Vec_3f* out_projected_vertices)
+{
+	const Render_Target* target = context->target;
+	Project_Vertices_Job job = { vertices, nullptr, model_view_projection_matrix, (float32)target->width, (float32)target->height, out_projected_vertices };
+	run_geometry_stage(context, vertex_count, c_vertices_per_geometry_job, project_vertices, &job);
+}
+
+void graphics_project_indexed_vertices(
+	const Render_Context* context,
+	const Vec_3f* vertices,
+	const uint32* indices,
+	uint32 index_count,
+	const Matrix_4x4* model_view_projection_matrix,
+	Vec_3f* out_projected_vertices)
+{
+	const Render_Target* target = context->target;
+	Project_Vertices_Job job = { vertices, indices, model_view_projection_matrix, (float32)target->width, (float32)target->height, out_projected_vertices };
+	run_geometry_stage(context, index_count, c_vertices_per_geometry_job, project_vertices, &job);
+}
+
+struct Project_Packed_Vertices_Job
+{
+	const Packed_Mesh* mesh;
+	Matrix_4x4 matrix; // with the dequantising folded in
+	float32 frame_width;
+	float32 frame_height;
+	Vec_3f* out_projected_vertices;
+	Vec_2f* out_texcoords;
+};
+
+static void project_packed_vertices(void* data, uint32 begin, uint32 end)
+{
+	const Project_Packed_Vertices_Job* job = (const Project_Packed_Vertices_Job*)data;
+	const Packed_Mesh* mesh = job->mesh;
+	const float32 frame_width = job->frame_width;
+	const float32 frame_height = job->frame_height;
+	const Vec_2f texcoord_min = mesh->texcoord_min;
+	const Vec_2f texcoord_scale = mesh->texcoord_scale;
+
+	for (uint32 i = begin; i < end; ++i)
+	{
+		const Packed_Vertex* vertex = &mesh->vertices[i];
+
+		Vec_4f projected3d = matrix_4x4_mul_vec4(&job->matrix, { (float32)vertex->position[0], (float32)vertex->position[1], (float32)vertex->position[2] });
+		projected3d.x /= projected3d.w;
+		projected3d.y /= projected3d.w;
+		projected3d.z /= projected3d.w;
+		projected3d.x = (projected3d.x + 1) / 2;
+		projected3d.y = (projected3d.y - 1) / -2;
+		projected3d.x *= frame_width;
+		projected3d.y *= frame_height;
+		job->out_projected_vertices[i] = { projected3d.x, projected3d.y, projected3d.z };
+
+		job->out_texcoords[i] = { texcoord_min.x + (vertex->texcoord[0] * texcoord_scale.x), texcoord_min.y + (vertex->texcoord[1] * texcoord_scale.y) };
+	}
+}
+
+void graphics_project_packed_vertices(
+	const Render_Context* context,
+	const Packed_Mesh* mesh,
+	uint32 vertex_count,
+	const Matrix_4x4* model_view_projection_matrix,
+	Vec_3f* out_projected_vertices,
+	Vec_2f* out_texcoords)
+{
+	// position = position_min + (packed * position_scale), so scaling the
+	// matrix's columns by the scale and moving its translation by the min
+	// lets packed positions be transformed directly
+	const Matrix_4x4* m = model_view_projection_matrix;
+	const Vec_3f min = mesh->position_min;
+	const Vec_3f scale = mesh->position_scale;
+	Matrix_4x4 matrix = *m;
+	matrix.m11 = m->m11 * scale.x;
+	matrix.m12 = m->m12 * scale.y;
+	matrix.m13 = m->m13 * scale.z;
+	matrix.m14 = (m->m11 * min.x) + (m->m12 * min.y) + (m->m13 * min.z) + m->m14;
+	matrix.m21 = m->m21 * scale.x;
+	matrix.m22 = m->m22 * scale.y;
+	matrix.m23 = m->m23 * scale.z;
+	matrix.m24 = (m->m21 * min.x) + (m->m22 * min.y) + (m->m23 * min.z) + m->m24;
+	matrix.m31 = m->m31 * scale.x;
+	matrix.m32 = m->m32 * scale.y;
+	matrix.m33 = m->m33 * scale.z;
+	matrix.m34 = (m->m31 * min.x) + (m->m32 * min.y) + (m->m33 * min.z) + m->m34;
+	matrix.m41 = m->m41 * scale.x;
+	matrix.m42 = m->m42 * scale.y;
+	matrix.m43 = m->m43 * scale.z;
+	matrix.m44 = (m->m41 * min.x) + (m->m42 * min.y) + (m->m43 * min.z) + m->m44;
+
+	const Render_Target* target = context->target;
+	Project_Packed_Vertices_Job job = { mesh, matrix, (float32)target->width, (float32)target->height, out_projected_vertices, out_texcoords };
+	run_geometry_stage(context, vertex_count, c_vertices_per_geometry_job, project_packed_vertices, &job);
+}
+
+struct Light_Vertices_Job
+{
+	const Vec_3f* normals;
+	Vec_3f light_in_model_space;
+	float32* out_light;
+};
+
+static void light_vertices(void* data, uint32 begin, uint32 end)
+{
+	const Light_Vertices_Job* job = (const Light_Vertices_Job*)data;
+	const Vec_3f* normals = job->normals;
+	const Vec_3f light_in_model_space = job->light_in_model_space;
+
+	for (uint32 i = begin; i < end; ++i)
+	{
+		job->out_light[i] = -vec_3f_dot(normals[i], light_in_model_space);
+	}
+}
+
+void graphics_light_vertices(const Render_Context* context, const Vec_3f* normals, uint32 vertex_count, Vec_3f light_in_model_space, float32* out_light)
+{
+	Light_Vertices_Job job = { normals, light_in_model_space, out_light };
+	run_geometry_stage(context, vertex_count, c_vertices_per_geometry_job, light_vertices, &job);
+}
+
+struct Light_Packed_Vertices_Job
+{
+	const Packed_Mesh* mesh;
+	Vec_3f light_in_model_space;
+	float32* out_light;
+};
+
+static void light_packed_vertices(void* data, uint32 begin, uint32 end)
+{
+	const Light_Packed_Vertices_Job* job = (const Light_Packed_Vertices_Job*)data;
+	const Packed_Mesh* mesh = job->mesh;
+	const Vec_3f light_in_model_space = job->light_in_model_space;
+
+	for (uint32 i = begin; i < end; ++i)
+	{
+		const Vec_3f normal = packed_normal_decode(mesh->vertices[i].normal);
+		job->out_light[i] = -vec_3f_dot(normal, light_in_model_space);
+	}
+}
+
+void graphics_light_packed_vertices(const Render_Context* context, const Packed_Mesh* mesh, uint32 vertex_count, Vec_3f light_in_model_space, float32* out_light)
+{
+	Light_Packed_Vertices_Job job = { mesh, light_in_model_space, out_light };
+	run_geometry_stage(context, vertex_count, c_vertices_per_geometry_job, light_packed_vertices, &job);
+}
+
+// Light from a local light reaching a vertex, fading as (1 - d^2 / r^2)^2 so
+// it's exactly nothing at the range rather than the long tail of inverse
+// square.
+static float32 local_light_at(const Local_Light* light, Vec_3f position, Vec_3f normal)
+{
+	const Vec_3f to_light = vec_3f_sub(light->position, position);
+	const float32 distance_sq = vec_3f_dot(to_light, to_light);
+	const float32 range_sq = light->range * light->range;
+	if (distance_sq >= range_sq)
+	{
+		return 0.0f;
+	}
+
+	const float32 distance = float32_sqrt(distance_sq);
+	if (distance <= 0.0f)
+	{
+		return light->intensity;
+	}
+
+	const float32 n_dot_l = vec_3f_dot(normal, to_light) / distance;
+	if (n_dot_l <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	float32 falloff = 1.0f - (distance_sq / range_sq);
+	falloff *= falloff;
+
+	if (light->cos_outer > -1.0f)
+	{
+		const float32 cos_angle = -vec_3f_dot(to_light, light->direction) / distance;
+		const float32 cone_width = float32_max(light->cos_inner - light->cos_outer, 0.0001f);
+		falloff *= float32_clamp(0.0f, 1.0f, (cos_angle - light->cos_outer) / cone_width);
+	}
+
+	return light->intensity * n_dot_l * falloff;
+}
+
+static void add_local_lights(Vec_3f position, Vec_3f normal, const Local_Light* lights, uint32 light_count, float32* inout_light)
+{
+	float32 added = 0.0f;
+	for (uint32 i = 0; i < light_count; ++i)
+	{
+		added += local_light_at(&lights[i], position, normal);
+	}
+
+	// the directional light goes negative facing away from it, which would
+	// eat into the local light
+	if (added > 0.0f)
+	{
+		*inout_light = float32_max(*inout_light, 0.0f) + added;
+	}
+}
+
+struct Local_Lights_Job
+{
+	const Vec_3f* vertices;
+	const Vec_3f* normals;
+	const Local_Light* lights;
+	uint32 light_count;
+	float32* inout_light;
+};
+
+static void light_vertices_locally(void* data, uint32 begin, uint32 end)
+{
+	const Local_Lights_Job* job = (const Local_Lights_Job*)data;
+	for (uint32 i = begin; i < end; ++i)
+	{
+		add_local_lights(job->vertices[i], job->normals[i], job->lights, job->light_count, &job->inout_light[i]);
+	}
+}
+
+void graphics_add_local_lights(
+	const Render_Context* context,
+	const Vec_3f* vertices,
+	const Vec_3f* normals,
+	uint32 vertex_count,
+	const Local_Light* lights_in_model_space,
+	uint32 light_count,
+	float32* inout_light)
+{
+	if (light_count == 0)
+	{
+		return;
+	}
+
+	Local_Lights_Job job = { vertices, normals, lights_in_model_space, light_count, inout_light };
+	run_geometry_stage(context, vertex_count, c_vertices_per_geometry_job, light_vertices_locally, &job);
+}
+
+struct Packed_Local_Lights_Job
+{
+	const Packed_Mesh* mesh;
+	const Local_Light* lights;
+	uint32 light_count;
+	float32* inout_light;
+};
+
+static void light_packed_vertices_locally(void* data, uint32 begin, uint32 end)
+{
+	const Packed_Local_Lights_Job* job = (const Packed_Local_Lights_Job*)data;
+	const Packed_Mesh* mesh = job->mesh;
+	const Vec_3f min = mesh->position_min;
+	const Vec_3f scale = mesh->position_scale;
+
+	for (uint32 i = begin; i < end; ++i)
+	{
+		const Packed_Vertex* vertex = &mesh->vertices[i];
+		const Vec_3f position = {
+			min.x + (vertex->position[0] * scale.x),
+			min.y + (vertex->position[1] * scale.y),
+			min.z + (vertex->position[2] * scale.z) };
+		add_local_lights(position, packed_normal_decode(vertex->normal), job->lights, job->light_count, &job->inout_light[i]);
+	}
+}
+
+void graphics_add_packed_local_lights(
+	const Render_Context* context,
+	const Packed_Mesh* mesh,
+	uint32 vertex_count,
+	const Local_Light* lights_in_model_space,
+	uint32 light_count,
+	float32* inout_light)
+{
+	if (light_count == 0)
+	{
+		return;
+	}
+
+	Packed_Local_Lights_Job job = { mesh, lights_in_model_space, light_count, inout_light };
+	run_geometry_stage(context, vertex_count, c_vertices_per_geometry_job, light_packed_vertices_locally, &job);
+}
+
+// Picking a rasteriser turns the target's format, whether it has draw ids and
+// the pipeline state into template parameters a level at a time, ending in
+// Op::run with them all. It's done once per draw rather than per pixel.
+template <typename Op, typename Format, bool Write_Draw_Ids, bool Textured, bool Lit, Depth_Mode Depth>
+static void dispatch_texture_address(const Pipeline_State* state, typename Op::Args* args)
+{
+	// the address mode does nothing without a texture, so that's one less rasteriser
+	if (state->texture_address == Texture_Address::Clamp)
+	{
+		Op::template run<Format, Write_Draw_Ids, Pipeline<Textured, Lit, Depth, Textured ? Texture_Address::Clamp : Texture_Address::Wrap>>(args);
+	}
+	else
+	{
+		Op::template run<Format, Write_Draw_Ids, Pipeline<Textured, Lit, Depth, Texture_Address::Wrap>>(args);
+	}
+}
+
+template <typename Op, typename Format, bool Write_Draw_Ids, bool Textured, bool Lit>
+static void dispatch_depth_mode(const Pipeline_State* state, typename Op::Args* args)
+{
+	switch (state->depth_mode)
+	{
+	case Depth_Mode::Test_And_Write:
+		dispatch_texture_address<Op, Format, Write_Draw_Ids, Textured, Lit, Depth_Mode::Test_And_Write>(state, args);
+		break;
+
+	case Depth_Mode::Test:
+		dispatch_texture_address<Op, Format, Write_Draw_Ids, Textured, Lit, Depth_Mode::Test>(state, args);
+		break;
+
+	case Depth_Mode::None:
+		dispatch_texture_address<Op, Format, Write_Draw_Ids, Textured, Lit, Depth_Mode::None>(state, args);
+		break;
+	}
+}
+
+template <typename Op, typename Format, bool Write_Draw_Ids, bool Textured>
+static void dispatch_lighting(const Pipeline_State* state, typename Op::Args* args)
+{
+	if (state->unlit)
+	{
+		dispatch_depth_mode<Op, Format, Write_Draw_Ids, Textured, false>(state, args);
+	}
+	else
+	{
+		dispatch_depth_mode<Op, Format, Write_Draw_Ids, Textured, true>(state, args);
+	}
+}
+
+template <typename Op, typename Format>
+static void dispatch_draw_ids(const Render_Target* target, const Pipeline_State* state, typename Op::Args* args)
+{
+	if (target->draw_ids)
+	{
+		if (state->untextured)
+		{
+			dispatch_lighting<Op, Format, true, false>(state, args);
+		}
+		else
+		{
+			dispatch_lighting<Op, Format, true, true>(state, args);
+		}
+	}
+	else
+	{
+		if (state->untextured)
+		{
+			dispatch_lighting<Op, Format, false, false>(state, args);
+		}
+		else
+		{
+			dispatch_lighting<Op, Format, false, true>(state, args);
+		}
+	}
+}
+
+template <typename Op>
+static void dispatch_pipeline(const Render_Target* target, const Pipeline_State* state, typename Op::Args* args)
+{
+	switch (target->format)
+	{
+	case Pixel_Format::BGR888:
+		dispatch_draw_ids<Op, Pixel_BGR888>(target, state, args);
+		break;
+
+	case Pixel_Format::BGRX8888:
+		dispatch_draw_ids<Op, Pixel_BGRX8888>(target, state, args);
+		break;
+
+	case Pixel_Format::RGB555:
+		dispatch_draw_ids<Op, Pixel_RGB555>(target, state, args);
+		break;
+	}
+}
+
+template <typename Index>
+struct Draw_Triangles_Op
+{
+	typedef const Triangle_Batch<Index> Args;
+
+	template <typename Format, bool Write_Draw_Ids, typename Pipeline>
+	static void run(Args* batch)
+	{
+		draw_triangles<Format, Write_Draw_Ids, Raster_Mode::Forward, Pipeline>(batch);
+	}
+};
+
+template <typename Index>
+static void draw_triangles_for_target(const Triangle_Batch<Index>* batch)
+{
+	// Nothing's written to the frame until later for these, so the format
+	// doesn't matter yet, and the pipeline is only used then.
+	const Render_Context* context = batch->context;
+	if (context->ordering_table)
+	{
+		draw_triangles<Pixel_BGRX8888, false, Raster_Mode::Ordered, Full_Pipeline>(batch);
+		return;
+	}
+	if (context->target->visibility)
+	{
+		if (context->target->draw_ids)
+		{
+			draw_triangles<Pixel_BGRX8888, true, Raster_Mode::Visibility, Full_Pipeline>(batch);
+		}
+		else
+		{
+			draw_triangles<Pixel_BGRX8888, false, Raster_Mode::Visibility, Full_Pipeline>(batch);
+		}
+		return;
+	}
+
+	dispatch_pipeline<Draw_Triangles_Op<Index>>(context->target, &context->pipeline, batch);
+}
+
+template <typename Format, typename Pipeline>
+static uint32 shade_visibility(const Render_Context* context, int32 y_begin, int32 y_end)
+{
+	const Render_Target* target = context->target;
+	const Pipeline_State* state = &context->pipeline;
+	const Visibility_Triangle* triangles = context->visibility_triangles;
+
+	uint32 pixels_shaded = 0;
+	for (int32 y = y_begin; y < y_end; ++y)
+	{
+		uint8* row = frame_row(target, y);
+		const uint32* visibility = target->visibility + pixel(target, 0, y);
+		// attributes are sampled at pixel centres
+		const float32 offset_y = (float32)y + 0.5f;
+		for (int32 x = 0; x < target->width; ++x)
+		{
+			if (visibility[x] == c_no_visibility_triangle)
+			{
+				continue;
+			}
+
+			const Visibility_Triangle* triangle = &triangles[visibility[x]];
+			const float32 dx = ((float32)x + 0.5f) - triangle->origin.x;
+			const float32 dy = offset_y - triangle->origin.y;
+			Vec_2f texcoord = {};
+			if (Pipeline::c_textured)
+			{
+				texcoord.x = float32_clamp(triangle->texcoord_min.x, triangle->texcoord_max.x, triangle->texcoord_u.x + (triangle->texcoord_u.y * dx) + (triangle->texcoord_u.z * dy));
+				texcoord.y = float32_clamp(triangle->texcoord_min.y, triangle->texcoord_max.y, triangle->texcoord_v.x + (triangle->texcoord_v.y * dx) + (triangle->texcoord_v.z * dy));
+			}
+			const float32 light = Pipeline::c_lit ? triangle->light.x + (triangle->light.y * dx) + (triangle->light.z * dy) : 0.0f;
+			shade_pixel<Format, Pipeline>(row, x, y, state, triangle->texture, texcoord, light);
+			++pixels_shaded;
+		}
+	}
+
+	return pixels_shaded;
+}
+
+struct Shade_Visibility_Args
+{
+	const Render_Context* context;
+	int32 y_begin;
+	int32 y_end;
+	uint32 pixels_shaded;
+};
+
+// draw ids and depth were dealt with when the visibility buffer was drawn
+struct Shade_Visibility_Op
+{
+	typedef Shade_Visibility_Args Args;
+
+	template <typename Format, bool Write_Draw_Ids, typename Pipeline>
+	static void run(Args* args)
+	{
+		args->pixels_shaded = shade_visibility<Format, Pipeline>(args->context, args->y_begin, args->y_end);
+	}
+};
+
+uint32 graphics_shade_visibility(const Render_Context* context, int32 y_begin, int32 y_end)
+{
+	assert(context->target->visibility);
+	assert(y_begin >= 0 && y_end <= context->target->height);
+
+	Shade_Visibility_Args args = {};
+	args.context = context;
+	args.y_begin = y_begin;
+	args.y_end = y_end;
+	dispatch_pipeline<Shade_Visibility_Op>(context->target, &context->pipeline, &args);
+	return args.pixels_shaded;
+}
+
+// Below this many rows there isn't enough shading to be worth splitting up
+static constexpr uint32 c_rows_per_shade_job = 16;
+
+struct Shade_Rows_Job
+{
+	const Render_Context* context;
+	std::atomic<uint32> pixels_shaded;
+};
+
+static void shade_rows(void* data, uint32 begin, uint32 end)
+{
+	Shade_Rows_Job* job = (Shade_Rows_Job*)data;
+	job->pixels_shaded += graphics_shade_visibility(job->context, (int32)begin, (int32)end);
+}
+
+uint32 graphics_shade_visibility_buffer(const Render_Context* context)
+{
+	const uint32 height = (uint32)context->target->height;
+	if (!context->jobs || height <= c_rows_per_shade_job)
+	{
+		return graphics_shade_visibility(context, 0, (int32)height);
+	}
+
+	Shade_Rows_Job job;
+	job.context = context;
+	job.pixels_shaded = 0;
+	job_parallel_for(context->jobs, 0, height, c_rows_per_shade_job, shade_rows, &job);
+	return job.pixels_shaded;
+}
+
+template <typename Format, bool Write_Draw_Ids, typename Pipeline>
+static void draw_ordering_table(Render_Context* context)
+{
+	const Ordering_Table* table = context->ordering_table;
+	for (uint32 bucket = 0; bucket < table->bucket_count; ++bucket)
+	{
+		for (uint32 i = table->buckets[bucket]; i != c_no_ordered_triangle; i = table->triangles[i].next)
+		{
+			const Ordered_Triangle* triangle = &table->triangles[i];
+			context->draw_id = triangle->draw_id;
+			draw_triangle<Format, Write_Draw_Ids, Raster_Mode::Forward, Pipeline>(context, triangle->position, triangle->texcoord, triangle->light, triangle->texture);
+		}
+	}
+}
+
+struct Draw_Ordering_Table_Op
+{
+	typedef Render_Context Args;
+
+	template <typename Format, bool Write_Draw_Ids, typename Pipeline>
+	static void run(Args* context)
+	{
+		draw_ordering_table<Format, Write_Draw_Ids, Pipeline>(context);
+	}
+};
+
+void graphics_draw_ordering_table(Render_Context* context)
+{
+	assert(context->ordering_table);
+
+	// the order is all there is to hide things
+	Pipeline_State state = context->pipeline;
+	state.depth_mode = Depth_Mode::None;
+	dispatch_pipeline<Draw_Ordering_Table_Op>(context->target, &state, context);
+
+	Ordering_Table* table = context->ordering_table;
+	for (uint32 i = 0; i < table->bucket_count; ++i)
+	{
+		table->buckets[i] = c_no_ordered_triangle;
+	}
+	table->triangle_count = 0;
+}
+
+void graphics_draw_lit_triangles(
+	Render_Context* context,
+	const Vec_3f* projected_vertices,
+	const Vec_2f* texcoords,
+	const float32* light,
+	const int32* triangles,
+	const Draw_Call* draw_calls,
+	uint32 draw_call_count)
+{
+	const Triangle_Batch<int32> batch = { context, projected_vertices, texcoords, light, triangles, draw_calls, draw_call_count };
+	draw_triangles_for_target(&batch);
+}
+
+void graphics_draw_lit_triangles(
+	Render_Context* context,
+	const Vec_3f* projected_vertices,
+	const Vec_2f* texcoords,
+	const float32* light,
+	const uint16* triangles,
+	const Draw_Call* draw_calls,
+	uint32 draw_call_count)
+{
+	const Triangle_Batch<uint16> batch = { context, projected_vertices, texcoords, light, triangles, draw_calls, draw_call_count };
+	draw_triangles_for_target(&batch);
+}
+
+void graphics_project_model_lod(
+	const Render_Context* context,
+	const Model* model,
+	uint32 lod,
+	const Matrix_4x4* model_view_projection_matrix,
+	Vec_3f* out_projected_vertices,
+	Vec_2f* out_texcoords)
+{
+	const uint32 vertex_count = model->lods[lod].vertex_count;
+	if (model->packed)
+	{
+		graphics_project_packed_vertices(context, model->packed, vertex_count, model_view_projection_matrix, out_projected_vertices, out_texcoords);
+	}
+	else
+	{
+		graphics_project_vertices(context, model->vertices, vertex_count, model_view_projection_matrix, out_projected_vertices);
+	}
+}
+
+void graphics_draw_model_lod(
+	Render_Context* context,
+	const Model* model,
+	uint32 lod,
+	const Vec_3f* projected_vertices,
+	const Vec_2f* unpacked_texcoords,
+	const float32* light,
+	uint32 first_draw_call,
+	uint32 draw_call_count)
+{
+	const Model_Lod* model_lod = &model->lods[lod];
+	const Draw_Call* draw_calls = &model_lod->draw_calls[first_draw_call];
+	const Packed_Mesh* packed = model->packed;
+	if (!packed)
+	{
+		graphics_draw_lit_triangles(context, projected_vertices, model->texcoords, light, model_lod->triangles, draw_calls, draw_call_count);
+		return;
+	}
+
+	// draw calls index from the start of the level's triangles
+	const uint32 index_start = packed->lod_triangle_starts[lod] * 3;
+	if (packed->triangles_16)
+	{
+		graphics_draw_lit_triangles(context, projected_vertices, unpacked_texcoords, light, packed->triangles_16 + index_start, draw_calls, draw_call_count);
+	}
+	else
+	{
+		graphics_draw_lit_triangles(context, projected_vertices, unpacked_texcoords, light, packed->triangles_32 + index_start, draw_calls, draw_call_count);
+	}
+}
+
+void project_and_draw(
+	Render_Context* context,
+	const Vec_3f* vertices,
+	const Vec_3f* normals,
+	const Vec_2f* texcoords,
+	Vec_3f* projected_vertices,
+	const int32 vertex_count,
+	const int32* triangles,
+	const Draw_Call* draw_calls,
+	uint32 draw_call_count,
+	Vec_4f light_in_world_space,
+	const Matrix_4x4* inverse_model_matrix,
+	const Matrix_4x4* model_view_projection_matrix)
+{
+	graphics_project_vertices(context, vertices, vertex_count, model_view_projection_matrix, projected_vertices);
+
+	// reserving here could free projected_vertices while they're in use, if
+	// they're the context's own
+	assert((uint32)vertex_count <= context->projected_vertex_capacity);
+
+	const bool light_is_directional = light_in_world_space.w == 0.0f;
+	if (light_is_directional)
+	{
+		Vec_3f light_in_model_space = matrix_4x4_mul_direction(inverse_model_matrix, { light_in_world_space.x, light_in_world_space.y, light_in_world_space.z});
+		graphics_light_vertices(context, normals, vertex_count, light_in_model_space, context->vertex_light);
+	}
+	else
+	{
+		// the direction to the light changes across the model
+		Local_Light light = {};
+		light.position = matrix_4x4_mul(inverse_model_matrix, { light_in_world_space.x, light_in_world_space.y, light_in_world_space.z });
+		light.range = INFINITY;
+		light.intensity = 1.0f;
+		light.cos_inner = -1.0f;
+		light.cos_outer = -1.0f;
+
+		memset(context->vertex_light, 0, vertex_count * sizeof(float32));
+		graphics_add_local_lights(context, vertices, normals, vertex_count, &light, 1, context->vertex_light);
+	}
+
+	graphics_draw_lit_triangles(context, projected_vertices, texcoords, context->vertex_light, triangles, draw_calls, draw_call_count);
 }
\ No newline at end of file
@@ -1,14 +1,7 @@
 #pragma once
 
-#define VC_EXTRALEAN
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-
 #include "maths.h"
-
-
-static constexpr int32 c_frame_width = 640;
-static constexpr int32 c_frame_height = 480;
+#include "pixel_format.h"
 
 
 struct Texture
@@ -32,6 +25,25 @@ struct Draw_Call
 	const Texture* texture;
 };
 
+struct Occluder;
+struct Packed_Mesh;
+struct Job_System;
+
+// A level of detail of a model, sharing the model's vertices. Vertices are
+// ordered so each level only uses the first vertex_count of them.
+struct Model_Lod
+{
+	int32* triangles;
+	Draw_Call* draw_calls; // draw_call_count of them, same textures in the same order as the model's
+	uint32 vertex_count;
+	uint32 triangle_count;
+	float32 error; // how far the surface can be from the full detail one, in model units
+};
+
+constexpr uint32 c_max_model_lods = 4;
+
+// Draw calls are sorted by texture at load, so drawing a model switches
+// texture as few times as possible. lods[0] is the full detail model.
 struct Model
 {
 	Vec_3f* vertices;
@@ -41,14 +53,357 @@ struct Model
 	Draw_Call* draw_calls;
 	uint32 vertex_count;
 	uint32 draw_call_count;
+	Vec_3f bounds_min;
+	Vec_3f bounds_max;
+	const Occluder* occluder; // optional, models with one hide what's behind them
+	const Packed_Mesh* packed; // optional, drawn from instead of the arrays above when set
+	Model_Lod lods[c_max_model_lods];
+	uint32 lod_count;
+};
+
+// A light at a position, fading out to nothing at its range. Spot lights also
+// fade from their inner cone to their outer one, a point light is a spot with
+// both cones all the way open (cos of -1).
+struct Local_Light
+{
+	Vec_3f position;
+	float32 range;
+	Vec_3f direction; // the way a spot light points
+	float32 intensity;
+	float32 cos_inner;
+	float32 cos_outer;
+};
+
+
+// A render target owns the colour and depth buffers for one view. Frame rows
+// are stored in the target's pixel format, padded to 4 bytes so they can go
+// straight into a DIB. The buffers are allocated for max_width x max_height,
+// and the target can be resized to anything smaller without reallocating.
+struct Render_Target
+{
+	int32 width;
+	int32 height;
+	int32 stride;
+	int32 max_width;
+	int32 max_height;
+	Pixel_Format format;
+	uint8* frame;
+	float32* depth_buffer;
+	// optional, the draw id of whatever is nearest in each pixel, for working
+	// out what's visible rather than for display
+	uint32* draw_ids;
+	// Optional, the render context's visibility triangle nearest in each
+	// pixel. Targets with one are only rasterised into, nothing is textured
+	// or lit until graphics_shade_visibility.
+	uint32* visibility;
+};
+
+constexpr uint32 c_no_draw_id = 0xffffffff;
+constexpr uint32 c_no_visibility_triangle = 0xffffffff;
+
+// A triangle rasterised into a visibility buffer. Its attributes are kept as
+// planes over the screen, the value at origin and how much it changes per
+// pixel in x and y, so shading can work them out at any pixel it covers.
+// The rasteriser covers some pixels whose centres are just outside the
+// triangle, so texcoords are clamped to its vertices' range, otherwise they'd
+// run off the triangle's tile of an atlas.
+struct Visibility_Triangle
+{
+	const Texture* texture;
+	Vec_2f origin;
+	Vec_3f texcoord_u; // value, d/dx, d/dy
+	Vec_3f texcoord_v;
+	Vec_3f light;
+	Vec_2f texcoord_min;
+	Vec_2f texcoord_max;
+};
+
+enum class Upscale_Filter
+{
+	Nearest,
+	Bilinear
+};
+
+// A triangle waiting in an ordering table, already projected and lit.
+struct Ordered_Triangle
+{
+	Vec_3f position[3];
+	Vec_2f texcoord[3];
+	float32 light[3];
+	const Texture* texture;
+	uint32 draw_id;
+	uint32 next; // next triangle in the same bucket
+};
+
+constexpr uint32 c_no_ordered_triangle = 0xffffffff;
+
+// The PS1's answer to not having a depth buffer. Triangles are put in a
+// bucket by their average depth and then drawn a bucket at a time from the
+// farthest, with no depth test at all. Each bucket is a list, latest first.
+// Buckets get narrower nearer the camera, each doubling of distance has
+// about the same number of them.
+struct Ordering_Table
+{
+	uint32* buckets; // first triangle in each, or c_no_ordered_triangle
+	uint32 bucket_count;
+	Ordered_Triangle* triangles;
+	uint32 triangle_count;
+	uint32 triangle_capacity;
+};
+
+enum class Depth_Mode
+{
+	Test_And_Write,
+	Test, // hidden by what's already drawn, but doesn't hide anything after it
+	None
+};
+
+enum class Texture_Address
+{
+	Wrap,
+	Clamp // texcoords outside 0..1 get the edge texel
+};
+
+// A triangle that made it through setup (not behind the camera, not off
+// screen, not facing away), ready to rasterise.
+struct Set_Up_Triangle
+{
+	Vec_3f position[3];
+	Vec_2f texcoord[3];
+	float32 light[3];
+	const Texture* texture;
+};
+
+// A run of one draw call's triangles set up by one job. The job writes the
+// ones it keeps from first_output on, so chunks never share any output and
+// reading them back in order gives the order they were submitted in.
+struct Geometry_Chunk
+{
+	uint32 draw_call;
+	uint32 triangle_start; // within the draw call
+	uint32 triangle_count;
+	uint32 first_output;
+	uint32 kept;
+};
+
+// How triangles are filled in. Each draw picks a rasteriser built for exactly
+// this state, so nothing in it is checked per pixel and what isn't used isn't
+// interpolated (no texcoords for untextured, no light for unlit). Zeroed is
+// the full path, textured, lit, depth tested and written, wrapped.
+struct Pipeline_State
+{
+	bool untextured; // filled with colour instead of the draw call's texture
+	bool unlit; // full brightness rather than the vertex light plus ambient
+	Depth_Mode depth_mode;
+	Texture_Address texture_address;
+	uint8 colour[3]; // blue, green, red, only for untextured
+};
+
+// A render context holds all the mutable state the rasteriser needs, so
+// several contexts can draw into their own targets on different threads at
+// once. The per row edge arrays are sized to the tallest target the context
+// can draw to.
+struct Render_Context
+{
+	Render_Target* target;
+	int32 max_height;
+	int32* min_x;
+	float32* min_depth;
+	Vec_2f* min_texcoord;
+	float32* min_light;
+	int32* max_x;
+	float32* max_depth;
+	Vec_2f* max_texcoord;
+	float32* max_light;
+
+	// screen space vertices for whatever is being drawn, grown on demand,
+	// along with the texcoords unpacked from packed meshes and light worked
+	// out on the fly
+	Vec_3f* projected_vertices;
+	Vec_2f* unpacked_texcoords;
+	float32* vertex_light;
+	uint32 projected_vertex_capacity;
+	// For draws which only project some of the vertices, grown with the
+	// arrays above. Each vertex's stamp is the last draw it was projected in,
+	// so ones listed several times in a draw are only projected once, and
+	// stamped_indices is room for the list of those still to project.
+	uint32* vertex_stamps;
+	uint32* stamped_indices;
+	uint32 vertex_stamp;
+
+	// Optional, when set big draws have their geometry split into chunks run
+	// on its workers, vertices for projecting and lighting, triangles for
+	// setup and culling. Triangles are still rasterised on the thread that
+	// drew them and in the order they were submitted, so what's drawn is
+	// exactly the same as without.
+	Job_System* jobs;
+	// what triangle setup jobs write, grown on demand
+	Set_Up_Triangle* set_up_triangles;
+	uint32 set_up_triangle_capacity;
+	Geometry_Chunk* geometry_chunks;
+	uint32 geometry_chunk_capacity;
+
+	// written to the target's draw ids, if it has them
+	uint32 draw_id;
+
+	// for everything drawn until it's changed. Visibility buffers always test
+	// and write depth, ordering tables never do.
+	Pipeline_State pipeline;
+
+	// Optional, when set triangles are put in it rather than drawn, until
+	// graphics_draw_ordering_table. The depth buffer isn't used at all.
+	Ordering_Table* ordering_table;
+
+	// triangles drawn into a visibility buffer since the last clear
+	Visibility_Triangle* visibility_triangles;
+	uint32 visibility_triangle_count;
+	uint32 visibility_triangle_capacity;
+
+	// Pixels that passed the depth test and were textured and lit, never
+	// reset by the rasteriser. Compared to the pixels in the target it's how
+	// much overdraw is costing.
+	uint64 pixels_shaded;
 };
 
 
-void graphics_clear();
+Render_Target render_target_create(int32 width, int32 height, Pixel_Format format);
+void render_target_destroy(Render_Target* target);
+void render_target_resize(Render_Target* target, int32 width, int32 height);
+// allocates draw ids for the target, they're cleared to c_no_draw_id
+void render_target_enable_draw_ids(Render_Target* target);
+// allocates a visibility buffer for the target, drawing into it is deferred
+// from then on
+void render_target_enable_visibility(Render_Target* target);
+// stretch src over the whole of dst, which must be the same format. Depth is
+// not copied.
+void render_target_upscale(const Render_Target* src, Render_Target* dst, Upscale_Filter filter);
+
+Render_Context render_context_create(int32 max_height);
+void render_context_destroy(Render_Context* context);
+void render_context_set_target(Render_Context* context, Render_Target* target);
+
+Ordering_Table ordering_table_create(uint32 bucket_count);
+void ordering_table_destroy(Ordering_Table* table);
+
+// makes sure context->projected_vertices (and the other per vertex arrays) have room for vertex_count
+void render_context_reserve_vertices(Render_Context* context, uint32 vertex_count);
+
+void graphics_clear(Render_Context* context);
+
+// Textures and lights each pixel of rows y_begin to y_end (exclusive) from the
+// triangle the visibility buffer says is nearest, exactly once however many
+// triangles were drawn over it. Rows are independent, so they can be split
+// between threads. Returns the number of pixels shaded.
+uint32 graphics_shade_visibility(const Render_Context* context, int32 y_begin, int32 y_end);
+// Shades every row of the target, split into bands on the context's workers
+// if it has any.
+uint32 graphics_shade_visibility_buffer(const Render_Context* context);
+
+// Draws everything in the context's ordering table back to front, then
+// empties it.
+void graphics_draw_ordering_table(Render_Context* context);
+
+// model space to screen space (x, y in pixels, z is depth)
+void graphics_project_vertices(
+	const Render_Context* context,
+	const Vec_3f* vertices,
+	uint32 vertex_count,
+	const Matrix_4x4* model_view_projection_matrix,
+	Vec_3f* out_projected_vertices);
+
+// Projects only the vertices listed in indices, each written to its own
+// place in out_projected_vertices. The rest are left as they were.
+void graphics_project_indexed_vertices(
+	const Render_Context* context,
+	const Vec_3f* vertices,
+	const uint32* indices,
+	uint32 index_count,
+	const Matrix_4x4* model_view_projection_matrix,
+	Vec_3f* out_projected_vertices);
+
+// Unpacks and projects a packed mesh's vertices, dequantising the position
+// is folded into the matrix.
+void graphics_project_packed_vertices(
+	const Render_Context* context,
+	const Packed_Mesh* mesh,
+	uint32 vertex_count,
+	const Matrix_4x4* model_view_projection_matrix,
+	Vec_3f* out_projected_vertices,
+	Vec_2f* out_texcoords);
+
+// Lights each vertex once, rather than once per triangle corner, for
+// graphics_draw_lit_triangles. Nothing here depends on the camera, so the
+// results can be kept for as long as the light and the model's transform
+// stay the same. Like projecting, big models are split between the
+// context's workers.
+void graphics_light_vertices(const Render_Context* context, const Vec_3f* normals, uint32 vertex_count, Vec_3f light_in_model_space, float32* out_light);
+void graphics_light_packed_vertices(const Render_Context* context, const Packed_Mesh* mesh, uint32 vertex_count, Vec_3f light_in_model_space, float32* out_light);
+// Adds local lights on top of what the functions above worked out. Vertices
+// out of a light's range skip it after a distance check, so only lights that
+// actually reach a vertex cost a dot product.
+void graphics_add_local_lights(
+	const Render_Context* context,
+	const Vec_3f* vertices,
+	const Vec_3f* normals,
+	uint32 vertex_count,
+	const Local_Light* lights_in_model_space,
+	uint32 light_count,
+	float32* inout_light);
+void graphics_add_packed_local_lights(
+	const Render_Context* context,
+	const Packed_Mesh* mesh,
+	uint32 vertex_count,
+	const Local_Light* lights_in_model_space,
+	uint32 light_count,
+	float32* inout_light);
+
+// Draws triangles from their projected vertices, with the light already
+// worked out per vertex by the functions above, and indices of either size.
+void graphics_draw_lit_triangles(
+	Render_Context* context,
+	const Vec_3f* projected_vertices,
+	const Vec_2f* texcoords,
+	const float32* light,
+	const int32* triangles,
+	const Draw_Call* draw_calls,
+	uint32 draw_call_count);
+void graphics_draw_lit_triangles(
+	Render_Context* context,
+	const Vec_3f* projected_vertices,
+	const Vec_2f* texcoords,
+	const float32* light,
+	const uint16* triangles,
+	const Draw_Call* draw_calls,
+	uint32 draw_call_count);
 
-void graphics_draw_to_window(HWND window);
+// Projects the vertices a model's level of detail uses. A packed model's
+// texcoords are unpacked into out_texcoords alongside, other models draw from
+// their own.
+void graphics_project_model_lod(
+	const Render_Context* context,
+	const Model* model,
+	uint32 lod,
+	const Matrix_4x4* model_view_projection_matrix,
+	Vec_3f* out_projected_vertices,
+	Vec_2f* out_texcoords);
+// Draws draw_call_count of the level's draw calls from first_draw_call, from
+// what graphics_project_model_lod projected, with the indices the model was
+// packed with if it was.
+void graphics_draw_model_lod(
+	Render_Context* context,
+	const Model* model,
+	uint32 lod,
+	const Vec_3f* projected_vertices,
+	const Vec_2f* unpacked_texcoords,
+	const float32* light,
+	uint32 first_draw_call,
+	uint32 draw_call_count);
 
+// light is a direction when w is 0, otherwise a position the light shines
+// out from, without fading with distance. Vertices are lit once each in
+// context->vertex_light, which must have been reserved for vertex_count.
 void project_and_draw(
+	Render_Context* context,
 	const Vec_3f* vertices,
 	const Vec_3f* normals,
 	const Vec_2f* texcoords,
@@ -0,0 +1,346 @@
+#include "jobs.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "assert.h"
+#include "maths.h"
+
+
+static constexpr uint32 c_initial_deque_capacity = 256;
+
+struct Job
+{
+	// one or the other
+	Job_Func func;
+	Job_Range_Func range_func;
+	void* data;
+	uint32 begin;
+	uint32 end;
+	Job_Counter* counter;
+	Job* next; // only for jobs waiting on a counter
+};
+
+// A ring of jobs. The owner pushes and pops at the back, thieves take from
+// the front, so the owner gets what it queued most recently (likely still in
+// its cache) and thieves get the oldest.
+struct Job_Deque
+{
+	std::mutex mutex;
+	Job* jobs;
+	uint32 capacity; // power of two
+	uint32 front;
+	uint32 count;
+};
+
+struct Job_System
+{
+	// deque 0 is shared by the threads which aren't workers, worker i has
+	// deque i + 1
+	Job_Deque* deques;
+	uint32 deque_count;
+	std::thread* workers;
+	uint32 worker_count;
+
+	// jobs in all the deques, workers sleep while there aren't any
+	std::atomic<int32> queued;
+	std::mutex sleep_mutex;
+	std::condition_variable work_queued;
+	bool quit;
+
+	// guards the counters' waiting lists, and the last decrement of each
+	// counter so nothing's added to the list after it's been started
+	std::mutex waiting_mutex;
+};
+
+// which deque the current thread pushes to and pops from, for the system it's a worker of
+static thread_local const Job_System* t_system;
+static thread_local uint32 t_deque;
+
+
+static uint32 own_deque(const Job_System* system)
+{
+	return t_system == system ? t_deque : 0;
+}
+
+static void push(Job_System* system, const Job* job)
+{
+	Job_Deque* deque = &system->deques[own_deque(system)];
+	{
+		std::lock_guard<std::mutex> lock(deque->mutex);
+		if (deque->count == deque->capacity)
+		{
+			const uint32 new_capacity = deque->capacity * 2;
+			Job* jobs = new Job[new_capacity];
+			for (uint32 i = 0; i < deque->count; ++i)
+			{
+				jobs[i] = deque->jobs[(deque->front + i) & (deque->capacity - 1)];
+			}
+			delete[] deque->jobs;
+			deque->jobs = jobs;
+			deque->capacity = new_capacity;
+			deque->front = 0;
+		}
+		deque->jobs[(deque->front + deque->count) & (deque->capacity - 1)] = *job;
+		++deque->count;
+	}
+
+	// Taking the lock between the count going up and notifying means a worker
+	// can't check the count, miss this job and then miss the wake up.
+	system->queued.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lock(system->sleep_mutex);
+	}
+	system->work_queued.notify_one();
+}
+
+static bool pop(Job_System* system, uint32 deque_index, bool steal, Job* out_job)
+{
+	Job_Deque* deque = &system->deques[deque_index];
+	{
+		std::lock_guard<std::mutex> lock(deque->mutex);
+		if (deque->count == 0)
+		{
+			return false;
+		}
+
+		if (steal)
+		{
+			*out_job = deque->jobs[deque->front];
+			deque->front = (deque->front + 1) & (deque->capacity - 1);
+		}
+		else
+		{
+			*out_job = deque->jobs[(deque->front + deque->count - 1) & (deque->capacity - 1)];
+		}
+		--deque->count;
+	}
+
+	system->queued.fetch_sub(1);
+	return true;
+}
+
+static void finish(Job_System* system, Job_Counter* counter)
+{
+	int32 remaining = counter->remaining.load();
+	while (remaining > 1)
+	{
+		if (counter->remaining.compare_exchange_weak(remaining, remaining - 1))
+		{
+			return;
+		}
+	}
+
+	// Probably the last one. Once it's zero a waiter can return and the
+	// counter can go away, so the waiting list is taken in the same lock and
+	// the counter isn't touched after.
+	Job* waiting = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(system->waiting_mutex);
+		if (counter->remaining.fetch_sub(1) == 1)
+		{
+			waiting = counter->waiting;
+			counter->waiting = nullptr;
+		}
+	}
+
+	while (waiting)
+	{
+		Job* next = waiting->next;
+		push(system, waiting);
+		delete waiting;
+		waiting = next;
+	}
+}
+
+static void execute(Job_System* system, const Job* job)
+{
+	if (job->func)
+	{
+		job->func(job->data);
+	}
+	else
+	{
+		job->range_func(job->data, job->begin, job->end);
+	}
+
+	if (job->counter)
+	{
+		finish(system, job->counter);
+	}
+}
+
+// own deque first, then steal from the others, starting with the next one
+// along so thieves don't all go for the same deque
+static bool run_one(Job_System* system)
+{
+	const uint32 own = own_deque(system);
+	Job job;
+	bool found = pop(system, own, false, &job);
+	for (uint32 i = 1; !found && i < system->deque_count; ++i)
+	{
+		found = pop(system, (own + i) % system->deque_count, true, &job);
+	}
+
+	if (found)
+	{
+		execute(system, &job);
+	}
+	return found;
+}
+
+static void worker_thread(Job_System* system, uint32 deque)
+{
+	t_system = system;
+	t_deque = deque;
+
+	while (true)
+	{
+		if (run_one(system))
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(system->sleep_mutex);
+		system->work_queued.wait(lock, [system] { return system->queued.load() > 0 || system->quit; });
+		if (system->quit && system->queued.load() == 0)
+		{
+			return;
+		}
+	}
+}
+
+uint32 job_default_worker_count()
+{
+	return uint32_max(std::thread::hardware_concurrency(), 1) - 1;
+}
+
+Job_System* job_system_create(uint32 worker_count)
+{
+	Job_System* system = new Job_System();
+	system->deque_count = worker_count + 1;
+	system->deques = new Job_Deque[system->deque_count];
+	for (uint32 i = 0; i < system->deque_count; ++i)
+	{
+		Job_Deque* deque = &system->deques[i];
+		deque->jobs = new Job[c_initial_deque_capacity];
+		deque->capacity = c_initial_deque_capacity;
+		deque->front = 0;
+		deque->count = 0;
+	}
+	system->queued = 0;
+	system->quit = false;
+
+	system->worker_count = worker_count;
+	system->workers = new std::thread[worker_count];
+	for (uint32 i = 0; i < worker_count; ++i)
+	{
+		system->workers[i] = std::thread(worker_thread, system, i + 1);
+	}
+
+	return system;
+}
+
+void job_system_destroy(Job_System* system)
+{
+	{
+		std::lock_guard<std::mutex> lock(system->sleep_mutex);
+		system->quit = true;
+	}
+	system->work_queued.notify_all();
+	for (uint32 i = 0; i < system->worker_count; ++i)
+	{
+		system->workers[i].join();
+	}
+
+	// with no workers nothing else would run what's left
+	while (run_one(system))
+	{
+	}
+
+	for (uint32 i = 0; i < system->deque_count; ++i)
+	{
+		delete[] system->deques[i].jobs;
+	}
+	delete[] system->deques;
+	delete[] system->workers;
+	delete system;
+}
+
+uint32 job_system_thread_count(const Job_System* system)
+{
+	return system->worker_count + 1;
+}
+
+void job_run(Job_System* system, Job_Func func, void* data, Job_Counter* counter)
+{
+	Job job = {};
+	job.func = func;
+	job.data = data;
+	job.counter = counter;
+	if (counter)
+	{
+		counter->remaining.fetch_add(1);
+	}
+	push(system, &job);
+}
+
+void job_run_after(Job_System* system, Job_Counter* dependency, Job_Func func, void* data, Job_Counter* counter)
+{
+	Job job = {};
+	job.func = func;
+	job.data = data;
+	job.counter = counter;
+	if (counter)
+	{
+		counter->remaining.fetch_add(1);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(system->waiting_mutex);
+		if (dependency->remaining.load() > 0)
+		{
+			Job* waiting = new Job(job);
+			waiting->next = dependency->waiting;
+			dependency->waiting = waiting;
+			return;
+		}
+	}
+
+	push(system, &job);
+}
+
+void job_wait(Job_System* system, Job_Counter* counter)
+{
+	while (counter->remaining.load() > 0)
+	{
+		if (!run_one(system))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	// whoever took it to zero might still be holding the lock, and the
+	// counter has to outlive that
+	std::lock_guard<std::mutex> lock(system->waiting_mutex);
+}
+
+void job_parallel_for(Job_System* system, uint32 begin, uint32 end, uint32 batch_size, Job_Range_Func func, void* data)
+{
+	assert(batch_size > 0);
+
+	Job_Counter counter = {};
+	for (uint32 batch_begin = begin; batch_begin < end; batch_begin += uint32_min(batch_size, end - batch_begin))
+	{
+		Job job = {};
+		job.range_func = func;
+		job.data = data;
+		job.begin = batch_begin;
+		job.end = batch_begin + uint32_min(batch_size, end - batch_begin);
+		job.counter = &counter;
+		counter.remaining.fetch_add(1);
+		push(system, &job);
+	}
+
+	job_wait(system, &counter);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include "types.h"
+
+
+typedef void (*Job_Func)(void* data);
+// called with a batch of a parallel for's range, end exclusive
+typedef void (*Job_Range_Func)(void* data, uint32 begin, uint32 end);
+
+struct Job;
+
+// How many jobs are still to finish. Jobs given a counter add one when they're
+// queued and take it away when they're done, so several jobs can share one
+// and it can be waited on, or other jobs can be queued to start once it's
+// zero. Zero it before first use and don't touch it while jobs are using it.
+struct Job_Counter
+{
+	std::atomic<int32> remaining;
+	// jobs queued after this counter, started when it gets to zero, guarded
+	// by the job system's mutex
+	Job* waiting;
+};
+
+// A worker thread per core but one, each with its own deque of jobs. Workers
+// push and pop jobs at the back of their own deque and steal from the front
+// of the others' when theirs is empty, so work spreads out on its own without
+// a shared queue to fight over. Threads which aren't workers, like the one
+// that created the system, share one more deque, and run jobs while they
+// wait rather than sitting idle.
+struct Job_System;
+
+
+// one per core but the calling thread's
+uint32 job_default_worker_count();
+// with no workers, jobs are run by whoever waits for them
+Job_System* job_system_create(uint32 worker_count);
+// waits for the workers to finish what's queued, then stops them
+void job_system_destroy(Job_System* system);
+// the workers plus the thread that created the system
+uint32 job_system_thread_count(const Job_System* system);
+
+// counter is optional
+void job_run(Job_System* system, Job_Func func, void* data, Job_Counter* counter);
+// runs once dependency is zero, which may be right away
+void job_run_after(Job_System* system, Job_Counter* dependency, Job_Func func, void* data, Job_Counter* counter);
+// runs other jobs until the counter is zero
+void job_wait(Job_System* system, Job_Counter* counter);
+// Splits begin to end into batches of batch_size and runs func on each, with
+// the calling thread helping. Returns once they're all done.
+void job_parallel_for(Job_System* system, uint32 begin, uint32 end, uint32 batch_size, Job_Range_Func func, void* data);
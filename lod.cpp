@@ -0,0 +1,790 @@
+#include "lod.h"
+
+#include <cstdlib>
+#include <cstring>
+#include "assert.h"
+
+
+// each level aims for this fraction of the triangles of the one before
+static constexpr float32 c_lod_triangle_ratio = 0.5f;
+// a level has to get at least this much smaller than the one before to be kept
+static constexpr float32 c_lod_min_reduction = 0.8f;
+// the most error any level can have, as a fraction of the model's bounds diagonal
+static constexpr float32 c_lod_max_error = 0.25f;
+// how strongly border vertices are kept on the line of their border
+static constexpr float32 c_lod_border_weight = 1.0f;
+// error allowed on screen before switching to a finer level
+static constexpr float32 c_lod_pixel_error = 1.0f;
+// fraction of c_lod_pixel_error a coarser level's error has to be under to switch to it
+static constexpr float32 c_lod_hysteresis = 0.75f;
+// models closer than this are treated as being this far away when picking
+// their level
+static constexpr float32 c_lod_min_distance = 0.01f;
+
+static constexpr uint32 c_removed_triangle = 0xffffffff;
+static constexpr uint32 c_no_vertex = 0xffffffff;
+
+
+// Symmetric 4x4 matrix giving the sum of squared distances from a point to a
+// set of planes, weighted by the area of the faces they came from. Collapsing
+// an edge adds the quadrics of its ends, so the error of a vertex is measured
+// against all the original faces that have been merged into it. Dividing by
+// the total face area gives the error as a squared distance.
+struct Quadric
+{
+	float64 xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+	float64 area;
+};
+
+static Quadric quadric_from_plane(Vec_3f normal, float32 d, float64 weight)
+{
+	const float64 a = normal.x;
+	const float64 b = normal.y;
+	const float64 c = normal.z;
+	Quadric quadric;
+	quadric.xx = a * a * weight;
+	quadric.xy = a * b * weight;
+	quadric.xz = a * c * weight;
+	quadric.xw = a * d * weight;
+	quadric.yy = b * b * weight;
+	quadric.yz = b * c * weight;
+	quadric.yw = b * d * weight;
+	quadric.zz = c * c * weight;
+	quadric.zw = c * d * weight;
+	quadric.ww = (float64)d * d * weight;
+	quadric.area = 0.0;
+	return quadric;
+}
+
+static void quadric_add(Quadric* quadric, const Quadric* other)
+{
+	quadric->xx += other->xx;
+	quadric->xy += other->xy;
+	quadric->xz += other->xz;
+	quadric->xw += other->xw;
+	quadric->yy += other->yy;
+	quadric->yz += other->yz;
+	quadric->yw += other->yw;
+	quadric->zz += other->zz;
+	quadric->zw += other->zw;
+	quadric->ww += other->ww;
+	quadric->area += other->area;
+}
+
+// squared distance
+static float64 quadric_error(const Quadric* quadric, Vec_3f point)
+{
+	const float64 x = point.x;
+	const float64 y = point.y;
+	const float64 z = point.z;
+	const float64 sum = (quadric->xx * x * x) + (2.0 * quadric->xy * x * y) + (2.0 * quadric->xz * x * z) + (2.0 * quadric->xw * x) +
+		(quadric->yy * y * y) + (2.0 * quadric->yz * y * z) + (2.0 * quadric->yw * y) +
+		(quadric->zz * z * z) + (2.0 * quadric->zw * z) +
+		quadric->ww;
+	const float64 error = quadric->area > 0.0 ? sum / quadric->area : sum;
+	return error > 0.0 ? error : 0.0;
+}
+
+struct Collapse
+{
+	uint32 from;
+	uint32 to;
+	float64 error;
+};
+
+static int compare_collapses(const void* a, const void* b)
+{
+	const float64 error_a = ((const Collapse*)a)->error;
+	const float64 error_b = ((const Collapse*)b)->error;
+	return error_a < error_b ? -1 : (error_a > error_b ? 1 : 0);
+}
+
+// a triangle's edge between two positions, key has the lower position in the high bits
+struct Edge
+{
+	uint64 key;
+	uint32 triangle;
+	uint32 opposite_position;
+};
+
+static int compare_edges(const void* a, const void* b)
+{
+	const uint64 key_a = ((const Edge*)a)->key;
+	const uint64 key_b = ((const Edge*)b)->key;
+	return key_a < key_b ? -1 : (key_a > key_b ? 1 : 0);
+}
+
+// qsort has no user data, thread local so models can be simplified on several threads at once
+static thread_local const Vec_3f* g_sort_vertices;
+
+static int compare_vertex_positions(const void* a, const void* b)
+{
+	const Vec_3f* position_a = &g_sort_vertices[*(const uint32*)a];
+	const Vec_3f* position_b = &g_sort_vertices[*(const uint32*)b];
+	for (int32 i = 0; i < 3; ++i)
+	{
+		if (position_a->v[i] != position_b->v[i])
+		{
+			return position_a->v[i] < position_b->v[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+// Interior positions can collapse towards any neighbour. Border positions are
+// on an open edge, or an edge between draw calls, and can only collapse along
+// the border to one of the two positions either side, so it keeps its shape.
+// Anything else, e.g. where borders meet, is locked.
+enum class Position_Kind : uint8
+{
+	Interior,
+	Border,
+	Locked
+};
+
+// Working state while simplifying. The obj loader splits vertices wherever
+// their texcoord or normal differs, so topology is worked out on positions,
+// with the vertices sharing a position being moved together.
+struct Simplifier
+{
+	const Model* model;
+
+	uint32* position_ids; // per vertex
+	uint32 position_count;
+	uint32* position_vertex_offsets; // position_count + 1, into position_vertices
+	uint32* position_vertices;
+	Position_Kind* position_kinds;
+	uint32* border_neighbours; // 2 per border position
+	bool* position_touched; // moved this pass, so the adjacency is stale
+	Quadric* quadrics; // per position
+
+	int32* triangles;
+	uint32* triangle_draw_calls;
+	uint32 triangle_count;
+
+	// triangles using each vertex, rebuilt each pass
+	uint32* vertex_triangle_offsets;
+	uint32* vertex_triangles;
+
+	Collapse* collapses;
+	float64 error_sq;
+};
+
+static void simplifier_create(Simplifier* simplifier, const Model* model)
+{
+	*simplifier = {};
+	simplifier->model = model;
+	const uint32 vertex_count = model->vertex_count;
+	const uint32 triangle_count = model->lods[0].triangle_count;
+
+	// weld vertices by position, sorting them so equal positions are adjacent
+	uint32* sorted = new uint32[vertex_count];
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		sorted[i] = i;
+	}
+	g_sort_vertices = model->vertices;
+	qsort(sorted, vertex_count, sizeof(uint32), compare_vertex_positions);
+
+	simplifier->position_ids = new uint32[vertex_count];
+	simplifier->position_vertices = sorted;
+	simplifier->position_vertex_offsets = new uint32[vertex_count + 1];
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		if (i == 0 || compare_vertex_positions(&sorted[i - 1], &sorted[i]) != 0)
+		{
+			simplifier->position_vertex_offsets[simplifier->position_count] = i;
+			++simplifier->position_count;
+		}
+		simplifier->position_ids[sorted[i]] = simplifier->position_count - 1;
+	}
+	simplifier->position_vertex_offsets[simplifier->position_count] = vertex_count;
+
+	const uint32 position_count = simplifier->position_count;
+	simplifier->position_kinds = new Position_Kind[position_count];
+	simplifier->border_neighbours = new uint32[position_count * 2];
+	simplifier->position_touched = new bool[position_count];
+	simplifier->quadrics = new Quadric[position_count];
+	memset(simplifier->quadrics, 0, position_count * sizeof(Quadric));
+
+	simplifier->triangles = new int32[triangle_count * 3];
+	simplifier->triangle_draw_calls = new uint32[triangle_count];
+	for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+	{
+		const Draw_Call* draw_call = &model->draw_calls[draw_call_i];
+		for (uint32 i = 0; i < draw_call->triangle_count; ++i)
+		{
+			const int32* triangle = &model->triangles[(draw_call->triangle_start + i) * 3];
+			int32* out_triangle = &simplifier->triangles[simplifier->triangle_count * 3];
+			out_triangle[0] = triangle[0];
+			out_triangle[1] = triangle[1];
+			out_triangle[2] = triangle[2];
+			simplifier->triangle_draw_calls[simplifier->triangle_count] = draw_call_i;
+			++simplifier->triangle_count;
+		}
+	}
+
+	// each triangle's plane is added to its corners' quadrics, weighted by area
+	Vec_3f* triangle_normals = new Vec_3f[simplifier->triangle_count];
+	Edge* edges = new Edge[simplifier->triangle_count * 3];
+	for (uint32 triangle_i = 0; triangle_i < simplifier->triangle_count; ++triangle_i)
+	{
+		const int32* triangle = &simplifier->triangles[triangle_i * 3];
+		uint32 positions[3];
+		for (int32 i = 0; i < 3; ++i)
+		{
+			positions[i] = simplifier->position_ids[triangle[i]];
+		}
+
+		for (int32 i = 0; i < 3; ++i)
+		{
+			const uint64 a = positions[i];
+			const uint64 b = positions[(i + 1) % 3];
+			Edge* edge = &edges[(triangle_i * 3) + i];
+			edge->key = a < b ? (a << 32) | b : (b << 32) | a;
+			edge->triangle = triangle_i;
+			edge->opposite_position = positions[(i + 2) % 3];
+		}
+
+		const Vec_3f p0 = model->vertices[triangle[0]];
+		const Vec_3f cross = vec_3f_cross(vec_3f_sub(model->vertices[triangle[1]], p0), vec_3f_sub(model->vertices[triangle[2]], p0));
+		const float32 length = float32_sqrt(vec_3f_dot(cross, cross));
+		triangle_normals[triangle_i] = {};
+		if (length > 0.0f)
+		{
+			const Vec_3f normal = vec_3f_mul(cross, 1.0f / length);
+			Quadric quadric = quadric_from_plane(normal, -vec_3f_dot(normal, p0), length * 0.5f);
+			quadric.area = length * 0.5f;
+			for (int32 i = 0; i < 3; ++i)
+			{
+				quadric_add(&simplifier->quadrics[positions[i]], &quadric);
+			}
+			triangle_normals[triangle_i] = normal;
+		}
+	}
+
+	// An edge is on a border if only one triangle uses it, or the two using it
+	// are in different draw calls, or they're the front and back of a two
+	// sided face. Edges used by more than two triangles lock their ends.
+	uint32* border_edge_counts = new uint32[position_count];
+	memset(border_edge_counts, 0, position_count * sizeof(uint32));
+	for (uint32 i = 0; i < position_count; ++i)
+	{
+		simplifier->position_kinds[i] = Position_Kind::Interior;
+	}
+
+	const uint32 edge_count = simplifier->triangle_count * 3;
+	qsort(edges, edge_count, sizeof(Edge), compare_edges);
+	for (uint32 i = 0; i < edge_count;)
+	{
+		uint32 run_end = i + 1;
+		while (run_end < edge_count && edges[run_end].key == edges[i].key)
+		{
+			++run_end;
+		}
+
+		const uint32 a = (uint32)(edges[i].key >> 32);
+		const uint32 b = (uint32)(edges[i].key & 0xffffffff);
+		const uint32 use_count = run_end - i;
+		if (use_count > 2)
+		{
+			simplifier->position_kinds[a] = Position_Kind::Locked;
+			simplifier->position_kinds[b] = Position_Kind::Locked;
+		}
+		else if (use_count == 1 ||
+			simplifier->triangle_draw_calls[edges[i].triangle] != simplifier->triangle_draw_calls[edges[i + 1].triangle] ||
+			edges[i].opposite_position == edges[i + 1].opposite_position)
+		{
+			for (uint32 j = 0; j < 2; ++j)
+			{
+				const uint32 position = j ? b : a;
+				if (border_edge_counts[position] < 2)
+				{
+					simplifier->border_neighbours[(position * 2) + border_edge_counts[position]] = j ? a : b;
+				}
+				++border_edge_counts[position];
+			}
+
+			// a plane through the edge at right angles to its triangle keeps
+			// the border's ends on the line of the border
+			const Vec_3f pa = model->vertices[simplifier->position_vertices[simplifier->position_vertex_offsets[a]]];
+			const Vec_3f pb = model->vertices[simplifier->position_vertices[simplifier->position_vertex_offsets[b]]];
+			const Vec_3f along = vec_3f_sub(pb, pa);
+			const Vec_3f across = vec_3f_cross(along, triangle_normals[edges[i].triangle]);
+			const float32 across_length = float32_sqrt(vec_3f_dot(across, across));
+			if (across_length > 0.0f)
+			{
+				const Vec_3f normal = vec_3f_mul(across, 1.0f / across_length);
+				const Quadric quadric = quadric_from_plane(normal, -vec_3f_dot(normal, pa), vec_3f_dot(along, along) * c_lod_border_weight);
+				quadric_add(&simplifier->quadrics[a], &quadric);
+				quadric_add(&simplifier->quadrics[b], &quadric);
+			}
+		}
+
+		i = run_end;
+	}
+
+	for (uint32 i = 0; i < position_count; ++i)
+	{
+		if (simplifier->position_kinds[i] == Position_Kind::Interior && border_edge_counts[i] > 0)
+		{
+			simplifier->position_kinds[i] = border_edge_counts[i] == 2 ? Position_Kind::Border : Position_Kind::Locked;
+		}
+	}
+	delete[] border_edge_counts;
+	delete[] edges;
+	delete[] triangle_normals;
+
+	simplifier->vertex_triangle_offsets = new uint32[vertex_count + 1];
+	simplifier->vertex_triangles = new uint32[triangle_count * 3];
+	simplifier->collapses = new Collapse[triangle_count * 6];
+}
+
+static void simplifier_destroy(Simplifier* simplifier)
+{
+	delete[] simplifier->position_ids;
+	delete[] simplifier->position_vertex_offsets;
+	delete[] simplifier->position_vertices;
+	delete[] simplifier->position_kinds;
+	delete[] simplifier->border_neighbours;
+	delete[] simplifier->position_touched;
+	delete[] simplifier->quadrics;
+	delete[] simplifier->triangles;
+	delete[] simplifier->triangle_draw_calls;
+	delete[] simplifier->vertex_triangle_offsets;
+	delete[] simplifier->vertex_triangles;
+	delete[] simplifier->collapses;
+	*simplifier = {};
+}
+
+static void build_vertex_triangles(Simplifier* simplifier)
+{
+	const uint32 vertex_count = simplifier->model->vertex_count;
+	uint32* offsets = simplifier->vertex_triangle_offsets;
+	memset(offsets, 0, (vertex_count + 1) * sizeof(uint32));
+	for (uint32 i = 0; i < simplifier->triangle_count * 3; ++i)
+	{
+		++offsets[simplifier->triangles[i] + 1];
+	}
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		offsets[i + 1] += offsets[i];
+	}
+	for (uint32 triangle_i = 0; triangle_i < simplifier->triangle_count; ++triangle_i)
+	{
+		for (int32 i = 0; i < 3; ++i)
+		{
+			const int32 vertex = simplifier->triangles[(triangle_i * 3) + i];
+			simplifier->vertex_triangles[offsets[vertex]] = triangle_i;
+			++offsets[vertex];
+		}
+	}
+	// filling in moved each offset along to the next vertex's start
+	for (uint32 i = vertex_count; i > 0; --i)
+	{
+		offsets[i] = offsets[i - 1];
+	}
+	offsets[0] = 0;
+}
+
+// For every vertex at the from position, find the vertex at the to position it
+// shares an edge with, so that seams collapse along themselves. Returns false
+// if any of them has no such vertex, or moving would flip a triangle.
+static bool plan_collapse(const Simplifier* simplifier, uint32 from_position, uint32 to_position, uint32* out_targets)
+{
+	const Model* model = simplifier->model;
+
+	// a border collapsing into a neighbour which shares its other neighbour
+	// would close up into a loop of two edges
+	if (simplifier->position_kinds[from_position] == Position_Kind::Border &&
+		simplifier->position_kinds[to_position] == Position_Kind::Border)
+	{
+		const uint32* from_neighbours = &simplifier->border_neighbours[from_position * 2];
+		const uint32* to_neighbours = &simplifier->border_neighbours[to_position * 2];
+		const uint32 from_other = from_neighbours[0] == to_position ? from_neighbours[1] : from_neighbours[0];
+		const uint32 to_other = to_neighbours[0] == from_position ? to_neighbours[1] : to_neighbours[0];
+		if (from_other == to_position || from_other == to_other)
+		{
+			return false;
+		}
+	}
+	const Vec_3f to = model->vertices[simplifier->position_vertices[simplifier->position_vertex_offsets[to_position]]];
+
+	for (uint32 i = simplifier->position_vertex_offsets[from_position]; i < simplifier->position_vertex_offsets[from_position + 1]; ++i)
+	{
+		const uint32 vertex = simplifier->position_vertices[i];
+		out_targets[i] = c_no_vertex;
+
+		for (uint32 j = simplifier->vertex_triangle_offsets[vertex]; j < simplifier->vertex_triangle_offsets[vertex + 1]; ++j)
+		{
+			const int32* triangle = &simplifier->triangles[simplifier->vertex_triangles[j] * 3];
+			bool collapses = false;
+			for (int32 k = 0; k < 3; ++k)
+			{
+				if (simplifier->position_ids[triangle[k]] == to_position)
+				{
+					// reaching different vertices at the position means
+					// crossing a seam rather than moving along it
+					if (out_targets[i] != c_no_vertex && out_targets[i] != (uint32)triangle[k])
+					{
+						return false;
+					}
+					out_targets[i] = triangle[k];
+					collapses = true;
+				}
+			}
+
+			if (!collapses)
+			{
+				// triangles which survive mustn't turn over
+				Vec_3f before[3];
+				Vec_3f after[3];
+				for (int32 k = 0; k < 3; ++k)
+				{
+					before[k] = model->vertices[triangle[k]];
+					after[k] = triangle[k] == (int32)vertex ? to : before[k];
+				}
+				const Vec_3f normal_before = vec_3f_cross(vec_3f_sub(before[1], before[0]), vec_3f_sub(before[2], before[0]));
+				const Vec_3f normal_after = vec_3f_cross(vec_3f_sub(after[1], after[0]), vec_3f_sub(after[2], after[0]));
+				if (vec_3f_dot(normal_before, normal_after) <= 0.0f)
+				{
+					return false;
+				}
+			}
+		}
+
+		// vertices at the position no longer used by anything can be ignored
+		if (out_targets[i] == c_no_vertex &&
+			simplifier->vertex_triangle_offsets[vertex] != simplifier->vertex_triangle_offsets[vertex + 1])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void apply_collapse(Simplifier* simplifier, uint32 from_position, uint32 to_position, const uint32* targets)
+{
+	simplifier->position_touched[from_position] = true;
+	simplifier->position_touched[to_position] = true;
+
+	for (uint32 i = simplifier->position_vertex_offsets[from_position]; i < simplifier->position_vertex_offsets[from_position + 1]; ++i)
+	{
+		const uint32 vertex = simplifier->position_vertices[i];
+		for (uint32 j = simplifier->vertex_triangle_offsets[vertex]; j < simplifier->vertex_triangle_offsets[vertex + 1]; ++j)
+		{
+			const uint32 triangle_i = simplifier->vertex_triangles[j];
+			int32* triangle = &simplifier->triangles[triangle_i * 3];
+			bool degenerate = false;
+			for (int32 k = 0; k < 3; ++k)
+			{
+				if (triangle[k] == (int32)vertex)
+				{
+					triangle[k] = targets[i];
+				}
+				else if (simplifier->position_ids[triangle[k]] == to_position)
+				{
+					degenerate = true;
+				}
+				simplifier->position_touched[simplifier->position_ids[triangle[k]]] = true;
+			}
+
+			if (degenerate)
+			{
+				simplifier->triangle_draw_calls[triangle_i] = c_removed_triangle;
+			}
+		}
+	}
+
+	quadric_add(&simplifier->quadrics[to_position], &simplifier->quadrics[from_position]);
+
+	// the border now runs straight from the to position to the from position's
+	// other neighbour
+	if (simplifier->position_kinds[from_position] == Position_Kind::Border)
+	{
+		const uint32* from_neighbours = &simplifier->border_neighbours[from_position * 2];
+		const uint32 other = from_neighbours[0] == to_position ? from_neighbours[1] : from_neighbours[0];
+		if (simplifier->position_kinds[to_position] == Position_Kind::Border)
+		{
+			uint32* to_neighbours = &simplifier->border_neighbours[to_position * 2];
+			to_neighbours[to_neighbours[0] == from_position ? 0 : 1] = other;
+		}
+		if (simplifier->position_kinds[other] == Position_Kind::Border)
+		{
+			uint32* other_neighbours = &simplifier->border_neighbours[other * 2];
+			other_neighbours[other_neighbours[0] == from_position ? 0 : 1] = to_position;
+		}
+	}
+}
+
+// collapses edges until there are at most target_triangle_count triangles,
+// or no collapse is left under max_error_sq
+static void simplify(Simplifier* simplifier, uint32 target_triangle_count, float64 max_error_sq)
+{
+	const Model* model = simplifier->model;
+	uint32* targets = new uint32[model->vertex_count];
+
+	while (simplifier->triangle_count > target_triangle_count)
+	{
+		build_vertex_triangles(simplifier);
+
+		// both directions of every edge, cheapest first
+		uint32 collapse_count = 0;
+		for (uint32 i = 0; i < simplifier->triangle_count * 3; ++i)
+		{
+			const uint32 a = simplifier->triangles[i];
+			const uint32 b = simplifier->triangles[(i % 3) == 2 ? i - 2 : i + 1];
+			const uint32 position_a = simplifier->position_ids[a];
+			const uint32 position_b = simplifier->position_ids[b];
+			for (int32 direction = 0; direction < 2; ++direction)
+			{
+				const uint32 from = direction ? position_b : position_a;
+				const uint32 to = direction ? position_a : position_b;
+				const Position_Kind from_kind = simplifier->position_kinds[from];
+				if (from == to || from_kind == Position_Kind::Locked ||
+					(from_kind == Position_Kind::Border && simplifier->border_neighbours[from * 2] != to && simplifier->border_neighbours[(from * 2) + 1] != to))
+				{
+					continue;
+				}
+
+				Quadric quadric = simplifier->quadrics[from];
+				quadric_add(&quadric, &simplifier->quadrics[to]);
+				Collapse* collapse = &simplifier->collapses[collapse_count];
+				collapse->from = from;
+				collapse->to = to;
+				collapse->error = quadric_error(&quadric, model->vertices[direction ? a : b]);
+				++collapse_count;
+			}
+		}
+		qsort(simplifier->collapses, collapse_count, sizeof(Collapse), compare_collapses);
+
+		// Collapse as many as possible in one pass. Anything near a collapse
+		// is touched and left until the next pass, once adjacency is rebuilt.
+		memset(simplifier->position_touched, 0, simplifier->position_count * sizeof(bool));
+		uint32 removed_count = 0;
+		for (uint32 i = 0; i < collapse_count; ++i)
+		{
+			const Collapse* collapse = &simplifier->collapses[i];
+			if (collapse->error > max_error_sq || simplifier->triangle_count - removed_count <= target_triangle_count)
+			{
+				break;
+			}
+			if (simplifier->position_touched[collapse->from] || simplifier->position_touched[collapse->to])
+			{
+				continue;
+			}
+			if (!plan_collapse(simplifier, collapse->from, collapse->to, targets))
+			{
+				continue;
+			}
+
+			// count what it'll remove before the triangles change
+			const uint32 removed_before = removed_count;
+			for (uint32 j = simplifier->position_vertex_offsets[collapse->from]; j < simplifier->position_vertex_offsets[collapse->from + 1]; ++j)
+			{
+				const uint32 vertex = simplifier->position_vertices[j];
+				for (uint32 k = simplifier->vertex_triangle_offsets[vertex]; k < simplifier->vertex_triangle_offsets[vertex + 1]; ++k)
+				{
+					const int32* triangle = &simplifier->triangles[simplifier->vertex_triangles[k] * 3];
+					if (simplifier->position_ids[triangle[0]] == collapse->to ||
+						simplifier->position_ids[triangle[1]] == collapse->to ||
+						simplifier->position_ids[triangle[2]] == collapse->to)
+					{
+						++removed_count;
+					}
+				}
+			}
+
+			apply_collapse(simplifier, collapse->from, collapse->to, targets);
+			if (removed_count == removed_before)
+			{
+				continue;
+			}
+			simplifier->error_sq = collapse->error > simplifier->error_sq ? collapse->error : simplifier->error_sq;
+		}
+
+		if (removed_count == 0)
+		{
+			break;
+		}
+
+		uint32 kept_count = 0;
+		for (uint32 triangle_i = 0; triangle_i < simplifier->triangle_count; ++triangle_i)
+		{
+			if (simplifier->triangle_draw_calls[triangle_i] == c_removed_triangle)
+			{
+				continue;
+			}
+			memcpy(&simplifier->triangles[kept_count * 3], &simplifier->triangles[triangle_i * 3], 3 * sizeof(int32));
+			simplifier->triangle_draw_calls[kept_count] = simplifier->triangle_draw_calls[triangle_i];
+			++kept_count;
+		}
+		simplifier->triangle_count = kept_count;
+	}
+
+	delete[] targets;
+}
+
+struct Lod_Level
+{
+	int32* triangles;
+	uint32* triangle_draw_calls;
+	uint32 triangle_count;
+	float32 error;
+};
+
+void model_generate_lods(Model* model, uint32 lod_count)
+{
+	assert(lod_count > 0 && lod_count <= c_max_model_lods);
+	assert(model->lod_count == 1);
+
+	Simplifier simplifier;
+	simplifier_create(&simplifier, model);
+
+	const Vec_3f size = vec_3f_sub(model->bounds_max, model->bounds_min);
+	const float64 max_error = c_lod_max_error * float32_sqrt(vec_3f_dot(size, size));
+	const float64 max_error_sq = max_error * max_error;
+
+	Lod_Level levels[c_max_model_lods] = {};
+	uint32 level_count = 1;
+	uint32 previous_triangle_count = model->lods[0].triangle_count;
+	while (level_count < lod_count)
+	{
+		simplify(&simplifier, (uint32)(previous_triangle_count * c_lod_triangle_ratio), max_error_sq);
+		if (simplifier.triangle_count == 0 || simplifier.triangle_count > previous_triangle_count * c_lod_min_reduction)
+		{
+			break;
+		}
+
+		Lod_Level* level = &levels[level_count];
+		level->triangle_count = simplifier.triangle_count;
+		level->triangles = new int32[simplifier.triangle_count * 3];
+		level->triangle_draw_calls = new uint32[simplifier.triangle_count];
+		memcpy(level->triangles, simplifier.triangles, simplifier.triangle_count * 3 * sizeof(int32));
+		memcpy(level->triangle_draw_calls, simplifier.triangle_draw_calls, simplifier.triangle_count * sizeof(uint32));
+		level->error = (float32)sqrt(simplifier.error_sq);
+		++level_count;
+
+		previous_triangle_count = simplifier.triangle_count;
+	}
+	simplifier_destroy(&simplifier);
+
+	if (level_count == 1)
+	{
+		return;
+	}
+
+	// Put the vertices the coarsest level uses first, then the ones the next
+	// coarsest adds and so on, so each level only needs a prefix of them
+	// transformed. Collapses only ever remove vertices, so each level's
+	// vertices are a subset of the finer level's.
+	const uint32 vertex_count = model->vertex_count;
+	uint32* last_level = new uint32[vertex_count];
+	memset(last_level, 0, vertex_count * sizeof(uint32));
+	for (uint32 level_i = 1; level_i < level_count; ++level_i)
+	{
+		for (uint32 i = 0; i < levels[level_i].triangle_count * 3; ++i)
+		{
+			last_level[levels[level_i].triangles[i]] = level_i;
+		}
+	}
+
+	uint32* new_index = new uint32[vertex_count];
+	uint32 next_index = 0;
+	uint32 level_vertex_counts[c_max_model_lods];
+	for (int32 level_i = level_count - 1; level_i >= 0; --level_i)
+	{
+		for (uint32 i = 0; i < vertex_count; ++i)
+		{
+			if (last_level[i] == (uint32)level_i)
+			{
+				new_index[i] = next_index;
+				++next_index;
+			}
+		}
+		level_vertex_counts[level_i] = next_index;
+	}
+
+	Vec_3f* vertices = new Vec_3f[vertex_count];
+	Vec_2f* texcoords = new Vec_2f[vertex_count];
+	Vec_3f* normals = new Vec_3f[vertex_count];
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		vertices[new_index[i]] = model->vertices[i];
+		texcoords[new_index[i]] = model->texcoords[i];
+		normals[new_index[i]] = model->normals[i];
+	}
+	delete[] model->vertices;
+	delete[] model->texcoords;
+	delete[] model->normals;
+	model->vertices = vertices;
+	model->texcoords = texcoords;
+	model->normals = normals;
+
+	for (uint32 i = 0; i < model->lods[0].triangle_count * 3; ++i)
+	{
+		model->triangles[i] = new_index[model->triangles[i]];
+	}
+
+	// each level's triangles grouped into the model's draw calls
+	for (uint32 level_i = 1; level_i < level_count; ++level_i)
+	{
+		const Lod_Level* level = &levels[level_i];
+		Model_Lod* lod = &model->lods[level_i];
+		lod->triangles = new int32[level->triangle_count * 3];
+		lod->draw_calls = new Draw_Call[model->draw_call_count];
+		lod->vertex_count = level_vertex_counts[level_i];
+		lod->triangle_count = level->triangle_count;
+		lod->error = level->error;
+
+		uint32 next_triangle = 0;
+		for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+		{
+			lod->draw_calls[draw_call_i].texture = model->draw_calls[draw_call_i].texture;
+			lod->draw_calls[draw_call_i].triangle_start = next_triangle;
+			for (uint32 triangle_i = 0; triangle_i < level->triangle_count; ++triangle_i)
+			{
+				if (level->triangle_draw_calls[triangle_i] == draw_call_i)
+				{
+					for (int32 i = 0; i < 3; ++i)
+					{
+						lod->triangles[(next_triangle * 3) + i] = new_index[level->triangles[(triangle_i * 3) + i]];
+					}
+					++next_triangle;
+				}
+			}
+			lod->draw_calls[draw_call_i].triangle_count = next_triangle - lod->draw_calls[draw_call_i].triangle_start;
+		}
+
+		delete[] level->triangles;
+		delete[] level->triangle_draw_calls;
+	}
+	model->lod_count = level_count;
+
+	delete[] last_level;
+	delete[] new_index;
+}
+
+uint32 model_select_lod(const Model* model, uint32 current_lod, float32 pixels_per_unit)
+{
+	uint32 lod = uint32_min(current_lod, model->lod_count - 1);
+	while (lod > 0 && model->lods[lod].error * pixels_per_unit > c_lod_pixel_error)
+	{
+		--lod;
+	}
+	while (lod + 1 < model->lod_count && model->lods[lod + 1].error * pixels_per_unit < c_lod_pixel_error * c_lod_hysteresis)
+	{
+		++lod;
+	}
+	return lod;
+}
+
+uint32 model_select_view_lod(const Model* model, uint32 current_lod, float32 lod_scale, float32 w)
+{
+	if (lod_scale <= 0.0f)
+	{
+		return 0;
+	}
+	return model_select_lod(model, current_lod, lod_scale / float32_max(w, c_lod_min_distance));
+}
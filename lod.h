@@ -0,0 +1,25 @@
+#pragma once
+
+#include "graphics.h"
+
+
+// Builds up to lod_count levels of detail (including the full detail one) by
+// collapsing edges in order of least quadric error. Each level aims for half
+// the triangles of the one before, levels that can't get meaningfully smaller
+// without the error getting too big aren't added. Vertices on an open edge or
+// an edge between draw calls only collapse along that border, into the next
+// vertex on it. Vertices where borders meet, or at the ends of an edge used by
+// more than two triangles, never move. Vertices split by UV seams or hard
+// edges are only collapsed together along the seam, so nothing tears.
+// The model's vertices are reordered so coarser levels use a prefix of them.
+void model_generate_lods(Model* model, uint32 lod_count);
+
+// Picks the level whose error is under a pixel, pixels_per_unit being how many
+// pixels a unit covers at the model's distance. Going to a coarser level
+// needs the error to be comfortably under, so models sitting at a switching
+// distance don't flicker between levels.
+uint32 model_select_lod(const Model* model, uint32 current_lod, float32 pixels_per_unit);
+// model_select_lod for a model w along the view direction, lod_scale being the
+// pixels a unit covers at a distance of one. A lod_scale of 0 always picks
+// full detail.
+uint32 model_select_view_lod(const Model* model, uint32 current_lod, float32 lod_scale, float32 w);
@@ -180,4 +180,145 @@ void matrix_4x4_transform(Matrix_4x4* matrix, Vec_3f position, Quat rotation)
 	matrix->m14 = position.x;
 	matrix->m24 = position.y;
 	matrix->m34 = position.z;
+}
+
+void matrix_4x4_inverse_transform(Matrix_4x4* matrix, Vec_3f position, Quat rotation)
+{
+	// inverse of rotate then translate is translate back then rotate back
+	matrix_4x4_rotation(matrix, quat_inverse(rotation));
+	const Vec_3f translation = matrix_4x4_mul_direction(matrix, position);
+	matrix->m14 = -translation.x;
+	matrix->m24 = -translation.y;
+	matrix->m34 = -translation.z;
+}
+
+void aabb_transform(const Matrix_4x4* matrix, Vec_3f min, Vec_3f max, Vec_3f* out_min, Vec_3f* out_max)
+{
+	// transform the centre, then the extents by the absolute of the 3x3 part,
+	// which gives the extents of the box enclosing the transformed box
+	const Vec_3f centre = vec_3f_mul(vec_3f_add(min, max), 0.5f);
+	const Vec_3f extents = vec_3f_mul(vec_3f_sub(max, min), 0.5f);
+
+	const Vec_3f new_centre = matrix_4x4_mul(matrix, centre);
+	const Vec_3f new_extents = {
+		(float32_abs(matrix->m11) * extents.x) + (float32_abs(matrix->m12) * extents.y) + (float32_abs(matrix->m13) * extents.z),
+		(float32_abs(matrix->m21) * extents.x) + (float32_abs(matrix->m22) * extents.y) + (float32_abs(matrix->m23) * extents.z),
+		(float32_abs(matrix->m31) * extents.x) + (float32_abs(matrix->m32) * extents.y) + (float32_abs(matrix->m33) * extents.z)
+	};
+
+	*out_min = vec_3f_sub(new_centre, new_extents);
+	*out_max = vec_3f_add(new_centre, new_extents);
+}
+
+static Plane plane_normalised(float32 a, float32 b, float32 c, float32 d)
+{
+	const float32 length = float32_sqrt((a * a) + (b * b) + (c * c));
+	return { { a / length, b / length, c / length }, d / length };
+}
+
+bool aabb_overlaps(Vec_3f a_min, Vec_3f a_max, Vec_3f b_min, Vec_3f b_max)
+{
+	return a_min.x <= b_max.x && a_max.x >= b_min.x &&
+		a_min.y <= b_max.y && a_max.y >= b_min.y &&
+		a_min.z <= b_max.z && a_max.z >= b_min.z;
+}
+
+float32 aabb_distance_sq(Vec_3f min, Vec_3f max, Vec_3f point)
+{
+	float32 distance_sq = 0.0f;
+	for (int32 axis = 0; axis < 3; ++axis)
+	{
+		const float32 nearest = float32_clamp(min.v[axis], max.v[axis], point.v[axis]);
+		const float32 d = point.v[axis] - nearest;
+		distance_sq += d * d;
+	}
+	return distance_sq;
+}
+
+bool ray_intersects_aabb(Vec_3f origin, Vec_3f inverse_direction, float32 max_t, Vec_3f min, Vec_3f max)
+{
+	// slab test, the infinities from zero direction components work out
+	float32 t_min = 0.0f;
+	float32 t_max = max_t;
+	for (int32 axis = 0; axis < 3; ++axis)
+	{
+		const float32 t1 = (min.v[axis] - origin.v[axis]) * inverse_direction.v[axis];
+		const float32 t2 = (max.v[axis] - origin.v[axis]) * inverse_direction.v[axis];
+		t_min = float32_max(t_min, float32_min(t1, t2));
+		t_max = float32_min(t_max, float32_max(t1, t2));
+	}
+	return t_min <= t_max;
+}
+
+void frustum_from_matrix(Frustum* frustum, const Matrix_4x4* m)
+{
+	// clip space is -w <= x <= w, -w <= y <= w, 0 <= z <= w, each inequality
+	// is a plane made from the rows of the matrix
+	frustum->planes[0] = plane_normalised(m->m41 + m->m11, m->m42 + m->m12, m->m43 + m->m13, m->m44 + m->m14); // left
+	frustum->planes[1] = plane_normalised(m->m41 - m->m11, m->m42 - m->m12, m->m43 - m->m13, m->m44 - m->m14); // right
+	frustum->planes[2] = plane_normalised(m->m41 + m->m21, m->m42 + m->m22, m->m43 + m->m23, m->m44 + m->m24); // bottom/top
+	frustum->planes[3] = plane_normalised(m->m41 - m->m21, m->m42 - m->m22, m->m43 - m->m23, m->m44 - m->m24); // top/bottom
+	frustum->planes[4] = plane_normalised(m->m31, m->m32, m->m33, m->m34); // near
+	frustum->planes[5] = plane_normalised(m->m41 - m->m31, m->m42 - m->m32, m->m43 - m->m33, m->m44 - m->m34); // far
+}
+
+bool frustum_intersects_aabb(const Frustum* frustum, Vec_3f min, Vec_3f max)
+{
+	for (int32 i = 0; i < 6; ++i)
+	{
+		// test the corner furthest along the plane normal, if even that is
+		// behind the plane the whole box is outside
+		const Plane* plane = &frustum->planes[i];
+		const Vec_3f corner = {
+			plane->normal.x >= 0.0f ? max.x : min.x,
+			plane->normal.y >= 0.0f ? max.y : min.y,
+			plane->normal.z >= 0.0f ? max.z : min.z
+		};
+		if (vec_3f_dot(plane->normal, corner) + plane->d < 0.0f)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+Frustum_Test frustum_classify_aabb(const Frustum* frustum, Vec_3f min, Vec_3f max)
+{
+	Frustum_Test result = Frustum_Test::Inside;
+	for (int32 i = 0; i < 6; ++i)
+	{
+		// furthest corner along the normal decides outside, the nearest one
+		// decides whether the box crosses the plane
+		const Plane* plane = &frustum->planes[i];
+		const bool x = plane->normal.x >= 0.0f;
+		const bool y = plane->normal.y >= 0.0f;
+		const bool z = plane->normal.z >= 0.0f;
+		const Vec_3f far_corner = { x ? max.x : min.x, y ? max.y : min.y, z ? max.z : min.z };
+		if (vec_3f_dot(plane->normal, far_corner) + plane->d < 0.0f)
+		{
+			return Frustum_Test::Outside;
+		}
+		const Vec_3f near_corner = { x ? min.x : max.x, y ? min.y : max.y, z ? min.z : max.z };
+		if (vec_3f_dot(plane->normal, near_corner) + plane->d < 0.0f)
+		{
+			result = Frustum_Test::Intersects;
+		}
+	}
+
+	return result;
+}
+
+bool frustum_intersects_sphere(const Frustum* frustum, Vec_3f centre, float32 radius)
+{
+	for (int32 i = 0; i < 6; ++i)
+	{
+		const Plane* plane = &frustum->planes[i];
+		if (vec_3f_dot(plane->normal, centre) + plane->d < -radius)
+		{
+			return false;
+		}
+	}
+
+	return true;
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include "types.h"
 #include <cmath>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 constexpr float32 c_pi = 3.1415926535897932384626433f;
 constexpr float32 c_deg_to_rad = c_pi / 180.0f;
@@ -47,6 +50,26 @@ struct Transform
 	Quat rotation;
 };
 
+// plane is dot(normal, p) + d = 0, normal points into the positive half space
+struct Plane
+{
+	Vec_3f normal;
+	float32 d;
+};
+
+// planes point inwards, so a point inside has a positive distance to all of them
+struct Frustum
+{
+	Plane planes[6];
+};
+
+enum class Frustum_Test
+{
+	Outside,
+	Intersects,
+	Inside
+};
+
 struct Matrix_4x4
 {
 	// m11 m12 m13 m14
@@ -91,6 +114,11 @@ inline float32 float32_floor(float32 value)
 	return floorf(value);
 }
 
+inline float32 float32_ceil(float32 value)
+{
+	return ceilf(value);
+}
+
 inline float32 float32_sqrt(float32 value)
 {
 	return sqrtf(value);
@@ -111,6 +139,11 @@ inline float32 float32_tan(float32 value)
 	return tanf(value);
 }
 
+inline float32 float32_pow(float32 value, float32 power)
+{
+	return powf(value, power);
+}
+
 constexpr int32 int32_abs(int32 a)
 {
 	return a >= 0 ? a : -a;
@@ -136,11 +169,40 @@ constexpr uint32 uint32_swap_endianness(uint32 u)
 	return (u << 24) | (u & 0xff00) << 8 | (u & 0xff0000) >> 8 | (u >> 24);
 }
 
+constexpr uint32 uint32_min(uint32 a, uint32 b)
+{
+	return a < b ? a : b;
+}
+
 constexpr uint32 uint32_max(uint32 a, uint32 b)
 {
 	return a > b ? a : b;
 }
 
+// index of the lowest set bit, value must not be 0
+inline uint32 uint32_lowest_set_bit(uint32 value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return index;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+// index of the highest set bit, value must not be 0
+inline uint32 uint32_highest_set_bit(uint32 value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, value);
+	return index;
+#else
+	return 31 - __builtin_clz(value);
+#endif
+}
+
 constexpr Vec_2f vec_2f_lerp(Vec_2f a, Vec_2f b, float32 t)
 {
 	return { float32_lerp(a.x, b.x, t), float32_lerp(a.y, b.y, t) };
@@ -176,6 +238,16 @@ constexpr Vec_3f vec_3f_cross(Vec_3f a, Vec_3f b)
 	return { (a.y * b.z) - (a.z * b.y), (a.z * b.x) - (a.x * b.z), (a.x * b.y) - (a.y * b.x) };
 }
 
+constexpr Vec_3f vec_3f_min(Vec_3f a, Vec_3f b)
+{
+	return { float32_min(a.x, b.x), float32_min(a.y, b.y), float32_min(a.z, b.z) };
+}
+
+constexpr Vec_3f vec_3f_max(Vec_3f a, Vec_3f b)
+{
+	return { float32_max(a.x, b.x), float32_max(a.y, b.y), float32_max(a.z, b.z) };
+}
+
 constexpr Vec_3f vec_3f_lerp(Vec_3f a, Vec_3f b, float32 t)
 {
 	return { float32_lerp(a.x, b.x, t),
@@ -212,6 +284,12 @@ constexpr Vec_3f quat_mul(Quat q, Vec_3f v)
 	return { x, y, z };
 }
 
+constexpr Quat quat_inverse(Quat q)
+{
+	// assumes unit length
+	return { -q.zy, -q.xz, -q.yx, q.scalar };
+}
+
 constexpr Quat quat_mul(Quat a, Quat b)
 {
 	// TODO simplify
@@ -236,4 +314,22 @@ Vec_4f matrix_4x4_mul_vec4(const Matrix_4x4* matrix, Vec_3f v);
 void matrix_4x4_camera(Matrix_4x4* matrix, Vec_3f position, Vec_3f forward, Vec_3f up, Vec_3f right);
 void matrix_4x4_lookat(Matrix_4x4* matrix, Vec_3f position, Vec_3f target, Vec_3f up);
 void matrix_4x4_rotation(Matrix_4x4* matrix, Quat rotation);
-void matrix_4x4_transform(Matrix_4x4* matrix, Vec_3f position, Quat rotation); // for an object in world with position and rotation, equivalent to doing rotation, then position translation
\ No newline at end of file
+void matrix_4x4_transform(Matrix_4x4* matrix, Vec_3f position, Quat rotation); // for an object in world with position and rotation, equivalent to doing rotation, then position translation
+void matrix_4x4_inverse_transform(Matrix_4x4* matrix, Vec_3f position, Quat rotation); // inverse of matrix_4x4_transform, without a general inverse
+
+// bounds of the box min-max after transforming by matrix
+void aabb_transform(const Matrix_4x4* matrix, Vec_3f min, Vec_3f max, Vec_3f* out_min, Vec_3f* out_max);
+bool aabb_overlaps(Vec_3f a_min, Vec_3f a_max, Vec_3f b_min, Vec_3f b_max);
+// squared distance from point to the nearest point in the box, 0 if it's inside
+float32 aabb_distance_sq(Vec_3f min, Vec_3f max, Vec_3f point);
+// inverse_direction is 1 / direction per axis, so it can be computed once per
+// ray, hits are between 0 and max_t along the direction
+bool ray_intersects_aabb(Vec_3f origin, Vec_3f inverse_direction, float32 max_t, Vec_3f min, Vec_3f max);
+
+// planes of the clip volume of a view projection matrix, in whatever space the
+// matrix transforms from (world space for view projection)
+void frustum_from_matrix(Frustum* frustum, const Matrix_4x4* matrix);
+bool frustum_intersects_aabb(const Frustum* frustum, Vec_3f min, Vec_3f max);
+// like frustum_intersects_aabb but also says when the box is entirely inside
+Frustum_Test frustum_classify_aabb(const Frustum* frustum, Vec_3f min, Vec_3f max);
+bool frustum_intersects_sphere(const Frustum* frustum, Vec_3f centre, float32 radius);
\ No newline at end of file
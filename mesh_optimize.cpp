@@ -0,0 +1,315 @@
+#include "mesh_optimize.h"
+
+#include <cstring>
+#include "assert.h"
+
+
+// Forsyth's scoring, vertices are kept in an LRU cache of this many while
+// ordering triangles
+static constexpr uint32 c_forsyth_cache_size = 32;
+static constexpr float32 c_forsyth_cache_decay_power = 1.5f;
+static constexpr float32 c_forsyth_last_triangle_score = 0.75f;
+static constexpr float32 c_forsyth_valence_boost_scale = 2.0f;
+static constexpr float32 c_forsyth_valence_boost_power = 0.5f;
+
+static constexpr int32 c_not_cached = -1;
+static constexpr uint32 c_no_triangle = 0xffffffff;
+static constexpr uint32 c_no_vertex = 0xffffffff;
+
+
+// Vertices in the cache score higher the more recently they were used, except
+// the last triangle's which score a bit lower so the next triangle doesn't
+// just fan around one vertex. Vertices with few triangles left score higher,
+// so lone triangles get finished off instead of left for later.
+static float32 forsyth_vertex_score(int32 cache_position, uint32 remaining_triangles)
+{
+	if (remaining_triangles == 0)
+	{
+		return -1.0f;
+	}
+
+	float32 score = 0.0f;
+	if (cache_position != c_not_cached)
+	{
+		if (cache_position < 3)
+		{
+			score = c_forsyth_last_triangle_score;
+		}
+		else
+		{
+			const float32 scale = 1.0f / (c_forsyth_cache_size - 3);
+			score = float32_pow(1.0f - ((cache_position - 3) * scale), c_forsyth_cache_decay_power);
+		}
+	}
+
+	return score + (c_forsyth_valence_boost_scale * float32_pow((float32)remaining_triangles, -c_forsyth_valence_boost_power));
+}
+
+// reorders triangle_count triangles in place
+static void optimize_triangle_order(int32* triangles, uint32 triangle_count, uint32 vertex_count)
+{
+	if (triangle_count < 2)
+	{
+		return;
+	}
+
+	// triangles using each vertex, the first remaining_triangles of them not drawn yet
+	uint32* vertex_triangle_offsets = new uint32[vertex_count + 1];
+	uint32* vertex_triangles = new uint32[triangle_count * 3];
+	uint32* remaining_triangles = new uint32[vertex_count];
+	int32* cache_positions = new int32[vertex_count];
+	float32* vertex_scores = new float32[vertex_count];
+	memset(remaining_triangles, 0, vertex_count * sizeof(uint32));
+	for (uint32 i = 0; i < triangle_count * 3; ++i)
+	{
+		++remaining_triangles[triangles[i]];
+	}
+	vertex_triangle_offsets[0] = 0;
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		vertex_triangle_offsets[i + 1] = vertex_triangle_offsets[i] + remaining_triangles[i];
+		remaining_triangles[i] = 0;
+		cache_positions[i] = c_not_cached;
+	}
+	for (uint32 triangle_i = 0; triangle_i < triangle_count; ++triangle_i)
+	{
+		for (int32 i = 0; i < 3; ++i)
+		{
+			const int32 vertex = triangles[(triangle_i * 3) + i];
+			vertex_triangles[vertex_triangle_offsets[vertex] + remaining_triangles[vertex]] = triangle_i;
+			++remaining_triangles[vertex];
+		}
+	}
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		vertex_scores[i] = forsyth_vertex_score(c_not_cached, remaining_triangles[i]);
+	}
+
+	float32* triangle_scores = new float32[triangle_count];
+	bool* triangle_drawn = new bool[triangle_count];
+	uint32 best_triangle = 0;
+	for (uint32 triangle_i = 0; triangle_i < triangle_count; ++triangle_i)
+	{
+		const int32* triangle = &triangles[triangle_i * 3];
+		triangle_scores[triangle_i] = vertex_scores[triangle[0]] + vertex_scores[triangle[1]] + vertex_scores[triangle[2]];
+		triangle_drawn[triangle_i] = false;
+		if (triangle_scores[triangle_i] > triangle_scores[best_triangle])
+		{
+			best_triangle = triangle_i;
+		}
+	}
+
+	// room for the triangle's vertices going in before the ones falling out are dropped
+	uint32 cache[c_forsyth_cache_size + 3];
+	uint32 cache_count = 0;
+	uint32 new_cache[c_forsyth_cache_size + 3];
+
+	int32* ordered = new int32[triangle_count * 3];
+	uint32 first_undrawn = 0;
+	for (uint32 ordered_i = 0; ordered_i < triangle_count; ++ordered_i)
+	{
+		if (best_triangle == c_no_triangle)
+		{
+			// nothing in the cache has triangles left, start on the next piece
+			while (triangle_drawn[first_undrawn])
+			{
+				++first_undrawn;
+			}
+			best_triangle = first_undrawn;
+		}
+
+		const int32* triangle = &triangles[best_triangle * 3];
+		memcpy(&ordered[ordered_i * 3], triangle, 3 * sizeof(int32));
+		triangle_drawn[best_triangle] = true;
+
+		// take the triangle out of its vertices' remaining triangles
+		for (int32 i = 0; i < 3; ++i)
+		{
+			const int32 vertex = triangle[i];
+			uint32* remaining = &vertex_triangles[vertex_triangle_offsets[vertex]];
+			for (uint32 j = 0; j < remaining_triangles[vertex]; ++j)
+			{
+				if (remaining[j] == best_triangle)
+				{
+					remaining[j] = remaining[remaining_triangles[vertex] - 1];
+					remaining[remaining_triangles[vertex] - 1] = best_triangle;
+					break;
+				}
+			}
+			--remaining_triangles[vertex];
+		}
+
+		// the triangle's vertices move to the front of the cache
+		uint32 new_cache_count = 0;
+		for (int32 i = 0; i < 3; ++i)
+		{
+			new_cache[new_cache_count] = triangle[i];
+			++new_cache_count;
+		}
+		for (uint32 i = 0; i < cache_count; ++i)
+		{
+			const uint32 vertex = cache[i];
+			if (vertex != (uint32)triangle[0] && vertex != (uint32)triangle[1] && vertex != (uint32)triangle[2])
+			{
+				new_cache[new_cache_count] = vertex;
+				++new_cache_count;
+			}
+		}
+
+		// Rescore everything that was or is in the cache, and the triangles
+		// they still have to draw. The best of those is drawn next.
+		best_triangle = c_no_triangle;
+		float32 best_score = -1.0f;
+		for (uint32 i = 0; i < new_cache_count; ++i)
+		{
+			const uint32 vertex = new_cache[i];
+			cache_positions[vertex] = i < c_forsyth_cache_size ? (int32)i : c_not_cached;
+			vertex_scores[vertex] = forsyth_vertex_score(cache_positions[vertex], remaining_triangles[vertex]);
+		}
+		for (uint32 i = 0; i < new_cache_count; ++i)
+		{
+			const uint32 vertex = new_cache[i];
+			const uint32* remaining = &vertex_triangles[vertex_triangle_offsets[vertex]];
+			for (uint32 j = 0; j < remaining_triangles[vertex]; ++j)
+			{
+				const int32* other = &triangles[remaining[j] * 3];
+				const float32 score = vertex_scores[other[0]] + vertex_scores[other[1]] + vertex_scores[other[2]];
+				triangle_scores[remaining[j]] = score;
+				if (score > best_score)
+				{
+					best_score = score;
+					best_triangle = remaining[j];
+				}
+			}
+		}
+
+		cache_count = uint32_min(new_cache_count, c_forsyth_cache_size);
+		memcpy(cache, new_cache, cache_count * sizeof(uint32));
+	}
+
+	memcpy(triangles, ordered, triangle_count * 3 * sizeof(int32));
+
+	delete[] vertex_triangle_offsets;
+	delete[] vertex_triangles;
+	delete[] remaining_triangles;
+	delete[] cache_positions;
+	delete[] vertex_scores;
+	delete[] triangle_scores;
+	delete[] triangle_drawn;
+	delete[] ordered;
+}
+
+void model_optimize(Model* model)
+{
+	const uint32 vertex_count = model->vertex_count;
+	for (uint32 lod_i = 0; lod_i < model->lod_count; ++lod_i)
+	{
+		const Model_Lod* lod = &model->lods[lod_i];
+		for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+		{
+			const Draw_Call* draw_call = &lod->draw_calls[draw_call_i];
+			optimize_triangle_order(&lod->triangles[draw_call->triangle_start * 3], draw_call->triangle_count, vertex_count);
+		}
+	}
+
+	// Number vertices as they're first used, in the order they're drawn. The
+	// coarsest level goes first, then what each finer one adds, so every
+	// level's vertices are still a prefix.
+	uint32* new_index = new uint32[vertex_count];
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		new_index[i] = c_no_vertex;
+	}
+	uint32 next_index = 0;
+	for (int32 lod_i = model->lod_count - 1; lod_i >= 0; --lod_i)
+	{
+		Model_Lod* lod = &model->lods[lod_i];
+		for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+		{
+			const Draw_Call* draw_call = &lod->draw_calls[draw_call_i];
+			const uint32 index_start = draw_call->triangle_start * 3;
+			const uint32 index_end = index_start + (draw_call->triangle_count * 3);
+			for (uint32 i = index_start; i < index_end; ++i)
+			{
+				if (new_index[lod->triangles[i]] == c_no_vertex)
+				{
+					new_index[lod->triangles[i]] = next_index;
+					++next_index;
+				}
+			}
+		}
+		lod->vertex_count = next_index;
+	}
+
+	// anything nothing uses goes on the end
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		if (new_index[i] == c_no_vertex)
+		{
+			new_index[i] = next_index;
+			++next_index;
+		}
+	}
+
+	Vec_3f* vertices = new Vec_3f[vertex_count];
+	Vec_2f* texcoords = new Vec_2f[vertex_count];
+	Vec_3f* normals = new Vec_3f[vertex_count];
+	for (uint32 i = 0; i < vertex_count; ++i)
+	{
+		vertices[new_index[i]] = model->vertices[i];
+		texcoords[new_index[i]] = model->texcoords[i];
+		normals[new_index[i]] = model->normals[i];
+	}
+	delete[] model->vertices;
+	delete[] model->texcoords;
+	delete[] model->normals;
+	model->vertices = vertices;
+	model->texcoords = texcoords;
+	model->normals = normals;
+
+	for (uint32 lod_i = 0; lod_i < model->lod_count; ++lod_i)
+	{
+		Model_Lod* lod = &model->lods[lod_i];
+		for (uint32 i = 0; i < lod->triangle_count * 3; ++i)
+		{
+			lod->triangles[i] = new_index[lod->triangles[i]];
+		}
+	}
+
+	delete[] new_index;
+}
+
+float32 model_acmr(const Model* model, uint32 lod, uint32 cache_size)
+{
+	assert(lod < model->lod_count);
+
+	const Model_Lod* model_lod = &model->lods[lod];
+	if (model_lod->triangle_count == 0)
+	{
+		return 0.0f;
+	}
+
+	// A vertex is in the FIFO if fewer than cache_size vertices have been
+	// added since it was, hits don't move it.
+	uint32* added_at = new uint32[model->vertex_count];
+	memset(added_at, 0, model->vertex_count * sizeof(uint32));
+	uint32 misses = 0;
+	for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+	{
+		const Draw_Call* draw_call = &model_lod->draw_calls[draw_call_i];
+		const uint32 index_start = draw_call->triangle_start * 3;
+		const uint32 index_end = index_start + (draw_call->triangle_count * 3);
+		for (uint32 i = index_start; i < index_end; ++i)
+		{
+			const int32 vertex = model_lod->triangles[i];
+			if (added_at[vertex] == 0 || misses - added_at[vertex] >= cache_size)
+			{
+				++misses;
+				added_at[vertex] = misses;
+			}
+		}
+	}
+	delete[] added_at;
+
+	return misses / (float32)model_lod->triangle_count;
+}
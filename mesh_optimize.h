@@ -0,0 +1,17 @@
+#pragma once
+
+#include "graphics.h"
+
+
+// Reorders each level of detail's triangles within each draw call so
+// triangles sharing vertices are drawn close together (Forsyth's linear speed
+// vertex cache optimisation), then renumbers the vertices in the order the
+// triangles first use them, so projecting and drawing walk the vertex arrays
+// mostly forwards. Coarser levels are renumbered first, so they still use a
+// prefix of the vertices. Run after model_generate_lods.
+void model_optimize(Model* model);
+
+// Average cache miss ratio, the number of vertices a FIFO cache of cache_size
+// vertices has to transform per triangle when drawing the level of detail.
+// 0.5 is the best a large regular grid can do, 3 means no reuse at all.
+float32 model_acmr(const Model* model, uint32 lod, uint32 cache_size);
@@ -0,0 +1,333 @@
+#include "meshlet.h"
+
+#include <cstring>
+
+
+// triangles a meshlet gets before it can be ended early to keep its cone narrow
+static constexpr uint32 c_min_meshlet_triangles = 16;
+// cones with normals spread wider than this (about 84 degrees from the axis)
+// would hardly ever cull anything, so they're not tested at all
+static constexpr float32 c_min_cone_dot = 0.1f;
+
+static constexpr uint32 c_no_meshlet = 0xffffffff;
+
+
+// unit normal of the side the rasteriser draws, zero for degenerate triangles
+static Vec_3f front_normal(const Model* model, const int32* triangle)
+{
+	const Vec_3f v0 = model->vertices[triangle[0]];
+	const Vec_3f v1 = model->vertices[triangle[1]];
+	const Vec_3f v2 = model->vertices[triangle[2]];
+	const Vec_3f normal = vec_3f_cross(vec_3f_sub(v1, v0), vec_3f_sub(v2, v0));
+	const float32 length = float32_sqrt(vec_3f_dot(normal, normal));
+	return length > 0.0f ? vec_3f_mul(normal, 1.0f / length) : Vec_3f{};
+}
+
+static void meshlet_finish(const Model* model, const uint32* vertices, Vec_3f normal_sum, Meshlet* meshlet)
+{
+	Vec_3f min = model->vertices[vertices[meshlet->vertex_start]];
+	Vec_3f max = min;
+	for (uint32 i = 1; i < meshlet->vertex_count; ++i)
+	{
+		const Vec_3f vertex = model->vertices[vertices[meshlet->vertex_start + i]];
+		min = vec_3f_min(min, vertex);
+		max = vec_3f_max(max, vertex);
+	}
+	meshlet->centre = vec_3f_mul(vec_3f_add(min, max), 0.5f);
+	float32 radius_sq = 0.0f;
+	for (uint32 i = 0; i < meshlet->vertex_count; ++i)
+	{
+		const Vec_3f offset = vec_3f_sub(model->vertices[vertices[meshlet->vertex_start + i]], meshlet->centre);
+		radius_sq = float32_max(radius_sq, vec_3f_dot(offset, offset));
+	}
+	meshlet->radius = float32_sqrt(radius_sq);
+
+	meshlet->cone_axis = {};
+	meshlet->cone_cutoff = 1.0f;
+	const float32 axis_length = float32_sqrt(vec_3f_dot(normal_sum, normal_sum));
+	if (axis_length <= 0.0f)
+	{
+		return;
+	}
+
+	const Vec_3f axis = vec_3f_mul(normal_sum, 1.0f / axis_length);
+	float32 min_dot = 1.0f;
+	for (uint32 i = 0; i < meshlet->triangle_count; ++i)
+	{
+		// Degenerate triangles can still come out with a sliver of area once
+		// projected and rounded, facing either way, so they count as facing
+		// every way.
+		const Vec_3f normal = front_normal(model, &model->lods[0].triangles[(meshlet->triangle_start + i) * 3]);
+		min_dot = vec_3f_dot(normal, normal) > 0.0f ? float32_min(min_dot, vec_3f_dot(normal, axis)) : -1.0f;
+	}
+
+	meshlet->cone_axis = axis;
+	if (min_dot > c_min_cone_dot)
+	{
+		// sin of the angle between the axis and the widest normal, what the
+		// view direction has to be within of the axis to see every triangle
+		// from behind
+		meshlet->cone_cutoff = float32_sqrt(1.0f - (min_dot * min_dot));
+	}
+}
+
+Meshlet_Mesh meshlet_mesh_create(const Model* model)
+{
+	const Model_Lod* lod = &model->lods[0];
+
+	// at worst every triangle is a meshlet of its own
+	Meshlet* meshlets = new Meshlet[lod->triangle_count];
+	uint32* vertices = new uint32[lod->triangle_count * 3];
+	uint32 meshlet_count = 0;
+	uint32 vertex_count = 0;
+
+	// which meshlet last used each vertex, so each is listed once per meshlet
+	uint32* vertex_meshlet = new uint32[model->vertex_count];
+	for (uint32 i = 0; i < model->vertex_count; ++i)
+	{
+		vertex_meshlet[i] = c_no_meshlet;
+	}
+
+	for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+	{
+		const Draw_Call* draw_call = &lod->draw_calls[draw_call_i];
+		Meshlet* meshlet = nullptr;
+		Vec_3f normal_sum = {};
+		for (uint32 triangle_i = 0; triangle_i < draw_call->triangle_count; ++triangle_i)
+		{
+			const uint32 triangle = draw_call->triangle_start + triangle_i;
+			const int32* indices = &lod->triangles[triangle * 3];
+			const Vec_3f normal = front_normal(model, indices);
+
+			if (meshlet)
+			{
+				uint32 new_vertices = 0;
+				for (uint32 i = 0; i < 3; ++i)
+				{
+					new_vertices += vertex_meshlet[indices[i]] != meshlet_count - 1 ? 1 : 0;
+				}
+
+				const bool full = meshlet->triangle_count == c_max_meshlet_triangles ||
+					meshlet->vertex_count + new_vertices > c_max_meshlet_vertices;
+				const bool turns_away = meshlet->triangle_count >= c_min_meshlet_triangles &&
+					vec_3f_dot(normal, normal_sum) < 0.0f;
+				if (full || turns_away)
+				{
+					meshlet_finish(model, vertices, normal_sum, meshlet);
+					meshlet = nullptr;
+				}
+			}
+
+			if (!meshlet)
+			{
+				meshlet = &meshlets[meshlet_count];
+				++meshlet_count;
+				*meshlet = {};
+				meshlet->draw_call = draw_call_i;
+				meshlet->triangle_start = triangle;
+				meshlet->vertex_start = vertex_count;
+				normal_sum = {};
+			}
+
+			for (uint32 i = 0; i < 3; ++i)
+			{
+				if (vertex_meshlet[indices[i]] != meshlet_count - 1)
+				{
+					vertex_meshlet[indices[i]] = meshlet_count - 1;
+					vertices[vertex_count] = indices[i];
+					++vertex_count;
+					++meshlet->vertex_count;
+				}
+			}
+			++meshlet->triangle_count;
+			normal_sum = vec_3f_add(normal_sum, normal);
+		}
+
+		if (meshlet)
+		{
+			meshlet_finish(model, vertices, normal_sum, meshlet);
+		}
+	}
+
+	delete[] vertex_meshlet;
+
+	Meshlet_Mesh mesh = {};
+	mesh.meshlet_count = meshlet_count;
+	mesh.meshlets = new Meshlet[meshlet_count];
+	memcpy(mesh.meshlets, meshlets, meshlet_count * sizeof(Meshlet));
+	mesh.vertex_count = vertex_count;
+	mesh.vertices = new uint32[vertex_count];
+	memcpy(mesh.vertices, vertices, vertex_count * sizeof(uint32));
+	delete[] meshlets;
+	delete[] vertices;
+
+	return mesh;
+}
+
+void meshlet_mesh_destroy(Meshlet_Mesh* mesh)
+{
+	delete[] mesh->meshlets;
+	delete[] mesh->vertices;
+	*mesh = {};
+}
+
+// If the camera is far enough behind the cone's apex to see it from inside
+// the cone, every triangle faces away. The apex isn't kept, the bounding
+// sphere stands in for it, which only ever culls less.
+static bool meshlet_is_backfacing(const Meshlet* meshlet, Vec_3f camera)
+{
+	if (meshlet->cone_cutoff >= 1.0f)
+	{
+		return false;
+	}
+
+	const Vec_3f view = vec_3f_sub(meshlet->centre, camera);
+	const float32 distance = float32_sqrt(vec_3f_dot(view, view));
+	return vec_3f_dot(view, meshlet->cone_axis) >= (meshlet->cone_cutoff * distance) + meshlet->radius;
+}
+
+// Draws the meshlets first to last, which follow on from each other in the
+// same draw call. Vertices already stamped with the context's stamp were
+// projected and lit by an earlier run. Returns the number of vertices
+// projected.
+static uint32 draw_meshlet_run(
+	Render_Context* context,
+	const Model* model,
+	const Meshlet_Mesh* mesh,
+	uint32 first,
+	uint32 last,
+	const Local_Light* point_light,
+	Vec_3f light_in_model_space,
+	const Matrix_4x4* model_view_projection_matrix)
+{
+	const Meshlet* first_meshlet = &mesh->meshlets[first];
+	const Meshlet* last_meshlet = &mesh->meshlets[last];
+	const uint32 vertices_end = last_meshlet->vertex_start + last_meshlet->vertex_count;
+
+	// vertices on the edges between meshlets are listed by each of them, but
+	// each is only projected once, by one job
+	const uint32 stamp = context->vertex_stamp;
+	uint32* indices = context->stamped_indices;
+	uint32 index_count = 0;
+	for (uint32 i = first_meshlet->vertex_start; i < vertices_end; ++i)
+	{
+		const uint32 vertex = mesh->vertices[i];
+		if (context->vertex_stamps[vertex] != stamp)
+		{
+			context->vertex_stamps[vertex] = stamp;
+			indices[index_count] = vertex;
+			++index_count;
+		}
+	}
+	graphics_project_indexed_vertices(context, model->vertices, indices, index_count, model_view_projection_matrix, context->projected_vertices);
+
+	Draw_Call draw_call = model->lods[0].draw_calls[first_meshlet->draw_call];
+	draw_call.triangle_start = first_meshlet->triangle_start;
+	draw_call.triangle_count = last_meshlet->triangle_start + last_meshlet->triangle_count - first_meshlet->triangle_start;
+
+	for (uint32 i = 0; i < index_count; ++i)
+	{
+		const uint32 vertex = indices[i];
+		if (point_light)
+		{
+			context->vertex_light[vertex] = 0.0f;
+			graphics_add_local_lights(context, &model->vertices[vertex], &model->normals[vertex], 1, point_light, 1, &context->vertex_light[vertex]);
+		}
+		else
+		{
+			graphics_light_vertices(context, &model->normals[vertex], 1, light_in_model_space, &context->vertex_light[vertex]);
+		}
+	}
+	graphics_draw_lit_triangles(context, context->projected_vertices, model->texcoords, context->vertex_light, model->lods[0].triangles, &draw_call, 1);
+	return index_count;
+}
+
+Meshlet_Draw_Stats project_and_draw_meshlets(
+	Render_Context* context,
+	const Model* model,
+	const Meshlet_Mesh* meshlets,
+	Vec_4f light_in_world_space,
+	Vec_3f camera_position,
+	const Matrix_4x4* inverse_model_matrix,
+	const Matrix_4x4* model_view_projection_matrix)
+{
+	Meshlet_Draw_Stats stats = {};
+
+	// both tests are done in model space
+	Frustum frustum;
+	frustum_from_matrix(&frustum, model_view_projection_matrix);
+	const Vec_3f camera = matrix_4x4_mul(inverse_model_matrix, camera_position);
+
+	// same lighting as project_and_draw
+	const Vec_3f light_direction = { light_in_world_space.x, light_in_world_space.y, light_in_world_space.z };
+	Vec_3f light_in_model_space = {};
+	Local_Light point_light = {};
+	const bool light_is_directional = light_in_world_space.w == 0.0f;
+	if (light_is_directional)
+	{
+		light_in_model_space = matrix_4x4_mul_direction(inverse_model_matrix, light_direction);
+	}
+	else
+	{
+		point_light.position = matrix_4x4_mul(inverse_model_matrix, light_direction);
+		point_light.range = INFINITY;
+		point_light.intensity = 1.0f;
+		point_light.cos_inner = -1.0f;
+		point_light.cos_outer = -1.0f;
+	}
+
+	render_context_reserve_vertices(context, model->vertex_count);
+
+	// a new stamp for this draw, starting the stamps over if it wraps round
+	++context->vertex_stamp;
+	if (context->vertex_stamp == 0)
+	{
+		memset(context->vertex_stamps, 0, context->projected_vertex_capacity * sizeof(uint32));
+		context->vertex_stamp = 1;
+	}
+
+	// Runs of meshlets left after culling are drawn together, as one draw
+	// call, while they follow on from each other in the same draw call.
+	uint32 run_first = c_no_meshlet;
+	for (uint32 i = 0; i < meshlets->meshlet_count; ++i)
+	{
+		const Meshlet* meshlet = &meshlets->meshlets[i];
+		bool visible = true;
+		if (!frustum_intersects_sphere(&frustum, meshlet->centre, meshlet->radius))
+		{
+			++stats.meshlets_outside;
+			visible = false;
+		}
+		else if (meshlet_is_backfacing(meshlet, camera))
+		{
+			++stats.meshlets_backfacing;
+			visible = false;
+		}
+
+		const bool continues_run = run_first != c_no_meshlet && visible &&
+			meshlet->draw_call == meshlets->meshlets[i - 1].draw_call;
+		if (run_first != c_no_meshlet && !continues_run)
+		{
+			stats.vertices_projected += draw_meshlet_run(context, model, meshlets, run_first, i - 1,
+				light_is_directional ? nullptr : &point_light, light_in_model_space, model_view_projection_matrix);
+			run_first = c_no_meshlet;
+		}
+
+		if (visible)
+		{
+			++stats.meshlets_drawn;
+			if (run_first == c_no_meshlet)
+			{
+				run_first = i;
+			}
+		}
+	}
+
+	if (run_first != c_no_meshlet)
+	{
+		stats.vertices_projected += draw_meshlet_run(context, model, meshlets, run_first, meshlets->meshlet_count - 1,
+			light_is_directional ? nullptr : &point_light, light_in_model_space, model_view_projection_matrix);
+	}
+
+	return stats;
+}
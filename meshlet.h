@@ -0,0 +1,70 @@
+#pragma once
+
+#include "graphics.h"
+
+
+// A run of up to c_max_meshlet_triangles of one draw call's triangles, using
+// up to c_max_meshlet_vertices vertices, with bounds to cull it by as a whole
+// before any of its vertices are projected.
+struct Meshlet
+{
+	Vec_3f centre;
+	float32 radius;
+	// Every triangle's normal is within the cone around the axis. Looking
+	// along the axis from far enough behind the meshlet, they all face away.
+	// A cutoff of 1 or more means the normals are too spread out to ever cull.
+	Vec_3f cone_axis;
+	float32 cone_cutoff;
+	uint32 draw_call;
+	uint32 triangle_start; // into the model's triangles, like a draw call's
+	uint32 triangle_count;
+	uint32 vertex_start; // into the meshlet mesh's vertices
+	uint32 vertex_count;
+};
+
+constexpr uint32 c_max_meshlet_vertices = 64;
+constexpr uint32 c_max_meshlet_triangles = 124;
+
+// A model's full detail level split into meshlets. Meshlets don't reorder
+// anything, each is a run of a draw call's triangles as they already are,
+// so a model drawn from its meshlets is drawn in the same order as without.
+struct Meshlet_Mesh
+{
+	Meshlet* meshlets;
+	uint32 meshlet_count;
+	// the model vertices each meshlet uses, one meshlet's after another, so
+	// vertices on the edge between meshlets are listed once for each
+	uint32* vertices;
+	uint32 vertex_count;
+};
+
+struct Meshlet_Draw_Stats
+{
+	uint32 meshlets_drawn;
+	uint32 meshlets_outside; // of the frustum
+	uint32 meshlets_backfacing;
+	uint32 vertices_projected;
+};
+
+
+// Run after model_optimize, so the meshlets are runs of the final triangle
+// order. Meshlets are ended early, once they have a few triangles, at a
+// triangle facing more than 90 degrees away from the rest, so their cones
+// stay narrow enough to cull.
+Meshlet_Mesh meshlet_mesh_create(const Model* model);
+void meshlet_mesh_destroy(Meshlet_Mesh* mesh);
+
+// project_and_draw for a model with meshlets. Meshlets outside the frustum or
+// facing away from the camera are skipped before their vertices are
+// projected, and only vertices of the meshlets left are projected into
+// context->projected_vertices (reserved for the model's vertex count here),
+// each once however many meshlets share it. The camera is needed in world
+// space to test the cones.
+Meshlet_Draw_Stats project_and_draw_meshlets(
+	Render_Context* context,
+	const Model* model,
+	const Meshlet_Mesh* meshlets,
+	Vec_4f light,
+	Vec_3f camera_position,
+	const Matrix_4x4* inverse_model_matrix,
+	const Matrix_4x4* model_view_projection_matrix);
@@ -1,5 +1,6 @@
 #include "obj_file.h"
 
+#include <cstdlib>
 #include "assert.h"
 #include "string.h"
 
@@ -356,9 +357,72 @@ Model model_obj(File obj_file, const char* containing_folder, Texture_DB* textur
 	{
 		model.vertices[i] = vertices[unique_vertices[i * 3] - 1];
 		model.texcoords[i] = texcoords[unique_vertices[(i * 3) + 1] - 1];
-		model.normals[i] = normals[unique_vertices[(i * 3) + 2] - 1];
 	}
 
+	if (normal_count > 0)
+	{
+		for (uint32 i = 0; i < unique_vertex_count; ++i)
+		{
+			model.normals[i] = normals[unique_vertices[(i * 3) + 2] - 1];
+		}
+	}
+	else
+	{
+		// no normals in the file, smooth them from the faces around each
+		// vertex, weighted by area (OBJ faces wind counter clockwise)
+		for (uint32 i = 0; i < unique_vertex_count; ++i)
+		{
+			model.normals[i] = {};
+		}
+		for (uint32 i = 0; i < triangle_count; ++i)
+		{
+			const int32* triangle = &model.triangles[i * 3];
+			const Vec_3f edge_1 = vec_3f_sub(model.vertices[triangle[1]], model.vertices[triangle[0]]);
+			const Vec_3f edge_2 = vec_3f_sub(model.vertices[triangle[2]], model.vertices[triangle[0]]);
+			const Vec_3f face_normal = vec_3f_cross(edge_1, edge_2);
+			for (int32 j = 0; j < 3; ++j)
+			{
+				model.normals[triangle[j]] = vec_3f_add(model.normals[triangle[j]], face_normal);
+			}
+		}
+		for (uint32 i = 0; i < unique_vertex_count; ++i)
+		{
+			const float32 length = float32_sqrt(vec_3f_dot(model.normals[i], model.normals[i]));
+			if (length > 0.0f)
+			{
+				model.normals[i] = vec_3f_mul(model.normals[i], 1.0f / length);
+			}
+		}
+	}
+
+	model.bounds_min = model.vertices[0];
+	model.bounds_max = model.vertices[0];
+	for (uint32 i = 1; i < unique_vertex_count; ++i)
+	{
+		model.bounds_min = vec_3f_min(model.bounds_min, model.vertices[i]);
+		model.bounds_max = vec_3f_max(model.bounds_max, model.vertices[i]);
+	}
+
+	// sort draw calls by texture so instances of different models which share
+	// textures can be batched, only a handful per model so insertion sort
+	for (uint32 i = 1; i < model.draw_call_count; ++i)
+	{
+		const Draw_Call draw_call = model.draw_calls[i];
+		int32 j = i - 1;
+		while (j >= 0 && model.draw_calls[j].texture > draw_call.texture)
+		{
+			model.draw_calls[j + 1] = model.draw_calls[j];
+			--j;
+		}
+		model.draw_calls[j + 1] = draw_call;
+	}
+
+	model.lods[0].triangles = model.triangles;
+	model.lods[0].draw_calls = model.draw_calls;
+	model.lods[0].vertex_count = model.vertex_count;
+	model.lods[0].triangle_count = triangle_count;
+	model.lod_count = 1;
+
 	delete[] vertices;
 	delete[] texcoords;
 	delete[] normals;
@@ -366,4 +430,20 @@ Model model_obj(File obj_file, const char* containing_folder, Texture_DB* textur
 	delete[] materials;
 
 	return model;
-}
\ No newline at end of file
+}
+
+void model_destroy(Model* model)
+{
+	// level 0 shares the model's own triangles and draw calls
+	for (uint32 i = 1; i < model->lod_count; ++i)
+	{
+		delete[] model->lods[i].triangles;
+		delete[] model->lods[i].draw_calls;
+	}
+	delete[] model->vertices;
+	delete[] model->texcoords;
+	delete[] model->normals;
+	delete[] model->triangles;
+	delete[] model->draw_calls;
+	*model = {};
+}
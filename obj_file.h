@@ -4,4 +4,7 @@
 #include "graphics.h"
 
 
-Model model_obj(File obj_file, const char* containing_folder, Texture_DB* texture_db);
\ No newline at end of file
+Model model_obj(File obj_file, const char* containing_folder, Texture_DB* texture_db);
+// Frees the model's arrays and any levels of detail generated for it. The
+// textures are the texture db's, and are left alone.
+void model_destroy(Model* model);
\ No newline at end of file
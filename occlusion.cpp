@@ -0,0 +1,267 @@
+#include "occlusion.h"
+
+#include "assert.h"
+
+
+// vertices closer than this (in clip space w) are treated as crossing the near plane
+static constexpr float32 c_min_w = 0.0001f;
+
+
+Occluder occluder_create(const Model* model, float32 min_triangle_area)
+{
+	uint32 triangle_count = 0;
+	for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+	{
+		triangle_count += model->draw_calls[draw_call_i].triangle_count;
+	}
+
+	Occluder occluder = {};
+	occluder.triangles = new int32[triangle_count * 3];
+
+	// model vertex index -> occluder vertex index
+	int32* remap = new int32[model->vertex_count];
+	for (uint32 i = 0; i < model->vertex_count; ++i)
+	{
+		remap[i] = -1;
+	}
+
+	for (uint32 triangle_i = 0; triangle_i < triangle_count; ++triangle_i)
+	{
+		const int32* triangle = &model->triangles[triangle_i * 3];
+		const Vec_3f edge_1 = vec_3f_sub(model->vertices[triangle[1]], model->vertices[triangle[0]]);
+		const Vec_3f edge_2 = vec_3f_sub(model->vertices[triangle[2]], model->vertices[triangle[0]]);
+		const Vec_3f cross = vec_3f_cross(edge_1, edge_2);
+		const float32 area = float32_sqrt(vec_3f_dot(cross, cross)) * 0.5f;
+		if (area < min_triangle_area)
+		{
+			continue;
+		}
+
+		for (int32 i = 0; i < 3; ++i)
+		{
+			if (remap[triangle[i]] == -1)
+			{
+				remap[triangle[i]] = occluder.vertex_count;
+				++occluder.vertex_count;
+			}
+			occluder.triangles[(occluder.triangle_count * 3) + i] = remap[triangle[i]];
+		}
+		++occluder.triangle_count;
+	}
+
+	occluder.vertices = new Vec_3f[occluder.vertex_count];
+	for (uint32 i = 0; i < model->vertex_count; ++i)
+	{
+		if (remap[i] != -1)
+		{
+			occluder.vertices[remap[i]] = model->vertices[i];
+		}
+	}
+	delete[] remap;
+
+	return occluder;
+}
+
+void occluder_destroy(Occluder* occluder)
+{
+	delete[] occluder->vertices;
+	delete[] occluder->triangles;
+	*occluder = {};
+}
+
+Occlusion_Buffer occlusion_buffer_create(int32 width, int32 height)
+{
+	assert(width > 0 && height > 0);
+
+	Occlusion_Buffer buffer = {};
+	buffer.width = width;
+	buffer.height = height;
+	buffer.depth = new float32[width * height];
+
+	return buffer;
+}
+
+void occlusion_buffer_destroy(Occlusion_Buffer* buffer)
+{
+	delete[] buffer->depth;
+	delete[] buffer->projected_vertices;
+	*buffer = {};
+}
+
+void occlusion_buffer_clear(Occlusion_Buffer* buffer)
+{
+	const int32 pixel_count = buffer->width * buffer->height;
+	for (int32 i = 0; i < pixel_count; ++i)
+	{
+		buffer->depth[i] = INFINITY;
+	}
+}
+
+// floor to a pixel index, clamped first so huge values from vertices near the
+// camera plane don't overflow the cast
+static int32 pixel_floor(float32 value, int32 size)
+{
+	return (int32)float32_floor(float32_clamp(-1.0f, (float32)size, value));
+}
+
+static Vec_4f project(const Occlusion_Buffer* buffer, const Matrix_4x4* matrix, Vec_3f v)
+{
+	// same mapping as graphics_project_vertices, w is kept to spot vertices
+	// behind the near plane
+	Vec_4f projected = matrix_4x4_mul_vec4(matrix, v);
+	const float32 inverse_w = 1.0f / projected.w;
+	projected.x = ((projected.x * inverse_w) + 1.0f) * 0.5f * buffer->width;
+	projected.y = ((projected.y * inverse_w) - 1.0f) * -0.5f * buffer->height;
+	projected.z *= inverse_w;
+	return projected;
+}
+
+uint32 occlusion_buffer_draw(Occlusion_Buffer* buffer, const Occluder* occluder, const Matrix_4x4* model_view_projection_matrix)
+{
+	if (buffer->projected_vertex_capacity < occluder->vertex_count)
+	{
+		delete[] buffer->projected_vertices;
+		buffer->projected_vertices = new Vec_4f[occluder->vertex_count];
+		buffer->projected_vertex_capacity = occluder->vertex_count;
+	}
+
+	for (uint32 i = 0; i < occluder->vertex_count; ++i)
+	{
+		buffer->projected_vertices[i] = project(buffer, model_view_projection_matrix, occluder->vertices[i]);
+	}
+
+	uint32 triangles_drawn = 0;
+	for (uint32 triangle_i = 0; triangle_i < occluder->triangle_count; ++triangle_i)
+	{
+		const Vec_4f p0 = buffer->projected_vertices[occluder->triangles[triangle_i * 3]];
+		const Vec_4f p1 = buffer->projected_vertices[occluder->triangles[(triangle_i * 3) + 1]];
+		const Vec_4f p2 = buffer->projected_vertices[occluder->triangles[(triangle_i * 3) + 2]];
+		if (p0.w < c_min_w || p1.w < c_min_w || p2.w < c_min_w)
+		{
+			continue;
+		}
+
+		// edge functions a * x + b * y + c, flipped so the inside is positive
+		// whichever way the triangle winds
+		float32 area = ((p1.x - p0.x) * (p2.y - p0.y)) - ((p1.y - p0.y) * (p2.x - p0.x));
+		if (area == 0.0f)
+		{
+			continue;
+		}
+		const float32 sign = area > 0.0f ? 1.0f : -1.0f;
+		const Vec_4f* edge_start[3] = { &p0, &p1, &p2 };
+		const Vec_4f* edge_end[3] = { &p1, &p2, &p0 };
+		float32 a[3], b[3], c[3];
+		for (int32 i = 0; i < 3; ++i)
+		{
+			a[i] = (edge_start[i]->y - edge_end[i]->y) * sign;
+			b[i] = (edge_end[i]->x - edge_start[i]->x) * sign;
+			c[i] = ((edge_start[i]->x * edge_end[i]->y) - (edge_end[i]->x * edge_start[i]->y)) * sign;
+
+			// Pulled in by half a pixel, so testing at a pixel's centre passes
+			// only if the triangle covers all of the pixel. Something seen
+			// through a gap narrower than a pixel, between two occluders or
+			// along an edge two of their triangles share, stays visible.
+			c[i] -= 0.5f * (float32_abs(a[i]) + float32_abs(b[i]));
+		}
+
+		// only pixels the triangle touches can be covered by it
+		const int32 min_x = int32_max(pixel_floor(float32_min(p0.x, float32_min(p1.x, p2.x)), buffer->width), 0);
+		const int32 max_x = int32_min(pixel_floor(float32_max(p0.x, float32_max(p1.x, p2.x)), buffer->width), buffer->width - 1);
+		const int32 min_y = int32_max(pixel_floor(float32_min(p0.y, float32_min(p1.y, p2.y)), buffer->height), 0);
+		const int32 max_y = int32_min(pixel_floor(float32_max(p0.y, float32_max(p1.y, p2.y)), buffer->height), buffer->height - 1);
+		if (min_x > max_x || min_y > max_y)
+		{
+			continue;
+		}
+
+		// depth varies across the triangle, taking the farthest of its
+		// vertices for all of it means occluders can only ever be drawn
+		// further away than they really are
+		const float32 depth = float32_max(p0.z, float32_max(p1.z, p2.z));
+
+		for (int32 y = min_y; y <= max_y; ++y)
+		{
+			const float32 centre_y = y + 0.5f;
+			const float32 row_0 = (b[0] * centre_y) + c[0];
+			const float32 row_1 = (b[1] * centre_y) + c[1];
+			const float32 row_2 = (b[2] * centre_y) + c[2];
+			float32* row = &buffer->depth[y * buffer->width];
+
+			// no branches in here, so it vectorises to a compare and blend per lane
+			for (int32 x = min_x; x <= max_x; ++x)
+			{
+				const float32 centre_x = x + 0.5f;
+				const bool inside = ((a[0] * centre_x) + row_0) >= 0.0f &&
+					((a[1] * centre_x) + row_1) >= 0.0f &&
+					((a[2] * centre_x) + row_2) >= 0.0f;
+				const float32 nearest = float32_min(row[x], depth);
+				row[x] = inside ? nearest : row[x];
+			}
+		}
+
+		++triangles_drawn;
+	}
+
+	return triangles_drawn;
+}
+
+bool occlusion_buffer_project_aabb(const Occlusion_Buffer* buffer, const Matrix_4x4* view_projection_matrix, Vec_3f min, Vec_3f max, Occlusion_Rect* out_rect)
+{
+	float32 min_x = INFINITY;
+	float32 min_y = INFINITY;
+	float32 max_x = -INFINITY;
+	float32 max_y = -INFINITY;
+	float32 min_depth = INFINITY;
+	for (int32 corner_i = 0; corner_i < 8; ++corner_i)
+	{
+		const Vec_3f corner = {
+			corner_i & 1 ? max.x : min.x,
+			corner_i & 2 ? max.y : min.y,
+			corner_i & 4 ? max.z : min.z
+		};
+		const Vec_4f projected = project(buffer, view_projection_matrix, corner);
+		if (projected.w < c_min_w)
+		{
+			return false;
+		}
+
+		min_x = float32_min(min_x, projected.x);
+		min_y = float32_min(min_y, projected.y);
+		max_x = float32_max(max_x, projected.x);
+		max_y = float32_max(max_y, projected.y);
+		min_depth = float32_min(min_depth, projected.z);
+	}
+
+	// every pixel the box touches, occluders only count as covering pixels
+	// they cover all of
+	out_rect->min_x = int32_max(pixel_floor(min_x, buffer->width), 0);
+	out_rect->min_y = int32_max(pixel_floor(min_y, buffer->height), 0);
+	out_rect->max_x = int32_min(pixel_floor(max_x, buffer->width), buffer->width - 1);
+	out_rect->max_y = int32_min(pixel_floor(max_y, buffer->height), buffer->height - 1);
+	out_rect->min_depth = min_depth;
+
+	return true;
+}
+
+bool occlusion_buffer_test(const Occlusion_Buffer* buffer, const Occlusion_Rect* rect)
+{
+	for (int32 y = rect->min_y; y <= rect->max_y; ++y)
+	{
+		const float32* row = &buffer->depth[y * buffer->width];
+
+		// or together the whole row rather than exiting early, so it vectorises
+		uint32 visible = 0;
+		for (int32 x = rect->min_x; x <= rect->max_x; ++x)
+		{
+			visible |= row[x] >= rect->min_depth;
+		}
+
+		if (visible)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
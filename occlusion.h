@@ -0,0 +1,57 @@
+#pragma once
+
+#include "graphics.h"
+
+
+// Simplified stand in for a model when drawing occluders, in model space. It
+// must never cover anything the model doesn't, so it's built from a subset of
+// the model's own triangles.
+struct Occluder
+{
+	Vec_3f* vertices;
+	int32* triangles;
+	uint32 vertex_count;
+	uint32 triangle_count;
+};
+
+// Small depth only buffer occluders are drawn into, and instance bounds
+// tested against. It covers the same view as the render target, just at much
+// lower resolution. Occluder triangles are written at their farthest depth, so
+// the buffer never claims anything is closer than it is.
+struct Occlusion_Buffer
+{
+	int32 width;
+	int32 height;
+	float32* depth;
+
+	Vec_4f* projected_vertices;
+	uint32 projected_vertex_capacity;
+};
+
+// pixels of the occlusion buffer some bounds cover, and their nearest depth
+struct Occlusion_Rect
+{
+	int32 min_x;
+	int32 min_y;
+	int32 max_x;
+	int32 max_y;
+	float32 min_depth;
+};
+
+
+// keeps the model's triangles with at least min_triangle_area, the small
+// detail ones aren't worth drawing, the triangle count can be 0
+Occluder occluder_create(const Model* model, float32 min_triangle_area);
+void occluder_destroy(Occluder* occluder);
+
+Occlusion_Buffer occlusion_buffer_create(int32 width, int32 height);
+void occlusion_buffer_destroy(Occlusion_Buffer* buffer);
+void occlusion_buffer_clear(Occlusion_Buffer* buffer);
+// returns the number of triangles drawn, triangles crossing the near plane are
+// skipped. Only pixels a triangle covers all of are drawn to.
+uint32 occlusion_buffer_draw(Occlusion_Buffer* buffer, const Occluder* occluder, const Matrix_4x4* model_view_projection_matrix);
+// false if the box crosses the near plane, in which case it should be treated
+// as visible, otherwise out_rect is the pixels it touches
+bool occlusion_buffer_project_aabb(const Occlusion_Buffer* buffer, const Matrix_4x4* view_projection_matrix, Vec_3f min, Vec_3f max, Occlusion_Rect* out_rect);
+// true if anything in the rect could be in front of the occluders drawn so far
+bool occlusion_buffer_test(const Occlusion_Buffer* buffer, const Occlusion_Rect* rect);
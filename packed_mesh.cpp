@@ -0,0 +1,143 @@
+#include "packed_mesh.h"
+
+#include <cstring>
+#include "assert.h"
+
+
+static constexpr float32 c_max_quantised = 65535.0f;
+
+
+static uint16 quantise(float32 value, float32 min, float32 range)
+{
+	if (range <= 0.0f)
+	{
+		return 0;
+	}
+	return (uint16)float32_clamp(0.0f, c_max_quantised, float32_floor((((value - min) / range) * c_max_quantised) + 0.5f));
+}
+
+static int8 quantise_snorm8(float32 value)
+{
+	return (int8)float32_clamp(-127.0f, 127.0f, float32_floor((value * 127.0f) + 0.5f));
+}
+
+static void packed_normal_encode(Vec_3f normal, int8 out_packed[2])
+{
+	// project onto the octahedron |x| + |y| + |z| = 1, then fold the lower
+	// half out into the corners of the square
+	const float32 sum = float32_abs(normal.x) + float32_abs(normal.y) + float32_abs(normal.z);
+	if (sum <= 0.0f)
+	{
+		out_packed[0] = 0;
+		out_packed[1] = 0;
+		return;
+	}
+
+	float32 x = normal.x / sum;
+	float32 y = normal.y / sum;
+	if (normal.z < 0.0f)
+	{
+		const float32 folded_x = (1.0f - float32_abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		const float32 folded_y = (1.0f - float32_abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = folded_x;
+		y = folded_y;
+	}
+
+	out_packed[0] = quantise_snorm8(x);
+	out_packed[1] = quantise_snorm8(y);
+}
+
+Packed_Mesh packed_mesh_create(const Model* model)
+{
+	Packed_Mesh mesh = {};
+	mesh.vertex_count = model->vertex_count;
+	mesh.vertices = new Packed_Vertex[model->vertex_count];
+
+	Vec_2f texcoord_min = model->vertex_count ? model->texcoords[0] : Vec_2f{};
+	Vec_2f texcoord_max = texcoord_min;
+	for (uint32 i = 1; i < model->vertex_count; ++i)
+	{
+		texcoord_min.x = float32_min(texcoord_min.x, model->texcoords[i].x);
+		texcoord_min.y = float32_min(texcoord_min.y, model->texcoords[i].y);
+		texcoord_max.x = float32_max(texcoord_max.x, model->texcoords[i].x);
+		texcoord_max.y = float32_max(texcoord_max.y, model->texcoords[i].y);
+	}
+
+	const Vec_3f position_range = vec_3f_sub(model->bounds_max, model->bounds_min);
+	const Vec_2f texcoord_range = { texcoord_max.x - texcoord_min.x, texcoord_max.y - texcoord_min.y };
+	mesh.position_min = model->bounds_min;
+	mesh.position_scale = vec_3f_mul(position_range, 1.0f / c_max_quantised);
+	mesh.texcoord_min = texcoord_min;
+	mesh.texcoord_scale = { texcoord_range.x / c_max_quantised, texcoord_range.y / c_max_quantised };
+
+	for (uint32 i = 0; i < model->vertex_count; ++i)
+	{
+		Packed_Vertex* vertex = &mesh.vertices[i];
+		const Vec_3f position = model->vertices[i];
+		vertex->position[0] = quantise(position.x, model->bounds_min.x, position_range.x);
+		vertex->position[1] = quantise(position.y, model->bounds_min.y, position_range.y);
+		vertex->position[2] = quantise(position.z, model->bounds_min.z, position_range.z);
+		packed_normal_encode(model->normals[i], vertex->normal);
+		vertex->texcoord[0] = quantise(model->texcoords[i].x, texcoord_min.x, texcoord_range.x);
+		vertex->texcoord[1] = quantise(model->texcoords[i].y, texcoord_min.y, texcoord_range.y);
+	}
+
+	for (uint32 lod_i = 0; lod_i < model->lod_count; ++lod_i)
+	{
+		mesh.lod_triangle_starts[lod_i] = mesh.triangle_count;
+		mesh.triangle_count += model->lods[lod_i].triangle_count;
+	}
+
+	const uint32 index_count = mesh.triangle_count * 3;
+	if (model->vertex_count <= 65536)
+	{
+		mesh.triangles_16 = new uint16[index_count];
+	}
+	else
+	{
+		mesh.triangles_32 = new int32[index_count];
+	}
+
+	for (uint32 lod_i = 0; lod_i < model->lod_count; ++lod_i)
+	{
+		const Model_Lod* lod = &model->lods[lod_i];
+		const uint32 start = mesh.lod_triangle_starts[lod_i] * 3;
+		if (mesh.triangles_16)
+		{
+			for (uint32 i = 0; i < lod->triangle_count * 3; ++i)
+			{
+				mesh.triangles_16[start + i] = (uint16)lod->triangles[i];
+			}
+		}
+		else
+		{
+			memcpy(&mesh.triangles_32[start], lod->triangles, lod->triangle_count * 3 * sizeof(int32));
+		}
+	}
+
+	return mesh;
+}
+
+void packed_mesh_destroy(Packed_Mesh* mesh)
+{
+	delete[] mesh->vertices;
+	delete[] mesh->triangles_16;
+	delete[] mesh->triangles_32;
+	*mesh = {};
+}
+
+uint32 packed_mesh_size(const Packed_Mesh* mesh)
+{
+	const uint32 index_size = mesh->triangles_16 ? sizeof(uint16) : sizeof(int32);
+	return (mesh->vertex_count * sizeof(Packed_Vertex)) + (mesh->triangle_count * 3 * index_size);
+}
+
+uint32 model_mesh_size(const Model* model)
+{
+	uint32 size = model->vertex_count * (sizeof(Vec_3f) + sizeof(Vec_2f) + sizeof(Vec_3f));
+	for (uint32 lod_i = 0; lod_i < model->lod_count; ++lod_i)
+	{
+		size += model->lods[lod_i].triangle_count * 3 * sizeof(int32);
+	}
+	return size;
+}
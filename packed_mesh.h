@@ -0,0 +1,61 @@
+#pragma once
+
+#include "graphics.h"
+
+
+// 12 bytes rather than the 32 of a model's separate float arrays. Positions
+// are quantised between the model's bounds, texcoords between the smallest
+// and biggest the model uses, and normals are octahedral (the unit sphere
+// folded flat onto a square).
+struct Packed_Vertex
+{
+	uint16 position[3];
+	int8 normal[2];
+	uint16 texcoord[2];
+};
+
+// A compact copy of a model's vertices and every level of detail's triangles,
+// to draw from instead of the model's arrays. Indices are 16 bit when there
+// are few enough vertices. Draw calls are still the model's, with each level's
+// triangles starting at lod_triangle_starts.
+struct Packed_Mesh
+{
+	Packed_Vertex* vertices;
+	uint32 vertex_count;
+
+	uint16* triangles_16;
+	int32* triangles_32; // only if there are too many vertices for 16 bit
+	uint32 lod_triangle_starts[c_max_model_lods];
+	uint32 triangle_count;
+
+	// unpacked = min + (packed * scale)
+	Vec_3f position_min;
+	Vec_3f position_scale;
+	Vec_2f texcoord_min;
+	Vec_2f texcoord_scale;
+};
+
+
+Packed_Mesh packed_mesh_create(const Model* model);
+void packed_mesh_destroy(Packed_Mesh* mesh);
+// bytes used by the vertices and triangles
+uint32 packed_mesh_size(const Packed_Mesh* mesh);
+// bytes used by the model's own vertex and triangle arrays, for comparison
+uint32 model_mesh_size(const Model* model);
+
+inline Vec_3f packed_normal_decode(const int8 packed[2])
+{
+	// unfold the lower half of the octahedron back out from the corners
+	const float32 x = packed[0] * (1.0f / 127.0f);
+	const float32 y = packed[1] * (1.0f / 127.0f);
+	const float32 z = 1.0f - float32_abs(x) - float32_abs(y);
+	Vec_3f normal = { x, y, z };
+	if (z < 0.0f)
+	{
+		normal.x = (1.0f - float32_abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		normal.y = (1.0f - float32_abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	const float32 length = float32_sqrt(vec_3f_dot(normal, normal));
+	return vec_3f_mul(normal, 1.0f / length);
+}
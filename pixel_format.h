@@ -0,0 +1,99 @@
+#pragma once
+
+#include "types.h"
+
+
+// Formats a render target's frame can be stored in. All of them can be handed
+// straight to a DIB.
+enum class Pixel_Format
+{
+	BGR888, // packed 24 bit, 3 byte stores
+	BGRX8888, // 32 bit, one aligned store per pixel, vector friendly
+	RGB555 // 16 bit 0RRRRRGGGGGBBBBB with ordered dither, like the ps1 framebuffer
+};
+
+// Per format pixel access. The rasteriser and upscaler are templated on these
+// so the inner loops compile to the right stores with no per pixel branching.
+// x and y are only used for dithering.
+struct Pixel_BGR888
+{
+	static constexpr Pixel_Format c_format = Pixel_Format::BGR888;
+	static constexpr int32 c_bytes = 3;
+
+	static void write(uint8* row, int32 x, int32, uint32 b, uint32 g, uint32 r)
+	{
+		uint8* pixel = row + (x * 3);
+		pixel[0] = (uint8)b;
+		pixel[1] = (uint8)g;
+		pixel[2] = (uint8)r;
+	}
+
+	static void read(const uint8* row, int32 x, uint32* b, uint32* g, uint32* r)
+	{
+		const uint8* pixel = row + (x * 3);
+		*b = pixel[0];
+		*g = pixel[1];
+		*r = pixel[2];
+	}
+};
+
+struct Pixel_BGRX8888
+{
+	static constexpr Pixel_Format c_format = Pixel_Format::BGRX8888;
+	static constexpr int32 c_bytes = 4;
+
+	static void write(uint8* row, int32 x, int32, uint32 b, uint32 g, uint32 r)
+	{
+		((uint32*)row)[x] = b | (g << 8) | (r << 16);
+	}
+
+	static void read(const uint8* row, int32 x, uint32* b, uint32* g, uint32* r)
+	{
+		const uint32 pixel = ((const uint32*)row)[x];
+		*b = pixel & 0xff;
+		*g = (pixel >> 8) & 0xff;
+		*r = (pixel >> 16) & 0xff;
+	}
+};
+
+struct Pixel_RGB555
+{
+	static constexpr Pixel_Format c_format = Pixel_Format::RGB555;
+	static constexpr int32 c_bytes = 2;
+
+	static uint32 quantise(uint32 value, int32 x, int32 y)
+	{
+		// 4x4 bayer matrix scaled to the 3 bits we throw away
+		static constexpr uint8 c_dither[4][4] = {
+			{ 0, 4, 1, 5 },
+			{ 6, 2, 7, 3 },
+			{ 1, 5, 0, 4 },
+			{ 7, 3, 6, 2 }
+		};
+		const uint32 dithered = (value + c_dither[y & 3][x & 3]) >> 3;
+		return dithered > 31 ? 31 : dithered;
+	}
+
+	static void write(uint8* row, int32 x, int32 y, uint32 b, uint32 g, uint32 r)
+	{
+		((uint16*)row)[x] = (uint16)(quantise(b, x, y) | (quantise(g, x, y) << 5) | (quantise(r, x, y) << 10));
+	}
+
+	static void read(const uint8* row, int32 x, uint32* b, uint32* g, uint32* r)
+	{
+		// replicate the top bits into the bottom so 31 comes back as 255
+		const uint32 pixel = ((const uint16*)row)[x];
+		const uint32 b5 = pixel & 0x1f;
+		const uint32 g5 = (pixel >> 5) & 0x1f;
+		const uint32 r5 = (pixel >> 10) & 0x1f;
+		*b = (b5 << 3) | (b5 >> 2);
+		*g = (g5 << 3) | (g5 >> 2);
+		*r = (r5 << 3) | (r5 >> 2);
+	}
+};
+
+constexpr int32 pixel_format_bytes(Pixel_Format format)
+{
+	return format == Pixel_Format::BGR888 ? Pixel_BGR888::c_bytes :
+		(format == Pixel_Format::BGRX8888 ? Pixel_BGRX8888::c_bytes : Pixel_RGB555::c_bytes);
+}
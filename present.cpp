@@ -0,0 +1,190 @@
+#include "present.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "assert.h"
+#include "maths.h"
+
+
+static constexpr int32 c_max_present_buffers = 4;
+
+struct Present_Queue
+{
+	Presenter presenter;
+	Upscale_Filter filter;
+	int32 buffer_count;
+	Render_Target buffers[c_max_present_buffers];
+	Render_Target output; // upscale destination when a frame was rendered small
+	std::chrono::steady_clock::time_point submit_time[c_max_present_buffers];
+
+	// free buffers are a stack, submitted buffers are a fifo ring
+	Render_Target* free_buffers[c_max_present_buffers];
+	int32 free_count;
+	Render_Target* submitted[c_max_present_buffers];
+	int32 submitted_head;
+	int32 submitted_count;
+	bool quit;
+
+	std::mutex mutex;
+	std::condition_variable buffer_freed;
+	std::condition_variable buffer_submitted;
+	std::thread thread;
+
+	Present_Stats stats;
+};
+
+
+static int32 buffer_index(const Present_Queue* queue, const Render_Target* target)
+{
+	const int32 index = (int32)(target - queue->buffers);
+	assert(index >= 0 && index < queue->buffer_count);
+	return index;
+}
+
+static void present_thread(Present_Queue* queue)
+{
+	constexpr float32 c_stats_smoothing = 0.1f;
+
+	while (true)
+	{
+		Render_Target* target;
+		{
+			std::unique_lock<std::mutex> lock(queue->mutex);
+			queue->buffer_submitted.wait(lock, [queue] { return queue->submitted_count > 0 || queue->quit; });
+			if (queue->submitted_count == 0)
+			{
+				// only quit once everything submitted has been presented
+				return;
+			}
+			target = queue->submitted[queue->submitted_head];
+		}
+
+		const auto present_start = std::chrono::steady_clock::now();
+
+		const Render_Target* to_present = target;
+		if (target->width != queue->output.width || target->height != queue->output.height)
+		{
+			render_target_upscale(target, &queue->output, queue->filter);
+			to_present = &queue->output;
+		}
+		queue->presenter.present(queue->presenter.user_data, to_present);
+
+		const auto present_end = std::chrono::steady_clock::now();
+
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->submitted_head = (queue->submitted_head + 1) % c_max_present_buffers;
+		--queue->submitted_count;
+		queue->free_buffers[queue->free_count] = target;
+		++queue->free_count;
+
+		Present_Stats* stats = &queue->stats;
+		const float32 present_s = std::chrono::duration<float32>(present_end - present_start).count();
+		const float32 latency_s = std::chrono::duration<float32>(present_end - queue->submit_time[buffer_index(queue, target)]).count();
+		if (stats->frames_presented == 0)
+		{
+			stats->average_present_s = present_s;
+			stats->average_latency_s = latency_s;
+		}
+		else
+		{
+			stats->average_present_s = float32_lerp(stats->average_present_s, present_s, c_stats_smoothing);
+			stats->average_latency_s = float32_lerp(stats->average_latency_s, latency_s, c_stats_smoothing);
+		}
+		stats->last_latency_s = latency_s;
+		++stats->frames_presented;
+		stats->queue_depth = queue->submitted_count;
+
+		queue->buffer_freed.notify_one();
+	}
+}
+
+Present_Queue* present_queue_create(Presenter presenter, int32 buffer_count, int32 width, int32 height, Pixel_Format format, Upscale_Filter filter)
+{
+	// need at least two, otherwise rendering can never overlap present
+	assert(buffer_count >= 2 && buffer_count <= c_max_present_buffers);
+	assert(presenter.present);
+
+	Present_Queue* queue = new Present_Queue();
+	queue->presenter = presenter;
+	queue->filter = filter;
+	queue->buffer_count = buffer_count;
+	for (int32 i = 0; i < buffer_count; ++i)
+	{
+		queue->buffers[i] = render_target_create(width, height, format);
+		queue->free_buffers[i] = &queue->buffers[i];
+	}
+	queue->free_count = buffer_count;
+	queue->output = render_target_create(width, height, format);
+
+	queue->thread = std::thread(present_thread, queue);
+
+	return queue;
+}
+
+void present_queue_destroy(Present_Queue* queue)
+{
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->quit = true;
+	}
+	queue->buffer_submitted.notify_one();
+	queue->thread.join();
+
+	for (int32 i = 0; i < queue->buffer_count; ++i)
+	{
+		render_target_destroy(&queue->buffers[i]);
+	}
+	render_target_destroy(&queue->output);
+
+	delete queue;
+}
+
+Render_Target* present_queue_acquire(Present_Queue* queue)
+{
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	if (queue->free_count == 0)
+	{
+		++queue->stats.acquire_waits;
+		queue->buffer_freed.wait(lock, [queue] { return queue->free_count > 0; });
+	}
+
+	--queue->free_count;
+	return queue->free_buffers[queue->free_count];
+}
+
+void present_queue_submit(Present_Queue* queue, Render_Target* target)
+{
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		assert(queue->submitted_count < queue->buffer_count);
+
+		queue->submit_time[buffer_index(queue, target)] = std::chrono::steady_clock::now();
+		queue->submitted[(queue->submitted_head + queue->submitted_count) % c_max_present_buffers] = target;
+		++queue->submitted_count;
+
+		Present_Stats* stats = &queue->stats;
+		++stats->frames_submitted;
+		stats->queue_depth = queue->submitted_count;
+		stats->max_queue_depth = int32_max(stats->max_queue_depth, queue->submitted_count);
+	}
+	queue->buffer_submitted.notify_one();
+}
+
+Present_Stats present_queue_stats(Present_Queue* queue)
+{
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	return queue->stats;
+}
+
+static void present_nothing(void*, const Render_Target*)
+{
+}
+
+Presenter presenter_headless()
+{
+	Presenter presenter = {};
+	presenter.present = present_nothing;
+	return presenter;
+}
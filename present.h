@@ -0,0 +1,46 @@
+#pragma once
+
+#include "graphics.h"
+
+
+// A presenter hands a finished frame to the platform. It's always called from
+// the present thread, never the render thread.
+typedef void (*Present_Func)(void* user_data, const Render_Target* target);
+
+struct Presenter
+{
+	Present_Func present;
+	void* user_data;
+};
+
+struct Present_Stats
+{
+	uint64 frames_submitted;
+	uint64 frames_presented;
+	uint64 acquire_waits; // times the render thread had to wait for a free buffer
+	int32 queue_depth; // frames submitted but not yet presented
+	int32 max_queue_depth;
+	float32 last_latency_s; // submit to present returning
+	float32 average_latency_s;
+	float32 average_present_s; // time spent in the presenter (and upscale)
+};
+
+// Owns buffer_count render targets and a thread which presents them. The
+// render thread acquires a free target, renders into it (at any size up to
+// width x height) and submits it, then can start on the next frame while the
+// present thread upscales the submitted one to width x height if needed and
+// hands it to the presenter. Frames are presented in submission order.
+struct Present_Queue;
+
+
+Present_Queue* present_queue_create(Presenter presenter, int32 buffer_count, int32 width, int32 height, Pixel_Format format, Upscale_Filter filter);
+// presents anything still queued, then stops the thread
+void present_queue_destroy(Present_Queue* queue);
+// blocks until a buffer is free, so the render thread can't get more than
+// buffer_count - 1 frames ahead of present
+Render_Target* present_queue_acquire(Present_Queue* queue);
+void present_queue_submit(Present_Queue* queue, Render_Target* target);
+Present_Stats present_queue_stats(Present_Queue* queue);
+
+// throws frames away, for running without a window (tests, benchmarks, linux)
+Presenter presenter_headless();
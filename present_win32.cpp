@@ -0,0 +1,41 @@
+#include "present_win32.h"
+
+
+static void present_to_window(void* user_data, const Render_Target* target)
+{
+	HWND window = (HWND)user_data;
+	HDC dc = GetDC(window);
+
+	BITMAPINFO bitmap_info = {};
+	bitmap_info.bmiHeader.biSize = sizeof(bitmap_info.bmiHeader);
+	bitmap_info.bmiHeader.biWidth = target->width;
+	bitmap_info.bmiHeader.biHeight = target->height;
+	bitmap_info.bmiHeader.biPlanes = 1;
+	// BI_RGB covers all our formats, 16 bit BI_RGB is 5-5-5 and the top byte
+	// of 32 bit is ignored
+	bitmap_info.bmiHeader.biBitCount = (WORD)(pixel_format_bytes(target->format) * 8);
+	bitmap_info.bmiHeader.biCompression = BI_RGB;
+
+	// TODO measure this, bitblt might be faster, also could draw this with directdraw or something if it takes up too much of the frame
+	SetDIBitsToDevice(
+		dc,
+		0, 0,
+		target->width, target->height,
+		0, 0,
+		0,
+		target->height,
+		target->frame,
+		&bitmap_info,
+		DIB_RGB_COLORS
+	);
+
+	ReleaseDC(window, dc);
+}
+
+Presenter presenter_window(HWND window)
+{
+	Presenter presenter = {};
+	presenter.present = present_to_window;
+	presenter.user_data = window;
+	return presenter;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include "present.h"
+
+
+// draws frames into the client area of window with SetDIBitsToDevice
+Presenter presenter_window(HWND window);
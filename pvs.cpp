@@ -0,0 +1,289 @@
+#include "pvs.h"
+
+#include <cstring>
+#include "assert.h"
+#include "file.h"
+
+
+static constexpr uint32 c_pvs_file_magic = 'P' | ('V' << 8) | ('S' << 16) | ('1' << 24);
+
+struct Pvs_File_Header
+{
+	uint32 magic;
+	Vec_3f origin;
+	float32 cell_size;
+	int32 cells_x;
+	int32 cells_y;
+	float32 max_z;
+	uint32 instance_count;
+	uint32 words_per_cell;
+};
+
+struct Cube_Face
+{
+	Vec_3f forward;
+	Vec_3f up;
+};
+
+static constexpr Cube_Face c_cube_faces[6] = {
+	{ { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { -1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f } },
+	{ { 0.0f, 0.0f, -1.0f }, { 0.0f, 1.0f, 0.0f } }
+};
+
+
+static void set_bit(uint32* bits, uint32 index)
+{
+	bits[index / 32] |= 1u << (index % 32);
+}
+
+static bool is_inside_occluder(const Scene* scene, Vec_3f position, uint32* scratch)
+{
+	const uint32 count = scene_query_aabb(scene, position, position, scratch, scene->instance_count);
+	for (uint32 i = 0; i < count; ++i)
+	{
+		if (scene->instances[scratch[i]].model->occluder)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+Pvs pvs_bake(Scene* scene, const Pvs_Bake_Settings* settings)
+{
+	assert(settings->cells_x > 0 && settings->cells_y > 0);
+	assert(settings->samples_per_cell > 0 && settings->height_samples > 0);
+
+	Pvs pvs = {};
+	pvs.origin = settings->origin;
+	pvs.cell_size = settings->cell_size;
+	pvs.cells_x = settings->cells_x;
+	pvs.cells_y = settings->cells_y;
+	pvs.max_z = settings->max_z;
+	pvs.instance_count = scene->instance_count;
+	pvs.words_per_cell = (scene->instance_count + 31) / 32;
+	const uint32 cell_count = pvs.cells_x * pvs.cells_y;
+	pvs.visible = new uint32[cell_count * pvs.words_per_cell];
+	memset(pvs.visible, 0, cell_count * pvs.words_per_cell * sizeof(uint32));
+
+	Render_Target target = render_target_create(settings->resolution, settings->resolution, Pixel_Format::BGRX8888);
+	render_target_enable_draw_ids(&target);
+	Render_Context context = render_context_create(settings->resolution);
+	render_context_set_target(&context, &target);
+	// only the draw ids are read back, so there's no point texturing or lighting
+	context.pipeline.untextured = true;
+	context.pipeline.unlit = true;
+	Occlusion_Buffer occlusion = occlusion_buffer_create(settings->resolution, settings->resolution);
+
+	Matrix_4x4 projection_matrix;
+	matrix_4x4_projection(&projection_matrix, 90.0f * c_deg_to_rad, 1.0f, settings->near_plane, settings->far_plane);
+
+	Scene_View view = {};
+	view.occlusion = &occlusion;
+
+	uint32* point_visible = new uint32[pvs.words_per_cell];
+	uint32* nearby = new uint32[pvs.instance_count];
+	const int32 samples = settings->samples_per_cell;
+	const float32 sample_spacing = settings->cell_size / samples;
+	const int32 points_x = (pvs.cells_x * samples) + 1;
+	const int32 points_y = (pvs.cells_y * samples) + 1;
+	for (int32 point_y = 0; point_y < points_y; ++point_y)
+	{
+		for (int32 point_x = 0; point_x < points_x; ++point_x)
+		{
+			memset(point_visible, 0, pvs.words_per_cell * sizeof(uint32));
+
+			for (int32 height_i = 0; height_i < settings->height_samples; ++height_i)
+			{
+				const float32 height_t = settings->height_samples > 1 ? height_i / (float32)(settings->height_samples - 1) : 0.0f;
+				const Vec_3f position = {
+					pvs.origin.x + (point_x * sample_spacing),
+					pvs.origin.y + (point_y * sample_spacing),
+					float32_lerp(pvs.origin.z, pvs.max_z, height_t)
+				};
+
+				// the camera can't be inside anything solid, and rendering
+				// from there is slow as everything is right up against the
+				// near plane
+				if (is_inside_occluder(scene, position, nearby))
+				{
+					continue;
+				}
+
+				for (int32 face_i = 0; face_i < 6; ++face_i)
+				{
+					const Cube_Face* face = &c_cube_faces[face_i];
+					Matrix_4x4 view_matrix;
+					matrix_4x4_camera(&view_matrix, position, face->forward, face->up, vec_3f_cross(face->forward, face->up));
+					matrix_4x4_mul(&view.view_projection_matrix, &projection_matrix, &view_matrix);
+
+					graphics_clear(&context);
+					scene_draw(&context, scene, &view, { 0.0f, 0.0f, -1.0f, 0.0f });
+
+					const int32 pixel_count = target.width * target.height;
+					for (int32 i = 0; i < pixel_count; ++i)
+					{
+						if (target.draw_ids[i] != c_no_draw_id)
+						{
+							set_bit(point_visible, target.draw_ids[i]);
+						}
+					}
+				}
+			}
+
+			// points on cell edges are shared by all the cells they touch
+			const int32 cell_min_x = int32_max((point_x - 1) / samples, 0);
+			const int32 cell_max_x = int32_min(point_x / samples, pvs.cells_x - 1);
+			const int32 cell_min_y = int32_max((point_y - 1) / samples, 0);
+			const int32 cell_max_y = int32_min(point_y / samples, pvs.cells_y - 1);
+			for (int32 cell_y = cell_min_y; cell_y <= cell_max_y; ++cell_y)
+			{
+				for (int32 cell_x = cell_min_x; cell_x <= cell_max_x; ++cell_x)
+				{
+					uint32* cell_visible = &pvs.visible[((cell_y * pvs.cells_x) + cell_x) * pvs.words_per_cell];
+					for (uint32 word_i = 0; word_i < pvs.words_per_cell; ++word_i)
+					{
+						cell_visible[word_i] |= point_visible[word_i];
+					}
+				}
+			}
+		}
+	}
+
+	// Anything right next to a cell can be too close to the camera for the
+	// renders to have drawn it (the rasteriser skips triangles with no vertex
+	// on screen), so it's always included.
+	for (int32 cell_y = 0; cell_y < pvs.cells_y; ++cell_y)
+	{
+		for (int32 cell_x = 0; cell_x < pvs.cells_x; ++cell_x)
+		{
+			const Vec_3f cell_min = {
+				pvs.origin.x + ((cell_x - 1) * pvs.cell_size),
+				pvs.origin.y + ((cell_y - 1) * pvs.cell_size),
+				pvs.origin.z
+			};
+			const Vec_3f cell_max = {
+				pvs.origin.x + ((cell_x + 2) * pvs.cell_size),
+				pvs.origin.y + ((cell_y + 2) * pvs.cell_size),
+				pvs.max_z
+			};
+			const uint32 nearby_count = scene_query_aabb(scene, cell_min, cell_max, nearby, pvs.instance_count);
+			uint32* cell_visible = &pvs.visible[((cell_y * pvs.cells_x) + cell_x) * pvs.words_per_cell];
+			for (uint32 i = 0; i < nearby_count; ++i)
+			{
+				set_bit(cell_visible, nearby[i]);
+			}
+		}
+	}
+
+	delete[] nearby;
+	delete[] point_visible;
+	occlusion_buffer_destroy(&occlusion);
+	render_context_destroy(&context);
+	render_target_destroy(&target);
+
+	return pvs;
+}
+
+void pvs_destroy(Pvs* pvs)
+{
+	delete[] pvs->visible;
+	*pvs = {};
+}
+
+int32 pvs_cell(const Pvs* pvs, Vec_3f position)
+{
+	const int32 cell_x = (int32)float32_floor((position.x - pvs->origin.x) / pvs->cell_size);
+	const int32 cell_y = (int32)float32_floor((position.y - pvs->origin.y) / pvs->cell_size);
+	if (cell_x < 0 || cell_x >= pvs->cells_x ||
+		cell_y < 0 || cell_y >= pvs->cells_y ||
+		position.z < pvs->origin.z || position.z > pvs->max_z)
+	{
+		return -1;
+	}
+
+	return (cell_y * pvs->cells_x) + cell_x;
+}
+
+const uint32* pvs_visible_set(const Pvs* pvs, int32 cell)
+{
+	assert(cell >= 0 && cell < pvs->cells_x * pvs->cells_y);
+	return &pvs->visible[cell * pvs->words_per_cell];
+}
+
+uint32 pvs_visible_count(const Pvs* pvs, int32 cell)
+{
+	const uint32* visible = pvs_visible_set(pvs, cell);
+	uint32 count = 0;
+	for (uint32 word_i = 0; word_i < pvs->words_per_cell; ++word_i)
+	{
+		for (uint32 word = visible[word_i]; word; word &= word - 1)
+		{
+			++count;
+		}
+	}
+	return count;
+}
+
+bool pvs_save(const Pvs* pvs, const char* path)
+{
+	const uint64 bits_size = (uint64)pvs->cells_x * pvs->cells_y * pvs->words_per_cell * sizeof(uint32);
+	const uint64 size = sizeof(Pvs_File_Header) + bits_size;
+	uint8* data = new uint8[size];
+
+	Pvs_File_Header* header = (Pvs_File_Header*)data;
+	header->magic = c_pvs_file_magic;
+	header->origin = pvs->origin;
+	header->cell_size = pvs->cell_size;
+	header->cells_x = pvs->cells_x;
+	header->cells_y = pvs->cells_y;
+	header->max_z = pvs->max_z;
+	header->instance_count = pvs->instance_count;
+	header->words_per_cell = pvs->words_per_cell;
+	memcpy(data + sizeof(Pvs_File_Header), pvs->visible, bits_size);
+
+	const bool success = write_file(path, data, size);
+	delete[] data;
+
+	return success;
+}
+
+bool pvs_load(Pvs* out_pvs, const char* path)
+{
+	File file = read_file(path);
+	if (!file.data)
+	{
+		return false;
+	}
+
+	const Pvs_File_Header* header = (const Pvs_File_Header*)file.data;
+	if (file.size < sizeof(Pvs_File_Header) ||
+		header->magic != c_pvs_file_magic ||
+		header->cells_x <= 0 || header->cells_y <= 0 ||
+		header->words_per_cell != ((uint64)header->instance_count + 31) / 32 ||
+		file.size != sizeof(Pvs_File_Header) + ((uint64)header->cells_x * header->cells_y * header->words_per_cell * sizeof(uint32)))
+	{
+		delete[] file.data;
+		return false;
+	}
+
+	Pvs pvs = {};
+	pvs.origin = header->origin;
+	pvs.cell_size = header->cell_size;
+	pvs.cells_x = header->cells_x;
+	pvs.cells_y = header->cells_y;
+	pvs.max_z = header->max_z;
+	pvs.instance_count = header->instance_count;
+	pvs.words_per_cell = header->words_per_cell;
+	const uint32 word_count = pvs.cells_x * pvs.cells_y * pvs.words_per_cell;
+	pvs.visible = new uint32[word_count];
+	memcpy(pvs.visible, file.data + sizeof(Pvs_File_Header), word_count * sizeof(uint32));
+	delete[] file.data;
+
+	*out_pvs = pvs;
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "scene.h"
+
+
+// Potentially visible sets for a static scene. The space the camera can be in
+// is split into a grid of columns (cells), and each cell has a bitset of the
+// instances that can be seen from somewhere inside it, so finding what might
+// be visible is just looking up the camera's cell.
+struct Pvs
+{
+	Vec_3f origin; // min corner of the grid
+	float32 cell_size;
+	int32 cells_x;
+	int32 cells_y;
+	float32 max_z; // cells go from origin.z to here
+
+	uint32 instance_count;
+	uint32 words_per_cell;
+	uint32* visible; // words_per_cell for each cell, x major
+};
+
+struct Pvs_Bake_Settings
+{
+	Vec_3f origin;
+	float32 cell_size;
+	int32 cells_x;
+	int32 cells_y;
+	float32 max_z;
+
+	// Visibility is sampled on a lattice of points, samples_per_cell apart
+	// across each cell and height_samples from origin.z to max_z, including
+	// the cell edges so neighbouring cells agree on what they share. Each
+	// point renders all 6 directions at resolution x resolution, so anything
+	// smaller than a pixel of that can be missed. Points inside the bounds of
+	// an occluder are skipped, as the camera can't be inside solid things.
+	int32 samples_per_cell;
+	int32 height_samples;
+	int32 resolution;
+	float32 near_plane;
+	float32 far_plane;
+};
+
+
+// renders the scene from every sample point with the normal rasteriser, the
+// scene mustn't change afterwards or the bitsets will refer to the wrong instances
+Pvs pvs_bake(Scene* scene, const Pvs_Bake_Settings* settings);
+void pvs_destroy(Pvs* pvs);
+// -1 if the position is outside the grid
+int32 pvs_cell(const Pvs* pvs, Vec_3f position);
+// bitset with a bit per instance, for Scene_View::potentially_visible
+const uint32* pvs_visible_set(const Pvs* pvs, int32 cell);
+uint32 pvs_visible_count(const Pvs* pvs, int32 cell);
+
+bool pvs_save(const Pvs* pvs, const char* path);
+// false if the file is missing or isn't a pvs
+bool pvs_load(Pvs* out_pvs, const char* path);
@@ -0,0 +1,618 @@
+#include "scene.h"
+
+#include <cstdlib>
+#include <cstring>
+#include "assert.h"
+#include "lod.h"
+
+
+// How many instances of a model are projected together. Each draw call is
+// then drawn for every instance in the chunk before moving to the next, so
+// the model's indices and the draw call's texture stay in cache across the
+// chunk.
+static constexpr uint32 c_instances_per_chunk = 32;
+// How far instance bounds are grown in the BVH, instances moving less than
+// this don't touch the tree.
+static constexpr float32 c_bvh_margin = 0.1f;
+// Occluders covering fewer pixels of the occlusion buffer than this hide too
+// little to be worth drawing.
+static constexpr int32 c_min_occluder_pixels = 36;
+// Most local lights an instance is lit by, when more reach it only the
+// strongest are kept.
+static constexpr uint32 c_max_instance_lights = 8;
+static constexpr uint32 c_initial_light_capacity = 16;
+
+
+Scene scene_create(uint32 instance_capacity)
+{
+	assert(instance_capacity > 0);
+
+	Scene scene = {};
+	scene.instances = new Model_Instance[instance_capacity];
+	scene.instance_capacity = instance_capacity;
+	scene.bvh = bvh_create(instance_capacity, c_bvh_margin);
+	scene.batch_rank = new uint32[instance_capacity];
+	scene.visible = new uint32[instance_capacity];
+	scene.draw_order = new Sort_Item[instance_capacity];
+	scene.draw_order_scratch = new Sort_Item[instance_capacity];
+	scene.lights = new Local_Light[c_initial_light_capacity];
+	scene.light_capacity = c_initial_light_capacity;
+	scene.light_bvh = bvh_create(c_initial_light_capacity, c_bvh_margin);
+	scene.light_proxies = new int32[c_initial_light_capacity];
+	scene.lights_found = new uint32[c_initial_light_capacity];
+
+	return scene;
+}
+
+void scene_destroy(Scene* scene)
+{
+	for (uint32 i = 0; i < scene->instance_count; ++i)
+	{
+		delete[] scene->instances[i].vertex_light;
+	}
+	delete[] scene->instances;
+	bvh_destroy(&scene->bvh);
+	delete[] scene->batch_rank;
+	delete[] scene->visible;
+	delete[] scene->draw_order;
+	delete[] scene->draw_order_scratch;
+	delete[] scene->lights;
+	bvh_destroy(&scene->light_bvh);
+	delete[] scene->light_proxies;
+	delete[] scene->lights_found;
+	*scene = {};
+}
+
+uint32 scene_add_instance(Scene* scene, const Model* model, Vec_3f position, Quat rotation)
+{
+	if (scene->instance_count == scene->instance_capacity)
+	{
+		const uint32 new_capacity = scene->instance_capacity * 2;
+		Model_Instance* instances = new Model_Instance[new_capacity];
+		memcpy(instances, scene->instances, scene->instance_count * sizeof(Model_Instance));
+		delete[] scene->instances;
+		delete[] scene->batch_rank;
+		delete[] scene->visible;
+		delete[] scene->draw_order;
+		delete[] scene->draw_order_scratch;
+		scene->instances = instances;
+		scene->batch_rank = new uint32[new_capacity];
+		scene->visible = new uint32[new_capacity];
+		scene->draw_order = new Sort_Item[new_capacity];
+		scene->draw_order_scratch = new Sort_Item[new_capacity];
+		scene->instance_capacity = new_capacity;
+	}
+
+	const uint32 instance = scene->instance_count;
+	++scene->instance_count;
+
+	Model_Instance* model_instance = &scene->instances[instance];
+	model_instance->model = model;
+	matrix_4x4_transform(&model_instance->transform, position, rotation);
+	matrix_4x4_inverse_transform(&model_instance->inverse_transform, position, rotation);
+	aabb_transform(&model_instance->transform, model->bounds_min, model->bounds_max, &model_instance->bounds_min, &model_instance->bounds_max);
+	model_instance->bvh_proxy = bvh_insert(&scene->bvh, instance, model_instance->bounds_min, model_instance->bounds_max);
+	model_instance->lod = 0;
+	model_instance->vertex_light = nullptr;
+	model_instance->lit_by = {};
+	model_instance->lighting_dirty = true;
+	scene->batches_dirty = true;
+
+	return instance;
+}
+
+void scene_set_transform(Scene* scene, uint32 instance, Vec_3f position, Quat rotation)
+{
+	assert(instance < scene->instance_count);
+
+	Model_Instance* model_instance = &scene->instances[instance];
+	matrix_4x4_transform(&model_instance->transform, position, rotation);
+	matrix_4x4_inverse_transform(&model_instance->inverse_transform, position, rotation);
+	aabb_transform(&model_instance->transform, model_instance->model->bounds_min, model_instance->model->bounds_max, &model_instance->bounds_min, &model_instance->bounds_max);
+	bvh_move(&scene->bvh, model_instance->bvh_proxy, model_instance->bounds_min, model_instance->bounds_max);
+	model_instance->lighting_dirty = true;
+}
+
+static void light_bounds(const Local_Light* light, Vec_3f* out_min, Vec_3f* out_max)
+{
+	const Vec_3f extent = { light->range, light->range, light->range };
+	*out_min = vec_3f_sub(light->position, extent);
+	*out_max = vec_3f_add(light->position, extent);
+}
+
+// instances the light reaches have to be lit again
+static void relight_instances_in_range(Scene* scene, const Local_Light* light)
+{
+	Vec_3f bounds_min;
+	Vec_3f bounds_max;
+	light_bounds(light, &bounds_min, &bounds_max);
+	const uint32 count = scene_query_aabb(scene, bounds_min, bounds_max, scene->visible, scene->instance_count);
+	for (uint32 i = 0; i < count; ++i)
+	{
+		scene->instances[scene->visible[i]].lighting_dirty = true;
+	}
+}
+
+uint32 scene_add_light(Scene* scene, const Local_Light* light)
+{
+	assert(light->range > 0.0f);
+
+	if (scene->light_count == scene->light_capacity)
+	{
+		const uint32 new_capacity = scene->light_capacity * 2;
+		Local_Light* lights = new Local_Light[new_capacity];
+		int32* light_proxies = new int32[new_capacity];
+		memcpy(lights, scene->lights, scene->light_count * sizeof(Local_Light));
+		memcpy(light_proxies, scene->light_proxies, scene->light_count * sizeof(int32));
+		delete[] scene->lights;
+		delete[] scene->light_proxies;
+		delete[] scene->lights_found;
+		scene->lights = lights;
+		scene->light_proxies = light_proxies;
+		scene->lights_found = new uint32[new_capacity];
+		scene->light_capacity = new_capacity;
+	}
+
+	const uint32 index = scene->light_count;
+	++scene->light_count;
+
+	scene->lights[index] = *light;
+	Vec_3f bounds_min;
+	Vec_3f bounds_max;
+	light_bounds(light, &bounds_min, &bounds_max);
+	scene->light_proxies[index] = bvh_insert(&scene->light_bvh, index, bounds_min, bounds_max);
+	relight_instances_in_range(scene, light);
+
+	return index;
+}
+
+void scene_set_light(Scene* scene, uint32 light, const Local_Light* new_light)
+{
+	assert(light < scene->light_count);
+	assert(new_light->range > 0.0f);
+
+	relight_instances_in_range(scene, &scene->lights[light]);
+	scene->lights[light] = *new_light;
+	Vec_3f bounds_min;
+	Vec_3f bounds_max;
+	light_bounds(new_light, &bounds_min, &bounds_max);
+	bvh_move(&scene->light_bvh, scene->light_proxies[light], bounds_min, bounds_max);
+	relight_instances_in_range(scene, new_light);
+}
+
+uint32 scene_query_aabb(const Scene* scene, Vec_3f bounds_min, Vec_3f bounds_max, uint32* out_instances, uint32 max_instances)
+{
+	const Bvh_Query_Stats query = bvh_query_aabb(&scene->bvh, bounds_min, bounds_max, out_instances, max_instances);
+
+	// the tree's bounds are grown by the margin, so check the real ones
+	uint32 count = 0;
+	for (uint32 i = 0; i < query.items_found; ++i)
+	{
+		const Model_Instance* instance = &scene->instances[out_instances[i]];
+		if (aabb_overlaps(instance->bounds_min, instance->bounds_max, bounds_min, bounds_max))
+		{
+			out_instances[count] = out_instances[i];
+			++count;
+		}
+	}
+
+	return count;
+}
+
+uint32 scene_query_ray(const Scene* scene, Vec_3f origin, Vec_3f direction, float32 max_t, uint32* out_instances, uint32 max_instances)
+{
+	const Bvh_Query_Stats query = bvh_query_ray(&scene->bvh, origin, direction, max_t, out_instances, max_instances);
+
+	const Vec_3f inverse_direction = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+	uint32 count = 0;
+	for (uint32 i = 0; i < query.items_found; ++i)
+	{
+		const Model_Instance* instance = &scene->instances[out_instances[i]];
+		if (ray_intersects_aabb(origin, inverse_direction, max_t, instance->bounds_min, instance->bounds_max))
+		{
+			out_instances[count] = out_instances[i];
+			++count;
+		}
+	}
+
+	return count;
+}
+
+struct Batch_Sort_Item
+{
+	uintptr_t texture;
+	uintptr_t model;
+	uint32 instance;
+};
+
+static int compare_batch_sort_items(const void* a, const void* b)
+{
+	const Batch_Sort_Item* item_a = (const Batch_Sort_Item*)a;
+	const Batch_Sort_Item* item_b = (const Batch_Sort_Item*)b;
+
+	if (item_a->texture != item_b->texture)
+	{
+		return item_a->texture < item_b->texture ? -1 : 1;
+	}
+	if (item_a->model != item_b->model)
+	{
+		return item_a->model < item_b->model ? -1 : 1;
+	}
+	// keep instances of the same model in the order they were added
+	return item_a->instance < item_b->instance ? -1 : 1;
+}
+
+static void rebuild_batches(Scene* scene)
+{
+	Batch_Sort_Item* items = new Batch_Sort_Item[scene->instance_count];
+	for (uint32 i = 0; i < scene->instance_count; ++i)
+	{
+		const Model* model = scene->instances[i].model;
+		items[i].texture = model->draw_call_count > 0 ? (uintptr_t)model->draw_calls[0].texture : 0;
+		items[i].model = (uintptr_t)model;
+		items[i].instance = i;
+	}
+
+	qsort(items, scene->instance_count, sizeof(Batch_Sort_Item), compare_batch_sort_items);
+
+	for (uint32 i = 0; i < scene->instance_count; ++i)
+	{
+		scene->batch_rank[items[i].instance] = i;
+	}
+	delete[] items;
+
+	scene->batches_dirty = false;
+}
+
+// The local lights reaching the instance's bounds, in its model space. If
+// there are too many, the ones brightest at the nearest point of the bounds
+// are kept.
+static uint32 gather_instance_lights(const Scene* scene, const Model_Instance* instance, Local_Light* out_lights)
+{
+	const Bvh_Query_Stats query = bvh_query_aabb(&scene->light_bvh, instance->bounds_min, instance->bounds_max, scene->lights_found, scene->light_count);
+
+	struct Candidate
+	{
+		uint32 light;
+		float32 strength;
+	};
+	Candidate candidates[c_max_instance_lights];
+	uint32 candidate_count = 0;
+	for (uint32 i = 0; i < query.items_found; ++i)
+	{
+		const Local_Light* light = &scene->lights[scene->lights_found[i]];
+		const float32 distance_sq = aabb_distance_sq(instance->bounds_min, instance->bounds_max, light->position);
+		const float32 range_sq = light->range * light->range;
+		if (distance_sq >= range_sq)
+		{
+			continue;
+		}
+
+		const float32 falloff = 1.0f - (distance_sq / range_sq);
+		const Candidate candidate = { scene->lights_found[i], light->intensity * falloff * falloff };
+		if (candidate_count < c_max_instance_lights)
+		{
+			candidates[candidate_count] = candidate;
+			++candidate_count;
+			continue;
+		}
+
+		uint32 weakest = 0;
+		for (uint32 j = 1; j < candidate_count; ++j)
+		{
+			if (candidates[j].strength < candidates[weakest].strength)
+			{
+				weakest = j;
+			}
+		}
+		if (candidate.strength > candidates[weakest].strength)
+		{
+			candidates[weakest] = candidate;
+		}
+	}
+
+	// transforms are only rotation and translation, so ranges stay the same
+	for (uint32 i = 0; i < candidate_count; ++i)
+	{
+		const Local_Light* light = &scene->lights[candidates[i].light];
+		out_lights[i] = *light;
+		out_lights[i].position = matrix_4x4_mul(&instance->inverse_transform, light->position);
+		out_lights[i].direction = matrix_4x4_mul_direction(&instance->inverse_transform, light->direction);
+	}
+
+	return candidate_count;
+}
+
+// Lights the instance's vertices if they aren't already lit by this light.
+// Returns how many local lights it was lit by, or -1 if it didn't need
+// lighting.
+static int32 update_instance_lighting(const Render_Context* context, const Scene* scene, Model_Instance* instance, Vec_4f light)
+{
+	const Model* model = instance->model;
+	if (!instance->vertex_light)
+	{
+		instance->vertex_light = new float32[model->vertex_count];
+		instance->lighting_dirty = true;
+	}
+
+	if (!instance->lighting_dirty &&
+		instance->lit_by.x == light.x && instance->lit_by.y == light.y && instance->lit_by.z == light.z && instance->lit_by.w == light.w)
+	{
+		return -1;
+	}
+
+	Local_Light local_lights[c_max_instance_lights];
+	const uint32 local_light_count = gather_instance_lights(scene, instance, local_lights);
+
+	// all the vertices, so changing level of detail doesn't need relighting
+	const Vec_3f light_in_model_space = matrix_4x4_mul_direction(&instance->inverse_transform, { light.x, light.y, light.z });
+	if (model->packed)
+	{
+		graphics_light_packed_vertices(context, model->packed, model->vertex_count, light_in_model_space, instance->vertex_light);
+		graphics_add_packed_local_lights(context, model->packed, model->vertex_count, local_lights, local_light_count, instance->vertex_light);
+	}
+	else
+	{
+		graphics_light_vertices(context, model->normals, model->vertex_count, light_in_model_space, instance->vertex_light);
+		graphics_add_local_lights(context, model->vertices, model->normals, model->vertex_count, local_lights, local_light_count, instance->vertex_light);
+	}
+	instance->lit_by = light;
+	instance->lighting_dirty = false;
+
+	return (int32)local_light_count;
+}
+
+static void draw_chunk(
+	Render_Context* context,
+	const Scene* scene,
+	const Model* model,
+	const uint32* chunk,
+	uint32 chunk_count,
+	const Matrix_4x4* view_projection_matrix)
+{
+	// each instance gets room for all the vertices, but only the prefix its
+	// level of detail uses is projected
+	const uint32 vertex_count = model->vertex_count;
+	render_context_reserve_vertices(context, vertex_count * chunk_count);
+
+	for (uint32 i = 0; i < chunk_count; ++i)
+	{
+		const Model_Instance* instance = &scene->instances[chunk[i]];
+		Matrix_4x4 model_view_projection_matrix;
+		matrix_4x4_mul(&model_view_projection_matrix, view_projection_matrix, &instance->transform);
+
+		const uint32 offset = i * vertex_count;
+		graphics_project_model_lod(context, model, instance->lod, &model_view_projection_matrix, context->projected_vertices + offset, context->unpacked_texcoords + offset);
+	}
+
+	for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+	{
+		for (uint32 i = 0; i < chunk_count; ++i)
+		{
+			const Model_Instance* instance = &scene->instances[chunk[i]];
+			const uint32 offset = i * vertex_count;
+			context->draw_id = chunk[i];
+			graphics_draw_model_lod(context, model, instance->lod, context->projected_vertices + offset, context->unpacked_texcoords + offset, instance->vertex_light, draw_call_i, 1);
+		}
+	}
+}
+
+static void draw_occluders(Scene* scene, uint32 visible_count, Occlusion_Buffer* occlusion, const Matrix_4x4* view_projection_matrix, Scene_Draw_Stats* stats)
+{
+	occlusion_buffer_clear(occlusion);
+
+	for (uint32 i = 0; i < visible_count; ++i)
+	{
+		const Model_Instance* instance = &scene->instances[scene->visible[i]];
+		if (!instance->model->occluder)
+		{
+			continue;
+		}
+
+		Occlusion_Rect rect;
+		if (!occlusion_buffer_project_aabb(occlusion, view_projection_matrix, instance->bounds_min, instance->bounds_max, &rect) ||
+			((rect.max_x - rect.min_x + 1) * (rect.max_y - rect.min_y + 1)) < c_min_occluder_pixels)
+		{
+			continue;
+		}
+
+		Matrix_4x4 model_view_projection_matrix;
+		matrix_4x4_mul(&model_view_projection_matrix, view_projection_matrix, &instance->transform);
+		stats->occluder_triangles += occlusion_buffer_draw(occlusion, instance->model->occluder, &model_view_projection_matrix);
+		++stats->occluders_drawn;
+	}
+}
+
+// instances with their bit set, in index order
+static uint32 gather_potentially_visible(const Scene* scene, const uint32* potentially_visible, uint32* out_instances)
+{
+	uint32 count = 0;
+	const uint32 word_count = (scene->instance_count + 31) / 32;
+	for (uint32 word_i = 0; word_i < word_count; ++word_i)
+	{
+		uint32 word = potentially_visible[word_i];
+		while (word)
+		{
+			const uint32 instance = (word_i * 32) + uint32_lowest_set_bit(word);
+			if (instance < scene->instance_count)
+			{
+				out_instances[count] = instance;
+				++count;
+			}
+			word &= word - 1;
+		}
+	}
+
+	return count;
+}
+
+// Culls the scene for the view, leaving what's left in scene->visible.
+// Returns how many there are.
+static uint32 cull_instances(Scene* scene, const Scene_View* view, const Frustum* frustum, Scene_Draw_Stats* stats)
+{
+	const Matrix_4x4* view_projection_matrix = &view->view_projection_matrix;
+
+	// a potentially visible set already rules out most of the scene, so its
+	// instances are just frustum tested one by one, otherwise the tree does it
+	uint32 candidate_count;
+	if (view->potentially_visible)
+	{
+		candidate_count = gather_potentially_visible(scene, view->potentially_visible, scene->visible);
+		stats->instances_not_potentially_visible = scene->instance_count - candidate_count;
+	}
+	else
+	{
+		const Bvh_Query_Stats query = bvh_query_frustum(&scene->bvh, frustum, scene->visible, scene->instance_count);
+		stats->bvh_nodes_visited = query.nodes_visited;
+		candidate_count = query.items_found;
+	}
+
+	// the tree only knows the grown bounds, so test the real ones
+	uint32 visible_count = 0;
+	for (uint32 i = 0; i < candidate_count; ++i)
+	{
+		const Model_Instance* instance = &scene->instances[scene->visible[i]];
+		if (frustum_intersects_aabb(frustum, instance->bounds_min, instance->bounds_max))
+		{
+			scene->visible[visible_count] = scene->visible[i];
+			++visible_count;
+		}
+	}
+
+	Occlusion_Buffer* occlusion = view->occlusion;
+	if (occlusion)
+	{
+		draw_occluders(scene, visible_count, occlusion, view_projection_matrix, stats);
+
+		uint32 unoccluded_count = 0;
+		for (uint32 i = 0; i < visible_count; ++i)
+		{
+			const Model_Instance* instance = &scene->instances[scene->visible[i]];
+			Occlusion_Rect rect;
+			if (occlusion_buffer_project_aabb(occlusion, view_projection_matrix, instance->bounds_min, instance->bounds_max, &rect) &&
+				!occlusion_buffer_test(occlusion, &rect))
+			{
+				++stats->instances_occluded;
+				continue;
+			}
+
+			scene->visible[unoccluded_count] = scene->visible[i];
+			++unoccluded_count;
+		}
+		visible_count = unoccluded_count;
+	}
+
+	stats->instances_drawn = visible_count;
+	stats->instances_culled = scene->instance_count - visible_count - stats->instances_occluded - stats->instances_not_potentially_visible;
+
+	return visible_count;
+}
+
+Scene_Draw_Stats scene_draw(Render_Context* context, Scene* scene, const Scene_View* view, Vec_4f light)
+{
+	if (scene->batches_dirty)
+	{
+		rebuild_batches(scene);
+	}
+
+	const Matrix_4x4* view_projection_matrix = &view->view_projection_matrix;
+	Frustum frustum;
+	frustum_from_matrix(&frustum, view_projection_matrix);
+
+	Scene_Draw_Stats stats = {};
+	const uint64 pixels_shaded_before = context->pixels_shaded;
+	const uint32 visible_count = cull_instances(scene, view, &frustum, &stats);
+
+	// Pick each instance's level of detail from how big it is on screen. w is
+	// the distance along the view direction, so a unit at the bounds centre
+	// covers lod_scale / w pixels. It's also what's sorted on to draw front
+	// to back, otherwise instances are sorted back into batch order by their
+	// batch rank.
+	Sort_Item* draw_order = scene->draw_order;
+	for (uint32 i = 0; i < visible_count; ++i)
+	{
+		Model_Instance* instance = &scene->instances[scene->visible[i]];
+		const Vec_3f centre = vec_3f_mul(vec_3f_add(instance->bounds_min, instance->bounds_max), 0.5f);
+		const float32 w = matrix_4x4_mul_vec4(view_projection_matrix, centre).w;
+		draw_order[i].key = view->front_to_back ? depth_sort_key(w) : scene->batch_rank[scene->visible[i]];
+		draw_order[i].value = scene->visible[i];
+
+		instance->lod = model_select_view_lod(instance->model, instance->lod, view->lod_scale, w);
+		stats.triangles_submitted += instance->model->lods[instance->lod].triangle_count;
+
+		// only relit if it or a light reaching it has changed since it was
+		// last drawn
+		const int32 local_light_count = update_instance_lighting(context, scene, instance, light);
+		if (local_light_count >= 0)
+		{
+			++stats.instances_relit;
+			stats.instance_lights += local_light_count;
+		}
+	}
+
+	const uint32 key_bits = view->front_to_back ? 16 : uint32_highest_set_bit(uint32_max(scene->instance_count, 2) - 1) + 1;
+	radix_sort(draw_order, scene->draw_order_scratch, visible_count, key_bits);
+
+	const Model* batch_model = nullptr;
+	uint32 chunk[c_instances_per_chunk];
+	uint32 chunk_count = 0;
+	for (uint32 i = 0; i < visible_count; ++i)
+	{
+		const uint32 instance_index = draw_order[i].value;
+		const Model_Instance* instance = &scene->instances[instance_index];
+		if (instance->model != batch_model)
+		{
+			if (chunk_count)
+			{
+				draw_chunk(context, scene, batch_model, chunk, chunk_count, view_projection_matrix);
+				chunk_count = 0;
+			}
+			batch_model = instance->model;
+			++stats.batches;
+		}
+
+		chunk[chunk_count] = instance_index;
+		++chunk_count;
+		if (chunk_count == c_instances_per_chunk)
+		{
+			draw_chunk(context, scene, batch_model, chunk, chunk_count, view_projection_matrix);
+			chunk_count = 0;
+		}
+	}
+
+	if (chunk_count)
+	{
+		draw_chunk(context, scene, batch_model, chunk, chunk_count, view_projection_matrix);
+	}
+
+	// deferred until everything's been drawn, then either drawn back to front
+	// or each pixel's shaded once
+	if (context->ordering_table)
+	{
+		graphics_draw_ordering_table(context);
+	}
+	else if (context->target->visibility)
+	{
+		context->pixels_shaded += graphics_shade_visibility_buffer(context);
+	}
+
+	stats.pixels_shaded = (uint32)(context->pixels_shaded - pixels_shaded_before);
+
+	return stats;
+}
+
+Scene_Draw_Stats scene_record_draws(Scene* scene, const Scene_View* view, Command_List* list)
+{
+	Frustum frustum;
+	frustum_from_matrix(&frustum, &view->view_projection_matrix);
+
+	Scene_Draw_Stats stats = {};
+	const uint32 visible_count = cull_instances(scene, view, &frustum, &stats);
+	for (uint32 i = 0; i < visible_count; ++i)
+	{
+		const Model_Instance* instance = &scene->instances[scene->visible[i]];
+		command_list_draw(list, instance->model, &instance->transform, scene->visible[i]);
+	}
+
+	return stats;
+}
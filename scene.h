@@ -0,0 +1,131 @@
+#pragma once
+
+#include "bvh.h"
+#include "command_list.h"
+#include "graphics.h"
+#include "occlusion.h"
+#include "sort.h"
+
+
+// One placement of a shared Model in the world. The inverse transform is
+// cached for lighting, and the bounds are the world space AABB.
+struct Model_Instance
+{
+	const Model* model;
+	Matrix_4x4 transform;
+	Matrix_4x4 inverse_transform;
+	Vec_3f bounds_min;
+	Vec_3f bounds_max;
+	int32 bvh_proxy;
+	// level of detail drawn last frame, kept for hysteresis
+	uint32 lod;
+
+	// Light for each of the model's vertices, allocated the first time the
+	// instance is drawn. It's only worked out again when the instance moves,
+	// the light it was lit by changes or a local light reaching it changes,
+	// anything else per vertex which doesn't depend on the camera (e.g.
+	// ambient or vertex colour) belongs in here too.
+	float32* vertex_light;
+	Vec_4f lit_by;
+	bool lighting_dirty;
+};
+
+// Instances are kept in the order they were added, and drawn in batches of
+// the same model. Batches are ordered by their first texture so models that
+// share textures are drawn next to each other. A BVH over the instance bounds
+// is used for culling and queries, so only the visible part of the scene
+// costs anything to draw. Local lights have a BVH of their own over their
+// ranges, so each instance is only lit by the few that reach it.
+struct Scene
+{
+	Model_Instance* instances;
+	uint32 instance_count;
+	uint32 instance_capacity;
+
+	Bvh bvh;
+
+	Local_Light* lights;
+	uint32 light_count;
+	uint32 light_capacity;
+	Bvh light_bvh;
+	int32* light_proxies;
+	// scratch for light query results
+	uint32* lights_found;
+
+	// position of each instance once they're grouped by model, rebuilt when
+	// instances are added
+	uint32* batch_rank;
+	bool batches_dirty;
+
+	// scratch for query results
+	uint32* visible;
+	// scratch for sorting the visible instances into the order they're drawn
+	Sort_Item* draw_order;
+	Sort_Item* draw_order_scratch;
+};
+
+// What to draw the scene from, and the optional culling to do on the way.
+struct Scene_View
+{
+	Matrix_4x4 view_projection_matrix;
+	// occluders are drawn into this and anything they hide is culled
+	Occlusion_Buffer* occlusion;
+	// bitset with a bit per instance, e.g. from the pvs cell the camera is
+	// in, instances without their bit set aren't considered at all
+	const uint32* potentially_visible;
+	// pixels covered by a unit at a distance of one, used to pick each
+	// instance's level of detail, 0 draws everything at full detail
+	float32 lod_scale;
+	// Draw the nearest instances first, so more of what's behind them fails
+	// the depth test before it's textured and lit. Instances of the same
+	// model are only batched together when they're next to each other in
+	// depth.
+	bool front_to_back;
+};
+
+struct Scene_Draw_Stats
+{
+	uint32 instances_drawn;
+	uint32 instances_culled;
+	uint32 batches;
+	uint32 bvh_nodes_visited;
+	uint32 instances_occluded;
+	uint32 instances_not_potentially_visible;
+	uint32 occluders_drawn;
+	uint32 occluder_triangles;
+	uint32 triangles_submitted;
+	uint32 instances_relit;
+	// local lights in the lists of the instances relit
+	uint32 instance_lights;
+	// pixels textured and lit, over the pixels in the target it's the
+	// average overdraw
+	uint32 pixels_shaded;
+};
+
+
+Scene scene_create(uint32 instance_capacity);
+void scene_destroy(Scene* scene);
+uint32 scene_add_instance(Scene* scene, const Model* model, Vec_3f position, Quat rotation);
+void scene_set_transform(Scene* scene, uint32 instance, Vec_3f position, Quat rotation);
+// Lights are in world space. Instances in reach of the light (before and
+// after, when it's changed) are relit next time they're drawn.
+uint32 scene_add_light(Scene* scene, const Local_Light* light);
+void scene_set_light(Scene* scene, uint32 light, const Local_Light* new_light);
+// instances whose bounds overlap the box, returns how many were written to out_instances
+uint32 scene_query_aabb(const Scene* scene, Vec_3f bounds_min, Vec_3f bounds_max, uint32* out_instances, uint32 max_instances);
+// instances whose bounds the ray hits within max_t, in no particular order
+uint32 scene_query_ray(const Scene* scene, Vec_3f origin, Vec_3f direction, float32 max_t, uint32* out_instances, uint32 max_instances);
+// Instances not in the potentially visible set, then those outside the
+// frustum, are culled first. If an occlusion buffer is given, the occluders of
+// the nearby instances left are drawn into it and anything they completely
+// hide is culled too. Each instance is drawn at the level of detail its
+// distance calls for, with its index as the draw id. It's lit by light, a
+// direction, plus the local lights whose range reaches its bounds. If the
+// context has an ordering table, it's drawn once everything is in it,
+// otherwise if the target has a visibility buffer, it's shaded after
+// everything's drawn.
+Scene_Draw_Stats scene_draw(Render_Context* context, Scene* scene, const Scene_View* view, Vec_4f light);
+// Culls the scene the same way as scene_draw, then records a draw of each
+// instance left into the list, with its index as the draw id. Nothing's
+// sorted or lit, that's left to whatever executes the list.
+Scene_Draw_Stats scene_record_draws(Scene* scene, const Scene_View* view, Command_List* list);
@@ -0,0 +1,72 @@
+#include "sort.h"
+
+#include <cstring>
+#include "assert.h"
+#include "maths.h"
+
+
+static constexpr uint32 c_radix_bits = 8;
+static constexpr uint32 c_radix_size = 1 << c_radix_bits;
+
+
+void radix_sort(Sort_Item* items, Sort_Item* scratch, uint32 count, uint32 key_bits)
+{
+	assert(key_bits <= 32);
+
+	if (count < 2)
+	{
+		return;
+	}
+
+	Sort_Item* from = items;
+	Sort_Item* to = scratch;
+	for (uint32 shift = 0; shift < key_bits; shift += c_radix_bits)
+	{
+		uint32 offsets[c_radix_size];
+		memset(offsets, 0, sizeof(offsets));
+		for (uint32 i = 0; i < count; ++i)
+		{
+			++offsets[(from[i].key >> shift) & (c_radix_size - 1)];
+		}
+
+		// a digit everything shares wouldn't move anything
+		if (offsets[(from[0].key >> shift) & (c_radix_size - 1)] == count)
+		{
+			continue;
+		}
+
+		uint32 offset = 0;
+		for (uint32 digit = 0; digit < c_radix_size; ++digit)
+		{
+			const uint32 digit_count = offsets[digit];
+			offsets[digit] = offset;
+			offset += digit_count;
+		}
+
+		for (uint32 i = 0; i < count; ++i)
+		{
+			const uint32 digit = (from[i].key >> shift) & (c_radix_size - 1);
+			to[offsets[digit]] = from[i];
+			++offsets[digit];
+		}
+
+		Sort_Item* temp = from;
+		from = to;
+		to = temp;
+	}
+
+	if (from != items)
+	{
+		memcpy(items, from, count * sizeof(Sort_Item));
+	}
+}
+
+// Positive floats sort the same as their bits. The top 16 bits keep 7 bits of
+// mantissa, so depths within about 1% of each other share a key.
+uint32 depth_sort_key(float32 depth)
+{
+	const float32 clamped = float32_max(depth, 0.0f);
+	uint32 bits;
+	memcpy(&bits, &clamped, sizeof(bits));
+	return bits >> 16;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "types.h"
+
+
+// A key to sort by and whatever it's the key for, e.g. an instance index.
+struct Sort_Item
+{
+	uint32 key;
+	uint32 value;
+};
+
+
+// Least significant digit radix sort, a byte at a time, over the bottom
+// key_bits of the keys. Stable, so items with equal keys keep their order.
+// scratch must have room for count items, the result ends up in items.
+void radix_sort(Sort_Item* items, Sort_Item* scratch, uint32 count, uint32 key_bits);
+
+// A 16 bit key ordering depths nearest first, negative depths count as 0.
+// Depths within about 1% of each other can share a key.
+uint32 depth_sort_key(float32 depth);
@@ -0,0 +1,394 @@
+#include "texture_atlas.h"
+
+#include <cstring>
+#include "assert.h"
+
+
+static constexpr uint32 c_no_tile = 0xffffffff;
+static constexpr uint32 c_no_copy = 0xffffffff;
+
+
+// How many whole repeats the triangle's texcoords have to be moved back by to
+// start in the first repeat, and how many repeats it spans from there.
+static void triangle_repeats(const Vec_2f* texcoords, const int32* triangle, int32* out_shift_u, int32* out_shift_v, uint32* out_repeats_u, uint32* out_repeats_v)
+{
+	Vec_2f min = texcoords[triangle[0]];
+	Vec_2f max = min;
+	for (uint32 i = 1; i < 3; ++i)
+	{
+		const Vec_2f texcoord = texcoords[triangle[i]];
+		min = { float32_min(min.x, texcoord.x), float32_min(min.y, texcoord.y) };
+		max = { float32_max(max.x, texcoord.x), float32_max(max.y, texcoord.y) };
+	}
+
+	*out_shift_u = (int32)float32_floor(min.x);
+	*out_shift_v = (int32)float32_floor(min.y);
+	*out_repeats_u = uint32_max(1, (uint32)float32_ceil(max.x - *out_shift_u));
+	*out_repeats_v = uint32_max(1, (uint32)float32_ceil(max.y - *out_shift_v));
+}
+
+static uint32 find_tile(const Atlas_Tile* tiles, uint32 tile_count, const Texture* texture)
+{
+	for (uint32 i = 0; i < tile_count; ++i)
+	{
+		if (tiles[i].texture == texture)
+		{
+			return i;
+		}
+	}
+	return c_no_tile;
+}
+
+static uint32 tile_width(const Atlas_Tile* tile)
+{
+	return (tile->texture->width * tile->repeats_u) + (c_atlas_gutter * 2);
+}
+
+static uint32 tile_height(const Atlas_Tile* tile)
+{
+	return (tile->texture->height * tile->repeats_v) + (c_atlas_gutter * 2);
+}
+
+Texture_Atlas texture_atlas_create(const Model* models, uint32 model_count)
+{
+	// at most a tile for every draw call
+	uint32 max_tile_count = 0;
+	for (uint32 i = 0; i < model_count; ++i)
+	{
+		max_tile_count += models[i].draw_call_count;
+	}
+	Atlas_Tile* tiles = new Atlas_Tile[max_tile_count];
+	uint32 tile_count = 0;
+
+	// each texture gets the most repeats any triangle using it needs
+	for (uint32 model_i = 0; model_i < model_count; ++model_i)
+	{
+		const Model* model = &models[model_i];
+		for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+		{
+			const Draw_Call* draw_call = &model->draw_calls[draw_call_i];
+			const Texture* texture = draw_call->texture;
+			if (!texture || texture->width > c_max_atlas_texture_size || texture->height > c_max_atlas_texture_size)
+			{
+				continue;
+			}
+
+			uint32 tile_i = find_tile(tiles, tile_count, texture);
+			if (tile_i == c_no_tile)
+			{
+				tile_i = tile_count;
+				++tile_count;
+				tiles[tile_i] = {};
+				tiles[tile_i].texture = texture;
+			}
+
+			Atlas_Tile* tile = &tiles[tile_i];
+			for (uint32 triangle_i = 0; triangle_i < draw_call->triangle_count; ++triangle_i)
+			{
+				int32 shift_u;
+				int32 shift_v;
+				uint32 repeats_u;
+				uint32 repeats_v;
+				triangle_repeats(model->texcoords, &model->triangles[(draw_call->triangle_start + triangle_i) * 3], &shift_u, &shift_v, &repeats_u, &repeats_v);
+				if (repeats_u <= c_max_atlas_repeats && repeats_v <= c_max_atlas_repeats)
+				{
+					tile->repeats_u = uint32_max(tile->repeats_u, repeats_u);
+					tile->repeats_v = uint32_max(tile->repeats_v, repeats_v);
+				}
+			}
+		}
+	}
+
+	// drop textures none of whose triangles fit
+	uint32 kept_count = 0;
+	uint32 total_area = 0;
+	uint32 widest = 0;
+	for (uint32 i = 0; i < tile_count; ++i)
+	{
+		if (tiles[i].repeats_u > 0)
+		{
+			tiles[kept_count] = tiles[i];
+			total_area += tile_width(&tiles[i]) * tile_height(&tiles[i]);
+			widest = uint32_max(widest, tile_width(&tiles[i]));
+			++kept_count;
+		}
+	}
+	tile_count = kept_count;
+
+	// tallest first, only a handful of textures so insertion sort
+	for (uint32 i = 1; i < tile_count; ++i)
+	{
+		const Atlas_Tile tile = tiles[i];
+		int32 j = i - 1;
+		while (j >= 0 && tile_height(&tiles[j]) < tile_height(&tile))
+		{
+			tiles[j + 1] = tiles[j];
+			--j;
+		}
+		tiles[j + 1] = tile;
+	}
+
+	// shelves across the page, each as tall as its first tile
+	const uint32 page_width = uint32_max(widest, (uint32)float32_ceil(float32_sqrt((float32)total_area)));
+	uint32 shelf_x = 0;
+	uint32 shelf_y = 0;
+	uint32 shelf_height = 0;
+	for (uint32 i = 0; i < tile_count; ++i)
+	{
+		Atlas_Tile* tile = &tiles[i];
+		if (shelf_x + tile_width(tile) > page_width)
+		{
+			shelf_x = 0;
+			shelf_y += shelf_height;
+			shelf_height = 0;
+		}
+
+		tile->x = shelf_x + c_atlas_gutter;
+		tile->y = shelf_y + c_atlas_gutter;
+		shelf_x += tile_width(tile);
+		shelf_height = uint32_max(shelf_height, tile_height(tile));
+	}
+	const uint32 page_height = shelf_y + shelf_height;
+
+	Texture_Atlas atlas = {};
+	atlas.tile_count = tile_count;
+	atlas.tiles = new Atlas_Tile[tile_count];
+	memcpy(atlas.tiles, tiles, tile_count * sizeof(Atlas_Tile));
+	delete[] tiles;
+
+	if (tile_count == 0)
+	{
+		return atlas;
+	}
+
+	// every texel of a tile's footprint, gutter included, is the texel it
+	// wraps round to
+	uint8* pixels = new uint8[page_width * page_height * 3];
+	memset(pixels, 0, page_width * page_height * 3);
+	for (uint32 tile_i = 0; tile_i < tile_count; ++tile_i)
+	{
+		const Atlas_Tile* tile = &atlas.tiles[tile_i];
+		const Texture* texture = tile->texture;
+		const int32 width = (int32)texture->width;
+		const int32 height = (int32)texture->height;
+		const int32 footprint_width = (int32)tile_width(tile);
+		const int32 footprint_height = (int32)tile_height(tile);
+		for (int32 y = 0; y < footprint_height; ++y)
+		{
+			const int32 texture_y = (((y - (int32)c_atlas_gutter) % height) + height) % height;
+			uint8* row = pixels + ((((tile->y - c_atlas_gutter) + y) * page_width) + (tile->x - c_atlas_gutter)) * 3;
+			for (int32 x = 0; x < footprint_width; ++x)
+			{
+				const int32 texture_x = (((x - (int32)c_atlas_gutter) % width) + width) % width;
+				memcpy(row + (x * 3), texture->pixels + (((texture_y * width) + texture_x) * 3), 3);
+			}
+		}
+	}
+
+	atlas.page.width = page_width;
+	atlas.page.height = page_height;
+	atlas.page.pixels = pixels;
+	return atlas;
+}
+
+void texture_atlas_destroy(Texture_Atlas* atlas)
+{
+	delete[] atlas->page.pixels;
+	delete[] atlas->tiles;
+	*atlas = {};
+}
+
+// a vertex as it's used by triangles on one tile with the same shift, or off
+// the page, copies are numbered the same as the new vertices
+struct Vertex_Copy
+{
+	uint32 tile;
+	int32 shift_u;
+	int32 shift_v;
+	uint32 next; // next copy of the same vertex
+};
+
+void model_use_atlas(Model* model, const Texture_Atlas* atlas)
+{
+	assert(model->lod_count == 1);
+	if (atlas->tile_count == 0)
+	{
+		return;
+	}
+
+	const uint32 triangle_count = model->lods[0].triangle_count;
+	const int32* triangles = model->triangles;
+
+	// which tile each triangle goes on, if it fits, and how far it's shifted
+	uint32* triangle_tiles = new uint32[triangle_count];
+	int32* triangle_shifts = new int32[triangle_count * 2];
+	uint32 atlas_triangle_count = 0;
+	for (uint32 draw_call_i = 0; draw_call_i < model->draw_call_count; ++draw_call_i)
+	{
+		const Draw_Call* draw_call = &model->draw_calls[draw_call_i];
+		const uint32 tile_i = find_tile(atlas->tiles, atlas->tile_count, draw_call->texture);
+		for (uint32 triangle = draw_call->triangle_start; triangle < draw_call->triangle_start + draw_call->triangle_count; ++triangle)
+		{
+			uint32 repeats_u;
+			uint32 repeats_v;
+			triangle_repeats(model->texcoords, &triangles[triangle * 3], &triangle_shifts[triangle * 2], &triangle_shifts[(triangle * 2) + 1], &repeats_u, &repeats_v);
+			const bool fits = tile_i != c_no_tile && repeats_u <= atlas->tiles[tile_i].repeats_u && repeats_v <= atlas->tiles[tile_i].repeats_v;
+			triangle_tiles[triangle] = fits ? tile_i : c_no_tile;
+			if (!fits)
+			{
+				triangle_shifts[triangle * 2] = 0;
+				triangle_shifts[(triangle * 2) + 1] = 0;
+			}
+			atlas_triangle_count += fits ? 1 : 0;
+		}
+	}
+
+	if (atlas_triangle_count == 0)
+	{
+		delete[] triangle_tiles;
+		delete[] triangle_shifts;
+		return;
+	}
+
+	// Draw calls stay sorted by texture, with the page's where it sorts to.
+	// Triangles are taken in the order they were in, the page's from every
+	// draw call that had any on it.
+	const Texture* page = &atlas->page;
+	Draw_Call* draw_calls = new Draw_Call[model->draw_call_count + 1];
+	uint32 draw_call_count = 0;
+	uint32* triangle_order = new uint32[triangle_count];
+	uint32 next_triangle = 0;
+	bool page_added = false;
+	for (uint32 draw_call_i = 0; draw_call_i <= model->draw_call_count; ++draw_call_i)
+	{
+		const Draw_Call* draw_call = draw_call_i < model->draw_call_count ? &model->draw_calls[draw_call_i] : nullptr;
+		if (!page_added && (!draw_call || draw_call->texture > page))
+		{
+			draw_calls[draw_call_count] = { next_triangle, atlas_triangle_count, page };
+			++draw_call_count;
+			for (uint32 triangle = 0; triangle < triangle_count; ++triangle)
+			{
+				if (triangle_tiles[triangle] != c_no_tile)
+				{
+					triangle_order[next_triangle] = triangle;
+					++next_triangle;
+				}
+			}
+			page_added = true;
+		}
+
+		if (!draw_call)
+		{
+			break;
+		}
+
+		// what's left off the page, merged with the draw call before if it
+		// has the same texture
+		const uint32 first = next_triangle;
+		for (uint32 triangle = draw_call->triangle_start; triangle < draw_call->triangle_start + draw_call->triangle_count; ++triangle)
+		{
+			if (triangle_tiles[triangle] == c_no_tile)
+			{
+				triangle_order[next_triangle] = triangle;
+				++next_triangle;
+			}
+		}
+		if (next_triangle == first)
+		{
+			continue;
+		}
+
+		if (draw_call_count > 0 && draw_calls[draw_call_count - 1].texture == draw_call->texture && draw_calls[draw_call_count - 1].triangle_start + draw_calls[draw_call_count - 1].triangle_count == first)
+		{
+			draw_calls[draw_call_count - 1].triangle_count += next_triangle - first;
+		}
+		else
+		{
+			draw_calls[draw_call_count] = { first, next_triangle - first, draw_call->texture };
+			++draw_call_count;
+		}
+	}
+	assert(next_triangle == triangle_count);
+
+	// each vertex is copied once per tile and shift it's used with
+	uint32* first_copies = new uint32[model->vertex_count];
+	for (uint32 i = 0; i < model->vertex_count; ++i)
+	{
+		first_copies[i] = c_no_copy;
+	}
+	Vertex_Copy* copies = new Vertex_Copy[triangle_count * 3];
+	uint32 copy_count = 0;
+	Vec_3f* vertices = new Vec_3f[triangle_count * 3];
+	Vec_2f* texcoords = new Vec_2f[triangle_count * 3];
+	Vec_3f* normals = new Vec_3f[triangle_count * 3];
+	int32* new_triangles = new int32[triangle_count * 3];
+	for (uint32 i = 0; i < triangle_count; ++i)
+	{
+		const uint32 triangle = triangle_order[i];
+		const uint32 tile_i = triangle_tiles[triangle];
+		const int32 shift_u = triangle_shifts[triangle * 2];
+		const int32 shift_v = triangle_shifts[(triangle * 2) + 1];
+		for (uint32 corner = 0; corner < 3; ++corner)
+		{
+			const uint32 vertex = triangles[(triangle * 3) + corner];
+			uint32 copy = first_copies[vertex];
+			while (copy != c_no_copy && (copies[copy].tile != tile_i || copies[copy].shift_u != shift_u || copies[copy].shift_v != shift_v))
+			{
+				copy = copies[copy].next;
+			}
+
+			if (copy == c_no_copy)
+			{
+				copy = copy_count;
+				++copy_count;
+				copies[copy] = { tile_i, shift_u, shift_v, first_copies[vertex] };
+				first_copies[vertex] = copy;
+
+				vertices[copy] = model->vertices[vertex];
+				normals[copy] = model->normals[vertex];
+				texcoords[copy] = model->texcoords[vertex];
+				if (tile_i != c_no_tile)
+				{
+					const Atlas_Tile* tile = &atlas->tiles[tile_i];
+					texcoords[copy] = {
+						(tile->x + ((texcoords[copy].x - shift_u) * tile->texture->width)) / page->width,
+						(tile->y + ((texcoords[copy].y - shift_v) * tile->texture->height)) / page->height };
+				}
+			}
+
+			new_triangles[(i * 3) + corner] = (int32)copy;
+		}
+	}
+
+	delete[] model->vertices;
+	delete[] model->texcoords;
+	delete[] model->normals;
+	delete[] model->triangles;
+	delete[] model->draw_calls;
+
+	model->vertex_count = copy_count;
+	model->vertices = new Vec_3f[copy_count];
+	model->texcoords = new Vec_2f[copy_count];
+	model->normals = new Vec_3f[copy_count];
+	memcpy(model->vertices, vertices, copy_count * sizeof(Vec_3f));
+	memcpy(model->texcoords, texcoords, copy_count * sizeof(Vec_2f));
+	memcpy(model->normals, normals, copy_count * sizeof(Vec_3f));
+	model->triangles = new_triangles;
+	model->draw_call_count = draw_call_count;
+	model->draw_calls = new Draw_Call[draw_call_count];
+	memcpy(model->draw_calls, draw_calls, draw_call_count * sizeof(Draw_Call));
+
+	model->lods[0].triangles = model->triangles;
+	model->lods[0].draw_calls = model->draw_calls;
+	model->lods[0].vertex_count = model->vertex_count;
+
+	delete[] vertices;
+	delete[] texcoords;
+	delete[] normals;
+	delete[] copies;
+	delete[] first_copies;
+	delete[] draw_calls;
+	delete[] triangle_order;
+	delete[] triangle_tiles;
+	delete[] triangle_shifts;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "graphics.h"
+
+
+constexpr uint32 c_max_atlas_texture_size = 128;
+// triangles needing more repeats than this keep their own texture
+constexpr uint32 c_max_atlas_repeats = 4;
+// texels of wrapped border round each tile, for texcoords that round out
+constexpr uint32 c_atlas_gutter = 2;
+
+// Where a texture is on the atlas page. The texture's laid out repeats_u
+// times across and repeats_v times down, so triangles with texcoords which
+// wrap still only sample their own tile, once they're shifted by whole
+// repeats to start in the first one.
+struct Atlas_Tile
+{
+	const Texture* texture;
+	// the first repeat's top left texel
+	uint32 x;
+	uint32 y;
+	uint32 repeats_u;
+	uint32 repeats_v;
+};
+
+// One page of every small texture the models use, with as many repeats of
+// each as the widest triangle using it needs.
+struct Texture_Atlas
+{
+	Texture page;
+	Atlas_Tile* tiles;
+	uint32 tile_count;
+};
+
+
+// Textures bigger than c_max_atlas_texture_size either way are left out.
+// Tiles are packed in shelves, tallest first, onto a page about as wide as
+// it is tall.
+Texture_Atlas texture_atlas_create(const Model* models, uint32 model_count);
+void texture_atlas_destroy(Texture_Atlas* atlas);
+
+// Moves the model's triangles onto the atlas page where they fit, then merges
+// its draw calls sharing a texture, so a model with all its textures in the
+// atlas is one draw call. Vertices used by triangles shifted by different
+// repeats, or by triangles on and off the page, are split. Run before
+// model_generate_lods, with an atlas made from the model.
+void model_use_atlas(Model* model, const Texture_Atlas* atlas);